@@ -0,0 +1,67 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/crc16.h"
+
+// Measures CRC-16/Modbus throughput for single gripper frames and for bulk data.
+
+using Clock = std::chrono::steady_clock;
+using CrcFunction = uint16_t (*)(const uint8_t*, size_t, uint16_t);
+
+volatile uint16_t sink; // Keeps the compiler from discarding the results
+
+double NanosecondsPerCall(CrcFunction crc, const std::vector<uint8_t>& data, size_t length, size_t iterations) {
+    uint16_t accumulator = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        size_t offset = (i * length) % (data.size() - length);
+        accumulator ^= crc(data.data() + offset, length, Crc16::INITIAL);
+    }
+    auto end = Clock::now();
+    sink = accumulator;
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+int main() {
+    std::vector<uint8_t> data(1 << 20);
+    std::mt19937 rng(42);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(rng());
+    }
+
+    for (size_t i = 0; i + 64 < data.size(); i += 4099) {
+        size_t length = i % 64;
+        uint16_t expected = Crc16::Bitwise(data.data() + i, length);
+        if (Crc16::Bytewise(data.data() + i, length) != expected || Crc16::Compute(data.data() + i, length) != expected) {
+            std::cerr << "CRC mismatch at offset " << i << " length " << length << std::endl;
+            return 1;
+        }
+    }
+
+    struct Variant {
+        std::string name;
+        CrcFunction function;
+    };
+    std::vector<Variant> variants {
+        {"bitwise", Crc16::Bitwise},
+        {"bytewise", Crc16::Bytewise},
+        {"slice-by-4", Crc16::Compute},
+    };
+
+    std::cout << "6 byte frame (ns/frame)" << std::endl;
+    for (auto& variant : variants) {
+        std::cout << "  " << variant.name << ": " << NanosecondsPerCall(variant.function, data, 6, 10000000) << std::endl;
+    }
+
+    std::cout << "4096 byte block (MB/s)" << std::endl;
+    for (auto& variant : variants) {
+        double ns = NanosecondsPerCall(variant.function, data, 4096, 20000);
+        std::cout << "  " << variant.name << ": " << 4096.0 / ns * 1000.0 << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/logging.h"
+#include "../include/frame_ring.h"
+
+// Measures what retaining recipe results costs the thread pushing them, and checks that a dump writes the
+// last frames in order without holding up that thread.
+// A synthetic source stands in for the recipe's output observer. Its frames reference a shared image
+// buffer, like the pylon images a recipe outputs, so recording one never copies pixels.
+//
+// Usage: frame_ring_benchmark [frames] [ring size] [dump directory]
+
+int Logger::log_level_ = Logger::Level::ERR;
+
+using Clock = std::chrono::steady_clock;
+
+struct SyntheticFrame {
+    std::vector<double> scores;
+    std::vector<double> positions;
+    std::shared_ptr<const std::vector<unsigned char>> image; // Shared like a grab buffer
+};
+
+SyntheticFrame MakeFrame(std::mt19937& rng, const std::shared_ptr<const std::vector<unsigned char>>& image) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    SyntheticFrame frame;
+    size_t count = rng() % 3;
+    for (size_t i = 0; i < count; ++i) {
+        frame.scores.push_back(unit(rng));
+        frame.positions.push_back(unit(rng));
+        frame.positions.push_back(unit(rng));
+    }
+    frame.image = image;
+    return frame;
+}
+
+// Time per push of a source that does nothing but push, with the ring recording or not
+double PushTime(FrameRing<SyntheticFrame>& ring, const std::vector<SyntheticFrame>& frames, size_t pushes) {
+    auto start = Clock::now();
+    for (size_t i = 0; i < pushes; ++i) {
+        ring.Record(frames[i % frames.size()], Clock::now());
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / pushes;
+}
+
+int main(int argc, char* argv[]) {
+    size_t pushes = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t capacity = argc > 2 ? std::stoul(argv[2]) : 16;
+    std::filesystem::path root = argc > 3 ? argv[3] : (std::filesystem::temp_directory_path() / "frame_ring_benchmark");
+
+    std::mt19937 rng(1);
+    auto image = std::make_shared<const std::vector<unsigned char>>(640 * 480, 128);
+    std::vector<SyntheticFrame> frames;
+    for (size_t i = 0; i < 64; ++i) {
+        frames.push_back(MakeFrame(rng, image));
+    }
+
+    FrameRing<SyntheticFrame> disabled(0);
+    FrameRing<SyntheticFrame> ring(capacity);
+    ring.SetTag("scan");
+    double disabled_ns = PushTime(disabled, frames, pushes);
+    double enabled_ns = PushTime(ring, frames, pushes);
+
+    // Dump while the source keeps pushing, as a failing cycle would
+    std::filesystem::remove_all(root);
+    size_t images_written = 0;
+    FrameDumper<SyntheticFrame> dumper(
+        [&](const FrameRing<SyntheticFrame>::Entry& frame, const std::filesystem::path& directory, std::ostream& index) {
+            index << "," << frame.value.scores.size();
+            std::string name = "frame_" + std::to_string(frame.info.sequence) + ".raw";
+            std::ofstream file(directory / name, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(frame.value.image->data()), frame.value.image->size());
+            index << "," << name;
+            ++images_written;
+        },
+        ",detections,image");
+
+    auto snapshot_start = Clock::now();
+    auto snapshot = ring.Snapshot();
+    uint64_t newest = ring.Recorded();
+    auto directory = dumper.Dump(std::move(snapshot), root, "benchmark");
+    double dump_us = std::chrono::duration<double, std::micro>(Clock::now() - snapshot_start).count();
+    double during_ns = PushTime(ring, frames, pushes / 10);
+    auto write_start = Clock::now();
+    dumper.Flush();
+    double write_ms = std::chrono::duration<double, std::milli>(Clock::now() - write_start).count();
+
+    // The index must list the last capacity frames recorded before the dump, oldest first
+    std::ifstream index(directory / "index.csv");
+    std::string line;
+    std::getline(index, line);
+    size_t lines = 0, out_of_order = 0;
+    uint64_t expected = newest - (std::min<uint64_t>)(capacity, newest) + 1;
+    while (std::getline(index, line)) {
+        if (std::stoull(line.substr(0, line.find(','))) != expected++)
+            ++out_of_order;
+        ++lines;
+    }
+    size_t expected_lines = (std::min<size_t>)(capacity, pushes);
+
+    std::cout << "Pushes " << pushes << ", ring of " << capacity << " frames" << std::endl;
+    std::cout << "Push without ring " << disabled_ns << " ns, with ring " << enabled_ns << " ns, while dumping "
+              << during_ns << " ns" << std::endl;
+    std::cout << "Dump returned after " << dump_us << " us, written in the background in " << write_ms << " ms to "
+              << directory.string() << std::endl;
+    std::cout << "Frames dumped " << lines << " of " << expected_lines << ", images " << images_written
+              << ", out of order " << out_of_order << std::endl;
+
+    std::filesystem::remove_all(root);
+    return lines == expected_lines && images_written == expected_lines && out_of_order == 0 ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../include/logging.h"
+#include "../include/simple_serial.h"
+#include "../include/sel_interface.h"
+#include "../include/halt_watchdog.h"
+
+// Measures the time from a halt request to the HLT command being written while another thread polls the
+// axis status as fast as the link allows, the load a scan puts on the SEL link.
+// A simulated SEL controller on a pseudo terminal answers each command after the transmit time of the
+// command and its reply at the configured baud rate. POSIX only.
+//
+// Usage: halt_benchmark [halts] [baud]
+
+int Logger::log_level_ = Logger::Level::ERR;
+
+/**
+ * Answers STA and HLT commands on the controller side of a pseudo terminal.
+ */
+class SimulatedController {
+public:
+    SimulatedController(int fd, uint32_t baud) : fd_(fd), baud_(baud), thread_([this]() { Run(); }) {}
+
+    ~SimulatedController() {
+        running_ = false;
+        thread_.join();
+    }
+
+    uint64_t Halts() const {
+        return halts_;
+    }
+
+private:
+    int fd_;
+    uint32_t baud_;
+    std::atomic<bool> running_{true};
+    std::atomic<uint64_t> halts_{0};
+    std::thread thread_;
+
+    // 10 bits per byte with one start and one stop bit
+    void Transmit(size_t bytes) {
+        std::this_thread::sleep_for(std::chrono::microseconds(bytes * 10 * 1000000 / baud_));
+    }
+
+    void Run() {
+        std::string command;
+        char c;
+        while (running_) {
+            fd_set read_set;
+            FD_ZERO(&read_set);
+            FD_SET(fd_, &read_set);
+            timeval timeout{0, 10000};
+            if (select(fd_ + 1, &read_set, nullptr, nullptr, &timeout) <= 0)
+                continue;
+            if (read(fd_, &c, 1) != 1)
+                continue;
+            command += c;
+            if (command.size() < 4 || command.compare(command.size() - 4, 4, "@@\r\n") != 0)
+                continue;
+
+            Transmit(command.size());
+            std::string reply;
+            if (command.compare(0, 6, "?99STA") == 0) {
+                reply = "#99STA21100000150.00011000000075.000@@\r\n";
+            }
+            else if (command.compare(0, 6, "!99HLT") == 0) {
+                reply = "#99HLT@@\r\n";
+                ++halts_;
+            }
+            else {
+                reply = "#99ERR@@\r\n";
+            }
+            command.clear();
+
+            Transmit(reply.size());
+            if (write(fd_, reply.data(), reply.size()) != static_cast<ssize_t>(reply.size()))
+                std::cerr << "Controller write failed" << std::endl;
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    size_t halts = argc > 1 ? std::stoul(argv[1]) : 100;
+    uint32_t baud = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 9600;
+
+    int controller_fd, link_fd;
+    char name[256];
+    if (openpty(&controller_fd, &link_fd, name, nullptr, nullptr) != 0) {
+        std::cerr << "openpty failed" << std::endl;
+        return 1;
+    }
+    termios raw;
+    tcgetattr(controller_fd, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(controller_fd, TCSANOW, &raw);
+    tcsetattr(link_fd, TCSANOW, &raw);
+
+    SimulatedController controller(controller_fd, baud);
+    SimpleSerial sel(name, baud);
+
+    auto& watchdog = HaltWatchdog::Instance();
+    watchdog.Register(sel);
+    watchdog.Start();
+
+    // Poll the status continuously; every reply must be a status reply if the halt replies are skipped
+    std::atomic<bool> polling{true};
+    std::atomic<uint64_t> polls{0}, out_of_step{0};
+    std::thread poller([&]() {
+        while (polling) {
+            auto reply = SEL_Interface::AxisInquiry(sel);
+            if (reply.compare(0, 6, "#99STA") != 0)
+                ++out_of_step;
+            ++polls;
+        }
+    });
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pause_us(50000, 150000); // Several polls between halts
+    for (size_t i = 0; i < halts; ++i) {
+        std::this_thread::sleep_for(std::chrono::microseconds(pause_us(rng)));
+        watchdog.Halt(sel);
+        watchdog.Release(sel);
+    }
+
+    // Let the last halt reply arrive before stopping the poller
+    while (controller.Halts() < halts) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    polling = false;
+    poller.join();
+    watchdog.Stop();
+    watchdog.Unregister(sel);
+
+    double transmit_ms = 12 * 10 * 1000.0 / baud; // "!99HLT03@@\r\n"
+    std::cout << "Halts " << halts << " at " << baud << " baud under " << polls << " status polls" << std::endl;
+    std::cout << "Request to HLT written: " << watchdog.RequestToWrite().Summary() << std::endl;
+    std::cout << "HLT transmit time " << transmit_ms << " ms, controller received " << controller.Halts() << " halts" << std::endl;
+    std::cout << "Halt replies skipped " << sel.unsolicitedSkipped() << ", status replies out of step " << out_of_step << std::endl;
+    return out_of_step == 0 ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/async.h"
+#include "../include/mailbox.h"
+
+// Measures the hand-off of detection results from a producer thread to a waiting consumer.
+// A synthetic source stands in for the recipe's output observer. The mailbox is compared against a
+// mutex, condition variable and list, the same shape as the previous CLock/WaitObjectEx hand-off, and against
+// a coroutine awaiting the mailbox on an asio event loop, as the cycle coroutines do.
+
+using Clock = std::chrono::steady_clock;
+
+struct SyntheticResult {
+    std::vector<double> scores;
+    std::vector<double> positions;
+};
+
+SyntheticResult MakeResult(std::mt19937& rng) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    SyntheticResult result;
+    size_t count = rng() % 3;
+    for (size_t i = 0; i < count; ++i) {
+        result.scores.push_back(unit(rng));
+        result.positions.push_back(unit(rng));
+        result.positions.push_back(unit(rng));
+    }
+    return result;
+}
+
+// Previous design: lock, clear the queue, push, signal; the consumer waits, then locks again to pop.
+class LockedQueue {
+public:
+    void Publish(SyntheticResult value, Clock::time_point timestamp) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.clear();
+            queue_.emplace_back(std::move(value), timestamp);
+        }
+        condition_.notify_one();
+    }
+
+    bool WaitFor(SyntheticResult& value, FrameInfo& info, std::chrono::nanoseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!condition_.wait_for(lock, timeout, [&]() { return !queue_.empty(); }))
+            return false;
+        value = std::move(queue_.front().first);
+        info.timestamp = queue_.front().second;
+        info.sequence = ++taken_;
+        queue_.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::list<std::pair<SyntheticResult, Clock::time_point>> queue_;
+    uint64_t taken_{0};
+};
+
+class MailboxAdapter {
+public:
+    void Publish(SyntheticResult value, Clock::time_point timestamp) {
+        mailbox_.Publish(std::move(value), timestamp);
+    }
+
+    bool WaitFor(SyntheticResult& value, FrameInfo& info, std::chrono::nanoseconds timeout) {
+        return mailbox_.WaitFor(value, info, info.sequence, Clock::time_point(), timeout);
+    }
+
+    Mailbox<SyntheticResult> mailbox_;
+};
+
+struct Report {
+    uint64_t published{0};
+    uint64_t received{0};
+    LatencyHistogram hand_off; // Publish until the consumer holds the result
+};
+
+/**
+ * \param frame_period Time between results, zero to publish as fast as possible
+ */
+template <typename Channel>
+void Run(Channel& channel, size_t frames, std::chrono::microseconds frame_period, Report& report) {
+    std::atomic<bool> done{false};
+
+    std::thread consumer([&]() {
+        SyntheticResult result;
+        FrameInfo info;
+        while (!done.load(std::memory_order_acquire)) {
+            if (channel.WaitFor(result, info, std::chrono::milliseconds(10))) {
+                report.hand_off.Record(Clock::now() - info.timestamp);
+                ++report.received;
+            }
+        }
+    });
+
+    std::mt19937 rng(7);
+    auto next = Clock::now();
+    for (size_t i = 0; i < frames; ++i) {
+        if (frame_period.count() > 0) {
+            next += frame_period;
+            while (Clock::now() < next) {
+                std::this_thread::sleep_until(next);
+            }
+        }
+        channel.Publish(MakeResult(rng), Clock::now());
+        ++report.published;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    done.store(true, std::memory_order_release);
+    consumer.join();
+}
+
+/**
+ * Same as Run, with the consumer a coroutine on an event loop woken through the mailbox's listener.
+ */
+void RunOnEventLoop(MailboxAdapter& channel, size_t frames, std::chrono::microseconds frame_period, Report& report) {
+    std::atomic<bool> done{false};
+    Async::MailboxWaiter<SyntheticResult> waiter(channel.mailbox_);
+
+    std::thread consumer([&]() {
+        Async::Run([&]() -> Async::Task<void> {
+            SyntheticResult result;
+            FrameInfo info;
+            while (!done.load(std::memory_order_acquire)) {
+                if (co_await waiter.WaitFor(result, info, info.sequence, Clock::time_point(), std::chrono::milliseconds(10))) {
+                    report.hand_off.Record(Clock::now() - info.timestamp);
+                    ++report.received;
+                }
+            }
+        }());
+    });
+
+    std::mt19937 rng(7);
+    auto next = Clock::now();
+    for (size_t i = 0; i < frames; ++i) {
+        if (frame_period.count() > 0) {
+            next += frame_period;
+            while (Clock::now() < next) {
+                std::this_thread::sleep_until(next);
+            }
+        }
+        channel.Publish(MakeResult(rng), Clock::now());
+        ++report.published;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    done.store(true, std::memory_order_release);
+    consumer.join();
+}
+
+void Print(const std::string& name, const Report& report) {
+    std::cout << std::left << std::setw(28) << name << std::right
+              << std::setw(9) << report.published << " published "
+              << std::setw(9) << report.received << " received  hand-off " << report.hand_off.Summary() << std::endl;
+}
+
+int main() {
+    struct Load {
+        std::string name;
+        size_t frames;
+        std::chrono::microseconds period;
+    };
+    std::vector<Load> loads {
+        {"camera rate (50 Hz)", 200, std::chrono::microseconds(20000)},
+        {"fast camera (1 kHz)", 2000, std::chrono::microseconds(1000)},
+        {"unthrottled", 200000, std::chrono::microseconds(0)},
+    };
+
+    for (auto& load : loads) {
+        std::cout << load.name << std::endl;
+
+        LockedQueue locked;
+        Report locked_report;
+        Run(locked, load.frames, load.period, locked_report);
+        Print("  mutex + condition + list", locked_report);
+
+        MailboxAdapter mailbox;
+        Report mailbox_report;
+        Run(mailbox, load.frames, load.period, mailbox_report);
+        Print("  mailbox", mailbox_report);
+        std::cout << "  mailbox wake latency      " << mailbox.mailbox_.WakeLatency().Summary() << std::endl;
+        std::cout << "  mailbox overwritten       " << mailbox.mailbox_.Overwritten() << std::endl;
+
+        MailboxAdapter event_loop;
+        Report event_loop_report;
+        RunOnEventLoop(event_loop, load.frames, load.period, event_loop_report);
+        Print("  mailbox on event loop", event_loop_report);
+    }
+
+    return 0;
+}
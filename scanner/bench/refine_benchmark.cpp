@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/xy.h"
+#include "../include/refine_estimator.h"
+
+// Replays the refinement loop against a simulated camera and stage and compares acting on single frames
+// with averaging several frames once settled. Noise levels follow monte_carlo/constants.py.
+
+struct Scenario {
+    double tolerance{0.1};          // mm, fixed connector tolerance
+    double scale_factor{0.59};      // Correction applied per move, as in CycleParameters
+    double camera_gain{1.5};        // Measured distance over actual distance
+    double camera_noise{0.0194};    // mm, standard deviation per axis per frame
+    double outlier_rate{0.03};      // Probability of a frame placing the connector far off
+    double outlier_offset{0.5};     // mm
+    double stage_noise{0.01};       // mm, standard deviation of where a move ends up
+    double initial_error{2.0};      // mm, largest offset after the scan stops
+    double frame_time{0.05};        // s, one frame at 20 fps
+    double move_time{0.3};          // s, a short correction move including settling
+    int max_moves{30};
+};
+
+struct Outcome {
+    bool success{false};
+    int moves{0};
+    int frames{0};
+    double final_error{0.0}; // mm, actual offset when the loop declared success
+};
+
+Outcome RunRefinement(const Scenario& scenario, const RefinementSettings& settings, std::mt19937& rng) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> camera(0.0, scenario.camera_noise);
+    std::normal_distribution<double> stage(0.0, scenario.stage_noise);
+
+    double angle = unit(rng) * 2.0 * std::acos(-1.0);
+    double radius = std::sqrt(unit(rng)) * scenario.initial_error;
+    XY actual(radius * std::cos(angle), radius * std::sin(angle)); // Offset from the camera center to the connector
+
+    Outcome outcome;
+    std::vector<OffsetSample> samples;
+    while (outcome.moves <= scenario.max_moves) {
+        XY measured = actual * scenario.camera_gain + XY(camera(rng), camera(rng));
+        if (unit(rng) < scenario.outlier_rate)
+            measured = measured + XY(scenario.outlier_offset, -scenario.outlier_offset);
+        samples.push_back({measured, 0.7 + 0.3 * unit(rng)});
+        ++outcome.frames;
+
+        auto decision = DecideRefinement(samples, settings, scenario.tolerance, scenario.scale_factor);
+        if (decision.need_more_frames)
+            continue;
+
+        if (decision.within_tolerance) {
+            outcome.success = true;
+            outcome.final_error = actual.magnitude();
+            return outcome;
+        }
+
+        actual = actual + decision.correction + XY(stage(rng), stage(rng));
+        samples.clear();
+        ++outcome.moves;
+    }
+    return outcome;
+}
+
+void Report(const std::string& name, const Scenario& scenario, const RefinementSettings& settings, int runs) {
+    std::mt19937 rng(11);
+    std::vector<int> moves;
+    int frames = 0, failures = 0, out_of_tolerance = 0;
+    double final_error = 0.0;
+
+    for (int i = 0; i < runs; ++i) {
+        auto outcome = RunRefinement(scenario, settings, rng);
+        if (!outcome.success) {
+            ++failures;
+            continue;
+        }
+        moves.push_back(outcome.moves);
+        frames += outcome.frames;
+        final_error += outcome.final_error;
+        if (outcome.final_error > scenario.tolerance)
+            ++out_of_tolerance;
+    }
+
+    std::sort(moves.begin(), moves.end());
+    double successes = (std::max)(moves.size(), size_t(1));
+    double mean_moves = 0.0;
+    for (int count : moves) {
+        mean_moves += count;
+    }
+    mean_moves /= successes;
+    double time = (frames * scenario.frame_time + mean_moves * successes * scenario.move_time) / successes;
+
+    std::cout << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(2)
+              << " moves mean " << mean_moves << " p95 " << (moves.empty() ? 0 : moves[moves.size() * 95 / 100])
+              << ", frames " << frames / successes << ", time " << time << " s"
+              << ", final error " << std::setprecision(3) << final_error / successes << " mm"
+              << ", out of tolerance " << std::setprecision(2) << 100.0 * out_of_tolerance / runs << " %"
+              << ", failed " << 100.0 * failures / runs << " %" << std::endl;
+}
+
+int main() {
+    const int runs = 20000;
+
+    struct Case {
+        double tolerance;
+        double camera_noise;
+    };
+    for (auto [tolerance, noise] : {Case{0.1, 0.0194}, Case{0.1, 0.05}, Case{1.0, 0.0194}}) {
+        Scenario scenario;
+        scenario.tolerance = tolerance;
+        scenario.camera_noise = noise;
+        std::cout << "Tolerance " << tolerance << " mm, camera noise " << noise << " mm" << std::endl;
+
+        RefinementSettings single;
+        single.max_frames = 1;
+        Report("  single frame", scenario, single, runs);
+
+        RefinementSettings fixed_five;
+        fixed_five.min_frames = 5;
+        fixed_five.max_frames = 5;
+        Report("  always 5 frames", scenario, fixed_five, runs);
+
+        RefinementSettings adaptive;
+        adaptive.frame_noise = noise;
+        Report("  adaptive", scenario, adaptive, runs);
+    }
+    return 0;
+}
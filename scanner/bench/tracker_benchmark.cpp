@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/xy.h"
+#include "../include/detection_tracker.h"
+
+// Replays synthetic scan passes over a single connector with random false positives and compares
+// stopping at the first detection against stopping at the first confirmed track.
+
+struct Scenario {
+    double speed{200.0};           // mm/s
+    double frame_rate{20.0};       // Hz
+    double field_of_view{35.0};    // mm, square, one scan width
+    double pass_length{450.0};     // mm
+    XY target{XY(0.0, 300.0)};     // mm, stage position centering the camera on the connector
+    double detection_rate{0.9};    // Probability the connector is detected while in view
+    double position_noise{0.5};    // mm, standard deviation
+    double false_positive_rate{0.05}; // Probability of a spurious detection per frame
+};
+
+struct Outcome {
+    bool stopped{false};
+    bool false_stop{false};
+    int frames_in_view{0}; // Frames from the connector entering the view until the stop
+    double error{0.0};     // mm, distance from the stop target to the connector
+};
+
+template <typename Policy>
+Outcome RunPass(const Scenario& scenario, std::mt19937& rng, Policy policy) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, scenario.position_noise);
+    double half_view = scenario.field_of_view / 2.0;
+    double step = scenario.speed / scenario.frame_rate;
+
+    Outcome outcome;
+    for (double y = 0.0; y <= scenario.pass_length; y += step) {
+        XY stage(0.0, y);
+        std::vector<Detection> detections;
+
+        XY offset = scenario.target - stage;
+        bool in_view = std::abs(offset.x) <= half_view && std::abs(offset.y) <= half_view;
+        if (in_view) {
+            ++outcome.frames_in_view;
+            if (unit(rng) < scenario.detection_rate) {
+                detections.push_back({scenario.target + XY(noise(rng), noise(rng)), 0.6 + 0.4 * unit(rng)});
+            }
+        }
+
+        if (unit(rng) < scenario.false_positive_rate) {
+            XY spurious = stage + XY((unit(rng) - 0.5) * scenario.field_of_view, (unit(rng) - 0.5) * scenario.field_of_view);
+            detections.push_back({spurious, 0.3 + 0.6 * unit(rng)});
+        }
+
+        XY stop_target;
+        if (policy(detections, stop_target)) {
+            outcome.stopped = true;
+            outcome.error = (stop_target - scenario.target).magnitude();
+            outcome.false_stop = outcome.error > 5.0;
+            return outcome;
+        }
+    }
+    return outcome;
+}
+
+template <typename MakePolicy>
+void Report(const char* name, const Scenario& scenario, int passes, MakePolicy make_policy) {
+    std::mt19937 rng(7);
+    int stops = 0, false_stops = 0, frames = 0;
+    double error = 0.0;
+
+    for (int i = 0; i < passes; ++i) {
+        auto outcome = RunPass(scenario, rng, make_policy());
+        if (!outcome.stopped)
+            continue;
+        ++stops;
+        if (outcome.false_stop) {
+            ++false_stops;
+            continue;
+        }
+        frames += outcome.frames_in_view;
+        error += outcome.error;
+    }
+
+    int true_stops = stops - false_stops;
+    std::cout << name << ": false stops " << 100.0 * false_stops / passes << " %, missed "
+              << 100.0 * (passes - stops) / passes << " %, frames to commit "
+              << (true_stops ? double(frames) / true_stops : 0.0) << ", stop error "
+              << (true_stops ? error / true_stops : 0.0) << " mm" << std::endl;
+}
+
+int main() {
+    Scenario scenario;
+    const int passes = 20000;
+
+    Report("first detection", scenario, passes, []() {
+        return [](const std::vector<Detection>& detections, XY& target) {
+            if (detections.empty())
+                return false;
+            target = detections[0].position;
+            return true;
+        };
+    });
+
+    for (int hits : {2, 3, 4}) {
+        TrackerSettings settings;
+        settings.confirm_hits = hits;
+        std::string name = "tracker, " + std::to_string(hits) + " hits";
+        Report(name.c_str(), scenario, passes, [settings]() {
+            auto tracker = std::make_shared<DetectionTracker>(settings);
+            return [tracker](const std::vector<Detection>& detections, XY& target) {
+                auto track = tracker->Update(detections);
+                if (!track)
+                    return false;
+                target = track->position;
+                return true;
+            };
+        });
+    }
+
+    // Cost of a single update with a handful of live tracks
+    DetectionTracker tracker;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> position(0.0, 30.0);
+    const int updates = 1000000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < updates; ++i) {
+        tracker.Update({{XY(position(rng), position(rng)), 0.8}, {XY(position(rng), position(rng)), 0.5}});
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / updates;
+    std::cout << "Update with 2 detections: " << ns << " ns" << std::endl;
+    return 0;
+}
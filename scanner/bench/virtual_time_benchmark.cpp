@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/async.h"
+#include "../include/clock.h"
+#include "../include/cycle_simulator.h"
+#include "../include/link_scheduler.h"
+#include "../include/logging.h"
+#include "../include/mailbox.h"
+
+// Runs the waits of a cycle in real time and in virtual time, checks that both take the same cycle time,
+// and measures how many cycles per second virtual time runs.
+// The cycle uses the primitives the scanner's cycle waits with: a camera coroutine publishes frames to a
+// Mailbox at the frame rate, the cycle awaits them with a MailboxWaiter and a timeout while the stage moves,
+// polls the status through the LinkScheduler between moves and blocks in Time::SleepFor for the gripper.
+// Then runs whole cycles of the scanner's scan and refine loops on CycleSimulator's simulated stage and
+// camera, which only run in virtual time, and checks that a cycle repeats exactly.
+//
+// Usage: virtual_time_benchmark [virtual cycles] [moves per cycle]
+
+using Clock = Time::Clock;
+using namespace std::chrono_literals;
+
+int Logger::log_level_ = Logger::Level::OFF;
+
+struct Frame {
+    double score{0.0};
+};
+
+struct CycleStats {
+    double time{0.0}; // s, on the clock the cycle ran on
+    uint64_t frames{0};
+    uint64_t timeouts{0};
+    uint64_t polls{0};
+};
+
+constexpr auto FRAME_PERIOD = 33ms;
+constexpr auto FRAME_TIMEOUT = 100ms; // Like PylonRecipe's RESULT_TIMEOUT
+constexpr auto POLL_PERIOD = 5ms;     // Like Commander::MOTION_POLL_PERIOD
+constexpr auto GRIPPER_SETTLE = 250ms;
+constexpr size_t STATUS_BYTES = 50;
+
+Async::Task<void> Camera(Mailbox<Frame>& mailbox, const bool& done) {
+    double score = 0.0;
+    while (!done) {
+        co_await Async::Sleep(FRAME_PERIOD);
+        mailbox.Publish(Frame{score += 1.0}, Clock::now());
+    }
+}
+
+// A scan move of the given duration, taking frames until it ends, then polls until the stage reports stopped
+Async::Task<void> Move(Async::MailboxWaiter<Frame>& waiter, LinkScheduler& link, Clock::duration duration, CycleStats& stats) {
+    auto end = Clock::now() + duration;
+    FrameInfo info;
+    Frame frame;
+    while (Clock::now() < end) {
+        if (co_await waiter.WaitFor(frame, info, info.sequence, Clock::time_point(), FRAME_TIMEOUT))
+            ++stats.frames;
+        else
+            ++stats.timeouts;
+    }
+    for (int poll = 0; poll < 3; ++poll) {
+        co_await Async::Sleep(link.StatusDelay());
+        link.Record(LinkPriority::STATUS, STATUS_BYTES);
+        ++stats.polls;
+        co_await Async::Sleep(POLL_PERIOD);
+    }
+}
+
+Async::Task<void> Cycle(size_t moves, CycleStats& stats) {
+    auto start = Clock::now();
+    Mailbox<Frame> mailbox;
+    Async::MailboxWaiter<Frame> waiter(mailbox);
+    LinkScheduler link(9600);
+    bool done = false;
+
+    auto executor = co_await boost::asio::this_coro::executor;
+    boost::asio::co_spawn(executor, Camera(mailbox, done), boost::asio::detached);
+
+    for (size_t i = 0; i < moves; ++i) {
+        co_await Move(waiter, link, std::chrono::milliseconds(100 + 40 * (i % 5)), stats);
+    }
+
+    // Grasp and mate: the gripper's waits block the loop
+    link.WaitForStatus();
+    Time::SleepFor(GRIPPER_SETTLE);
+    co_await Async::Sleep(100ms);
+    Time::SleepFor(GRIPPER_SETTLE);
+
+    done = true;
+    co_await Async::Sleep(FRAME_PERIOD); // Lets the camera see done and finish
+    stats.time = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+CycleStats RunCycle(size_t moves) {
+    CycleStats stats;
+    Async::Run(Cycle(moves, stats));
+    return stats;
+}
+
+int main(int argc, char* argv[]) {
+    size_t cycles = argc > 1 ? std::stoul(argv[1]) : 10000;
+    size_t moves = argc > 2 ? std::stoul(argv[2]) : 8;
+
+    auto wall_start = std::chrono::steady_clock::now();
+    CycleStats real = RunCycle(moves);
+    double real_wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    CycleStats simulated;
+    double total_time = 0.0;
+    bool consistent = true;
+    wall_start = std::chrono::steady_clock::now();
+    {
+        Time::VirtualTime virtual_time;
+        for (size_t i = 0; i < cycles; ++i) {
+            CycleStats stats = RunCycle(moves);
+            if (i == 0)
+                simulated = stats;
+            else if (stats.time != simulated.time || stats.frames != simulated.frames)
+                consistent = false; // Virtual time makes every cycle identical
+            total_time += stats.time;
+        }
+    }
+    double virtual_wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    std::cout << "Real time: cycle " << real.time * 1000.0 << " ms, " << real.frames << " frames, " << real.timeouts
+              << " timeouts, " << real.polls << " polls, " << real_wall * 1000.0 << " ms wall" << std::endl;
+    std::cout << "Virtual time: cycle " << simulated.time * 1000.0 << " ms, " << simulated.frames << " frames, "
+              << simulated.timeouts << " timeouts, " << simulated.polls << " polls" << std::endl;
+    std::cout << "Virtual time ran " << cycles << " cycles (" << total_time / 3600.0 << " h simulated) in "
+              << virtual_wall * 1000.0 << " ms wall, " << virtual_wall / cycles * 1e6 << " us per cycle, "
+              << total_time / virtual_wall << "x real time" << std::endl;
+
+    // Real time adds the wakeup latency of every wait, so allow a few ms per move and a frame either way
+    bool matches = std::abs(real.time - simulated.time) < 0.005 * (moves + 1) + 0.01 &&
+                   std::abs(double(real.frames) - double(simulated.frames)) <= moves && simulated.timeouts == 0;
+    // Scan, refine, grasp and mate through the loops of scan_refine.h
+    size_t simulated_cycles = (std::max)(cycles / 10, size_t(1));
+    CycleSimulator simulator(CycleParameters(), SimulatedWorld(), 1);
+    CycleEstimate estimate;
+    wall_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < simulated_cycles; ++i) {
+        estimate.Add(simulator.Run(i));
+    }
+    double simulator_wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    CycleOutcome first = simulator.Run(0);
+    CycleOutcome again = simulator.Run(0);
+    bool repeats = first.failure == again.failure && first.time == again.time && first.frames == again.frames;
+
+    std::cout << "Simulated " << simulated_cycles << " scan, refine and mate cycles (" << estimate.total_time / 3600.0
+              << " h simulated, " << estimate.SuccessRate() * 100.0 << " % mated) in " << simulator_wall * 1000.0
+              << " ms wall, " << simulator_wall / simulated_cycles * 1e6 << " us per cycle, "
+              << estimate.total_time / simulator_wall << "x real time" << std::endl;
+
+    if (!consistent)
+        std::cout << "Virtual cycles differ from each other" << std::endl;
+    if (!matches)
+        std::cout << "Virtual cycle does not match the real one" << std::endl;
+    if (!repeats)
+        std::cout << "Simulated cycle does not repeat" << std::endl;
+    return consistent && matches && repeats ? 0 : 1;
+}
@@ -1,3 +1,5 @@
+#ifndef OUTPUT_OBSERVER_H
+#define OUTPUT_OBSERVER_H
 
 // Include files to use the pylon API.
 #include <pylon/PylonIncludes.h>
@@ -5,18 +7,22 @@
 #include <pylondataprocessing/PylonDataProcessingIncludes.h>
 // The sample uses the std::vector.
 #include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "ResultData.h"
+#include "clock.h"
+#include "frame_ring.h"
+#include "mailbox.h"
 
 // RecipeOutputObserver is a helper object that shows how to handle output data
 // provided via the IOutputObserver::OutputDataPush interface method.
-// Also, MyOutputObserver implements a thread safe queue
-// for later processing while pulling the output data.
+// Only the newest result is kept, in a lock-free latest-value mailbox, so
+// consumers never process a backlog of frames that are already out of date.
 class RecipeOutputObserver : public Pylon::DataProcessing::IOutputObserver
 {
 public:
-    RecipeOutputObserver()
-            : m_waitObject(Pylon::WaitObjectEx::Create())
-    {
-    }
+    using Clock = Time::Clock;
 
     // Implements IOutputObserver::OutputDataPush.
     // This method is called when an output of the CRecipe pushes data out.
@@ -31,58 +37,78 @@ public:
         PYLON_UNUSED(update);
         PYLON_UNUSED(userProvidedId);
 
-        ResultData currentResultData;
-        currentResultData.fromVariantContainer(valueContainer);
+        // The push follows the capture by the processing time of the recipe,
+        // which is short compared to a move. The pylon results carry no capture time.
+        auto timestamp = Clock::now();
+
+        // Each thread of the pool decodes into a result of its own, which keeps the storage
+        // of the results it swaps out of the mailbox.
+        thread_local ResultData currentResultData;
+        m_decoder.Decode(valueContainer, currentResultData);
+
+        // Kept for diagnosing a failed cycle. Does nothing unless the ring has been sized.
+        m_frames.Record(currentResultData, timestamp);
 
+        // Replaces the previous result if it has not been read yet and wakes the consumer.
+        m_mailbox.PublishSwap(currentResultData, timestamp);
 
-        // Add data to the result queue in a thread-safe way.
-        {
-            Pylon::AutoLock scopedLock(m_memberLock);
-            if (m_queue.size() > 0)
-            {
-                m_queue.clear();
-            }
-            m_queue.emplace_back(currentResultData);
-        }
+        // Holds an older result now, which must not keep its image's grab buffer in use.
+        currentResultData.Recycle();
+    }
 
-        // Signal that data is ready.
-        m_waitObject.Signal();
+    // Looks up only the outputs the recipe has when decoding its pushes. Call for every recipe observed.
+    void RegisterOutputs(const Pylon::StringList_t& outputNames)
+    {
+        m_decoder.Register(outputNames);
     }
 
+    // Discards the unread result, e.g. one produced with settings that have since changed.
     void ClearOutputData() {
-        Pylon::AutoLock scopedLock(m_memberLock);
-        m_queue.clear();
-        m_waitObject.Reset();
+        m_mailbox.Clear();
     }
 
-    // Get the wait object for waiting for data.
-    const Pylon::WaitObject& GetWaitObject()
+    // Get the newest result if it has not been read yet.
+    bool GetResultData(ResultData& resultDataOut)
     {
-        return m_waitObject;
+        FrameInfo info;
+        return m_mailbox.TryTake(resultDataOut, info);
     }
 
-    // Get one result data object from the queue.
-    bool GetResultData(ResultData& resultDataOut)
+    // Waits for a result newer than afterSequence and pushed no earlier than afterTime.
+    // Older results taken while waiting are discarded and counted as stale.
+    // Must only be called from one thread at a time.
+    bool WaitForResult(
+            ResultData& resultDataOut,
+            FrameInfo& infoOut,
+            uint64_t afterSequence,
+            Clock::time_point afterTime,
+            std::chrono::milliseconds timeout)
     {
-        Pylon::AutoLock scopedLock(m_memberLock);
-        if (m_queue.empty())
-        {
-            return false;
-        }
-
-        resultDataOut = std::move(m_queue.front());
-        m_queue.pop_front();
-        if (m_queue.empty())
-        {
-            m_waitObject.Reset();
-        }
-        return true;
+        return m_mailbox.WaitFor(resultDataOut, infoOut, afterSequence, afterTime, timeout);
+    }
+
+    // The mailbox holding the newest result, for its counters and wake latency.
+    const Mailbox<ResultData>& GetMailbox() const
+    {
+        return m_mailbox;
+    }
+
+    // The mailbox holding the newest result, e.g. to await results on an event loop.
+    Mailbox<ResultData>& GetMailbox()
+    {
+        return m_mailbox;
+    }
+
+    // The last results pushed, including their images if the recipe outputs them.
+    FrameRing<ResultData>& GetFrameRing()
+    {
+        return m_frames;
     }
 
 private:
-    Pylon::CLock m_memberLock;        // The member lock is required to ensure
-    // thread-safe access to the member variables.
-    Pylon::WaitObjectEx m_waitObject; // Signals that ResultData is available.
-    // It is set if m_queue is not empty.
-    std::list<ResultData> m_queue;  // The queue of ResultData
+    ResultDecoder m_decoder; // Decodes the outputs listed in ResultData.schema.
+    Mailbox<ResultData> m_mailbox; // The newest ResultData and its sequence number.
+    FrameRing<ResultData> m_frames; // The last results, for dumping after a failure.
 };
+
+#endif // OUTPUT_OBSERVER_H
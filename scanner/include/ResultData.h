@@ -1,146 +1,182 @@
+// Generated by tools/gen_result_data.py from include/ResultData.schema.
+// Edit the schema and regenerate this file instead of editing it, see the README.
+#ifndef RESULT_DATA_H
+#define RESULT_DATA_H
+
 // Include files to use the pylon API.
 #include <pylon/PylonIncludes.h>
 // Extend the pylon API for using pylon data processing.
 #include <pylondataprocessing/PylonDataProcessingIncludes.h>
-// The sample uses the std::vector.
+#include <atomic>
+#include <cstdint>
+#include <string>
 #include <vector>
 
+#include "logging.h"
+
 // Declare a data class for one set of output data values.
 class ResultData
 {
 public:
-    ResultData()
-        : hasError(false)
+    // The outputs of the recipe, in the order of the schema.
+    enum Output
     {
-    }
+        FIXED_SCORE,
+        FIXED_POSITION,
+        MOBILE_SCORE,
+        MOBILE_POSITION,
+        IMAGE,
+        OUTPUT_COUNT
+    };
 
     std::vector<double> fixed_score;
     std::vector<Pylon::DataProcessing::SPointF2D> fixed_position;
     std::vector<double> mobile_score;
     std::vector<Pylon::DataProcessing::SPointF2D> mobile_position;
+    Pylon::CPylonImage image;       // Only pushed if the recipe has an output named image
 
-    bool hasError;                  // If something doesn't work as expected
+    bool hasError{false};           // If something doesn't work as expected
                                     // while processing data, this is set to true.
     Pylon::String_t errorMessage;   // Contains an error message if
                                     // hasError has been set to true.
 
-    void fromVariantContainer(const Pylon::DataProcessing::CVariantContainer& variantContainer)
+    // Name of an output in the recipe. Built once, so looking an output up constructs no key.
+    static const Pylon::String_t& OutputName(Output output)
     {
-        // fixed_score
-        auto posfixed_score = variantContainer.find("fixed_score");
-        if (posfixed_score != variantContainer.end())
+        static const Pylon::String_t names[OUTPUT_COUNT] = {
+            "fixed_score",
+            "fixed_position",
+            "mobile_score",
+            "mobile_position",
+            "image",
+        };
+        return names[output];
+    }
+
+    // Drops what this result shares with the recipe, e.g. images holding grab buffers,
+    // and keeps the storage of its arrays for decoding another result into.
+    void Recycle()
+    {
+        image.Release();
+    }
+};
+
+// Decodes the values a recipe pushes into a ResultData.
+// Which outputs the recipes have is resolved when they are registered, so a push only looks up
+// outputs that can be in it. Arrays are decoded into the vectors of the result passed in, which
+// keep their storage, so decoding into a result that held as many values allocates nothing.
+class ResultDecoder
+{
+public:
+    using CVariant = Pylon::DataProcessing::CVariant;
+    using CVariantContainer = Pylon::DataProcessing::CVariantContainer;
+
+    // Adds the outputs of a recipe to those looked up. Until a recipe is registered, all are.
+    // Recipe outputs missing from the schema are reported, as they are not decoded.
+    void Register(const Pylon::StringList_t& outputNames)
+    {
+        uint32_t present = 0;
+        for (const auto& name : outputNames)
         {
-            const Pylon::DataProcessing::CVariant& value = posfixed_score->second;
-            if (value.HasError() == false)
-            {
-                for(size_t i = 0; i < value.GetNumArrayValues(); ++i)
-                {
-                    const Pylon::DataProcessing::CVariant fixed_scoreValue = value.GetArrayValue(i);
-                    if (fixed_scoreValue.HasError() == false)
-                    {
-                        fixed_score.push_back(fixed_scoreValue.ToDouble());
-                    }
-                    else
-                    {
-                        hasError = true;
-                        errorMessage = value.GetErrorDescription();
-                        break;
-                    }
-                }
-            }
-            else
+            uint32_t bit = 0;
+            for (int output = 0; output < ResultData::OUTPUT_COUNT; ++output)
             {
-                hasError = true;
-                errorMessage = value.GetErrorDescription();
+                if (name == ResultData::OutputName(ResultData::Output(output)))
+                    bit = 1u << output;
             }
+            if (!bit)
+                Logger::warn("ResultDecoder: Recipe output " + std::string(name.c_str()) + " is not in ResultData.schema and is ignored");
+            present |= bit;
         }
+        // The recipes share one observer, so an output is looked up if any of them has it
+        if (m_registered)
+            present |= m_present.load(std::memory_order_relaxed);
+        m_registered = true;
+        m_present.store(present, std::memory_order_release);
+    }
 
-        // fixed_position
-        auto posfixed_position = variantContainer.find("fixed_position");
-        if (posfixed_position != variantContainer.end())
+    // Decodes a push into result, replacing the values it held.
+    void Decode(const CVariantContainer& variantContainer, ResultData& result) const
+    {
+        uint32_t present = m_present.load(std::memory_order_acquire);
+        if (result.hasError)
         {
-            const Pylon::DataProcessing::CVariant& value = posfixed_position->second;
-            if (value.HasError() == false)
-            {
-                for(size_t i = 0; i < value.GetNumArrayValues(); ++i)
-                {
-                    const Pylon::DataProcessing::CVariant fixed_positionValue = value.GetArrayValue(i);
-                    if (fixed_positionValue.HasError() == false)
-                    {
-                        fixed_position.push_back(fixed_positionValue.ToPointF2D());
-                    }
-                    else
-                    {
-                        hasError = true;
-                        errorMessage = value.GetErrorDescription();
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                hasError = true;
-                errorMessage = value.GetErrorDescription();
-            }
+            result.hasError = false;
+            result.errorMessage = Pylon::String_t();
         }
 
+        // fixed_score
+        DecodeArray(variantContainer, present, ResultData::FIXED_SCORE, result.fixed_score, result,
+            [](const CVariant& value) { return value.ToDouble(); });
+
+        // fixed_position
+        DecodeArray(variantContainer, present, ResultData::FIXED_POSITION, result.fixed_position, result,
+            [](const CVariant& value) { return value.ToPointF2D(); });
+
         // mobile_score
-        auto posmobile_score = variantContainer.find("mobile_score");
-        if (posmobile_score != variantContainer.end())
+        DecodeArray(variantContainer, present, ResultData::MOBILE_SCORE, result.mobile_score, result,
+            [](const CVariant& value) { return value.ToDouble(); });
+
+        // mobile_position
+        DecodeArray(variantContainer, present, ResultData::MOBILE_POSITION, result.mobile_position, result,
+            [](const CVariant& value) { return value.ToPointF2D(); });
+
+        // image
+        DecodeValue(variantContainer, present, ResultData::IMAGE, result.image, result,
+            [](const CVariant& value) { return value.ToImage(); });
+    }
+
+private:
+    std::atomic<uint32_t> m_present{~0u}; // Bit per output any registered recipe has
+    bool m_registered{false};
+
+    // The value of an output, or nullptr if it was not pushed or carries an error, which is recorded in result.
+    static const CVariant* Find(const CVariantContainer& variantContainer, uint32_t present, ResultData::Output output, ResultData& result)
+    {
+        if (!(present & (1u << output)))
+            return nullptr;
+        auto pos = variantContainer.find(ResultData::OutputName(output));
+        if (pos == variantContainer.end())
+            return nullptr;
+        if (pos->second.HasError())
         {
-            const Pylon::DataProcessing::CVariant& value = posmobile_score->second;
-            if (value.HasError() == false)
-            {
-                for(size_t i = 0; i < value.GetNumArrayValues(); ++i)
-                {
-                    const Pylon::DataProcessing::CVariant mobile_scoreValue = value.GetArrayValue(i);
-                    if (mobile_scoreValue.HasError() == false)
-                    {
-                        mobile_score.push_back(mobile_scoreValue.ToDouble());
-                    }
-                    else
-                    {
-                        hasError = true;
-                        errorMessage = value.GetErrorDescription();
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                hasError = true;
-                errorMessage = value.GetErrorDescription();
-            }
+            result.hasError = true;
+            result.errorMessage = pos->second.GetErrorDescription();
+            return nullptr;
         }
+        return &pos->second;
+    }
 
-        // mobile_position
-        auto posmobile_position = variantContainer.find("mobile_position");
-        if (posmobile_position != variantContainer.end())
+    template <typename T, typename Convert>
+    static void DecodeArray(const CVariantContainer& variantContainer, uint32_t present, ResultData::Output output,
+                            std::vector<T>& values, ResultData& result, Convert convert)
+    {
+        values.clear();
+        const CVariant* value = Find(variantContainer, present, output, result);
+        if (!value)
+            return;
+        size_t count = value->GetNumArrayValues();
+        values.reserve(count);
+        for (size_t i = 0; i < count; ++i)
         {
-            const Pylon::DataProcessing::CVariant& value = posmobile_position->second;
-            if (value.HasError() == false)
+            const CVariant element = value->GetArrayValue(i);
+            if (element.HasError())
             {
-                for(size_t i = 0; i < value.GetNumArrayValues(); ++i)
-                {
-                    const Pylon::DataProcessing::CVariant mobile_positionValue = value.GetArrayValue(i);
-                    if (mobile_positionValue.HasError() == false)
-                    {
-                        mobile_position.push_back(mobile_positionValue.ToPointF2D());
-                    }
-                    else
-                    {
-                        hasError = true;
-                        errorMessage = value.GetErrorDescription();
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                hasError = true;
-                errorMessage = value.GetErrorDescription();
+                result.hasError = true;
+                result.errorMessage = element.GetErrorDescription();
+                return;
             }
+            values.push_back(convert(element));
         }
+    }
 
+    template <typename T, typename Convert>
+    static void DecodeValue(const CVariantContainer& variantContainer, uint32_t present, ResultData::Output output,
+                            T& field, ResultData& result, Convert convert)
+    {
+        const CVariant* value = Find(variantContainer, present, output, result);
+        field = value ? convert(*value) : T();
     }
-};
\ No newline at end of file
+};
+
+#endif // RESULT_DATA_H
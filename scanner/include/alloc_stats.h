@@ -0,0 +1,231 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef SCANNER_ALLOC_STATS
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#endif
+
+/**
+ * Counts heap allocations and serial I/O calls per cycle phase and per SEL command, to find and track heap
+ * churn in the control loop.
+ *
+ * Built with -DSCANNER_ALLOC_STATS=ON, src/scanner.cpp replaces the global operator new and delete with
+ * versions that call OnAllocate and OnFree, and SimpleSerial reports every read and write call. Each count
+ * goes to the phase and the command in scope on the calling thread, set with Scope. Counting takes no lock
+ * and never allocates. Without the option every function here is an empty inline and Report returns an
+ * empty string.
+ */
+namespace AllocStats
+{
+    enum class Kind {
+        PHASE,   // Part of the cycle, e.g. scan or refine
+        COMMAND, // SEL command code, e.g. STA or MOV
+    };
+
+    enum class Io {
+        READ,
+        WRITE,
+    };
+
+#ifdef SCANNER_ALLOC_STATS
+
+    static constexpr size_t MAX_NAMES = 32; // Per kind. Later names are counted under the last slot.
+    static constexpr size_t NAME_LENGTH = 16;
+
+    struct Counts {
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> frees{0};
+        std::atomic<uint64_t> reads{0};       // Read calls on a serial port
+        std::atomic<uint64_t> read_bytes{0};
+        std::atomic<uint64_t> writes{0};      // Write calls on a serial port
+        std::atomic<uint64_t> write_bytes{0};
+
+        void Reset() {
+            for (auto* count : {&allocations, &bytes, &frees, &reads, &read_bytes, &writes, &write_bytes}) {
+                count->store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    /**
+     * Counts under fixed names. Slots are never freed, so pointers into the table stay valid.
+     */
+    class Table {
+    public:
+        /**
+         * \return The counts of a name, added on first use. Takes a lock, so look names up outside hot paths.
+         */
+        Counts* Find(const char* name) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < used_; ++i) {
+                if (std::strncmp(names_[i].data(), name, NAME_LENGTH - 1) == 0)
+                    return &counts_[i];
+            }
+            if (used_ == MAX_NAMES)
+                return &counts_[MAX_NAMES - 1];
+            std::strncpy(names_[used_].data(), name, NAME_LENGTH - 1);
+            return &counts_[used_++];
+        }
+
+        void Reset() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < used_; ++i) {
+                counts_[i].Reset();
+            }
+        }
+
+        /**
+         * One line per name with any counts, aligned for reading in the log.
+         */
+        void Append(std::ostringstream& stream, const char* title) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stream << "\n" << title;
+            for (size_t i = 0; i < used_; ++i) {
+                auto& c = counts_[i];
+                if (c.allocations == 0 && c.reads == 0 && c.writes == 0)
+                    continue;
+                stream << "\n  " << std::left << std::setw(10) << names_[i].data() << std::right
+                       << std::setw(9) << c.allocations << " allocs " << std::setw(11) << c.bytes << " bytes "
+                       << std::setw(9) << c.frees << " frees " << std::setw(7) << c.reads << " reads ("
+                       << c.read_bytes << " bytes) " << std::setw(6) << c.writes << " writes (" << c.write_bytes << " bytes)";
+            }
+        }
+
+    private:
+        std::mutex mutex_;
+        std::array<std::array<char, NAME_LENGTH>, MAX_NAMES> names_{};
+        std::array<Counts, MAX_NAMES> counts_;
+        size_t used_{0};
+    };
+
+    inline Table& Phases() {
+        static Table table;
+        return table;
+    }
+
+    inline Table& Commands() {
+        static Table table;
+        return table;
+    }
+
+    inline Counts& Total() {
+        static Counts counts;
+        return counts;
+    }
+
+    // What the calling thread is doing, and whether counting is paused while building a report
+    inline thread_local Counts* current_phase = nullptr;
+    inline thread_local Counts* current_command = nullptr;
+    inline thread_local bool paused = false;
+
+    /**
+     * Attributes the counts on this thread to a phase or command while in scope. Scopes nest; the
+     * innermost of each kind wins.
+     */
+    class Scope {
+    public:
+        Scope(Kind kind, const char* name)
+            : slot_(kind == Kind::PHASE ? &current_phase : &current_command), previous_(*slot_) {
+            bool was_paused = paused;
+            paused = true; // Table::Find takes a lock, which must not count
+            *slot_ = (kind == Kind::PHASE ? Phases() : Commands()).Find(name);
+            paused = was_paused;
+        }
+
+        ~Scope() {
+            *slot_ = previous_;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Counts** slot_;
+        Counts* previous_;
+    };
+
+    template <typename Update>
+    inline void Count(Update update) {
+        if (paused)
+            return;
+        update(Total());
+        if (current_phase)
+            update(*current_phase);
+        if (current_command)
+            update(*current_command);
+    }
+
+    inline void OnAllocate(size_t bytes) {
+        Count([bytes](Counts& c) {
+            c.allocations.fetch_add(1, std::memory_order_relaxed);
+            c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        });
+    }
+
+    inline void OnFree() {
+        Count([](Counts& c) { c.frees.fetch_add(1, std::memory_order_relaxed); });
+    }
+
+    inline void OnIo(Io io, size_t bytes) {
+        Count([io, bytes](Counts& c) {
+            if (io == Io::READ) {
+                c.reads.fetch_add(1, std::memory_order_relaxed);
+                c.read_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
+            else {
+                c.writes.fetch_add(1, std::memory_order_relaxed);
+                c.write_bytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    /**
+     * Counts since the last Reset, per phase and per command. Building the report is not counted.
+     */
+    inline std::string Report() {
+        bool was_paused = paused;
+        paused = true;
+        std::ostringstream stream;
+        auto& t = Total();
+        stream << "Allocations: " << t.allocations << " allocs, " << t.bytes << " bytes, " << t.frees << " frees, "
+               << t.reads << " serial reads, " << t.writes << " serial writes in total";
+        Phases().Append(stream, "By phase:");
+        Commands().Append(stream, "By SEL command:");
+        std::string report = stream.str();
+        paused = was_paused;
+        return report;
+    }
+
+    inline void Reset() {
+        Total().Reset();
+        Phases().Reset();
+        Commands().Reset();
+    }
+
+#else
+
+    class Scope {
+    public:
+        Scope(Kind, const char*) {}
+    };
+
+    inline void OnAllocate(size_t) {}
+    inline void OnFree() {}
+    inline void OnIo(Io, size_t) {}
+    inline std::string Report() { return std::string(); }
+    inline void Reset() {}
+
+#endif
+}
+
+#endif // ALLOC_STATS_H
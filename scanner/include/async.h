@@ -0,0 +1,263 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "clock.h"
+#include "mailbox.h"
+
+// Coroutine support for the cycle. Routines that wait on the stage, the Z axis or the camera are coroutines
+// that suspend on an asio timer instead of polling, so one thread sleeps in the event loop while the hardware
+// works and the wait ends within a timer tick of the event. Serial exchanges are short and stay blocking.
+// Timers follow Time::Clock, so on a thread in virtual time the waits end as soon as the loop is idle.
+namespace Async
+{
+    using Clock = Time::Clock;
+    using Timer = boost::asio::steady_timer;
+
+    template <typename T = void>
+    using Task = boost::asio::awaitable<T>;
+
+    /**
+     * Timers of the calling thread waiting on virtual time. Such a timer never expires by itself; Advance
+     * ends its wait by cancelling it once the thread's time has been moved to its deadline.
+     */
+    class VirtualTimers {
+    public:
+        static VirtualTimers& ThisThread() {
+            static thread_local VirtualTimers timers;
+            return timers;
+        }
+
+        void Add(Clock::time_point deadline, const std::shared_ptr<Timer>& timer) {
+            queue_.push({deadline, added_++, timer});
+        }
+
+        /**
+         * Moves the thread's time to the earliest deadline of a timer still waiting and ends that wait.
+         * Timers due at the same time end in the order they were added. Call from the timers' event loop.
+         * \return false if no timer is waiting
+         */
+        bool Advance() {
+            while (!queue_.empty()) {
+                Entry entry = queue_.top();
+                queue_.pop();
+                auto timer = entry.timer.lock();
+                if (!timer)
+                    continue; // The wait ended otherwise, e.g. its Signal was notified, and the timer is gone
+                Time::AdvanceTo(entry.deadline);
+                timer->cancel();
+                return true;
+            }
+            return false;
+        }
+
+    private:
+        struct Entry {
+            Clock::time_point deadline;
+            uint64_t order;
+            std::weak_ptr<Timer> timer;
+
+            bool operator>(const Entry& other) const {
+                return deadline != other.deadline ? deadline > other.deadline : order > other.order;
+            }
+        };
+
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue_;
+        uint64_t added_{0};
+    };
+
+    /**
+     * A timer expiring at a deadline on the calling thread's clock. Its wait ends with an error if the
+     * timer is cancelled, which is also how a wait in virtual time ends, so wait with redirect_error.
+     */
+    template <typename Executor>
+    std::shared_ptr<Timer> MakeTimer(const Executor& executor, Clock::time_point deadline) {
+        if (!Time::IsVirtual())
+            return std::make_shared<Timer>(executor, deadline);
+        auto timer = std::make_shared<Timer>(executor, Timer::time_point::max());
+        VirtualTimers::ThisThread().Add(deadline, timer);
+        return timer;
+    }
+
+    /**
+     * Suspends the calling coroutine until a point in time.
+     */
+    inline Task<void> SleepUntil(Clock::time_point time) {
+        if (time <= Clock::now())
+            co_return;
+        auto timer = MakeTimer(co_await boost::asio::this_coro::executor, time);
+        boost::system::error_code ec;
+        co_await timer->async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
+
+    inline Task<void> Sleep(Clock::duration duration) {
+        co_await SleepUntil(Clock::now() + duration);
+    }
+
+    /**
+     * Runs an event loop until it is out of work. In virtual time, whenever the loop has nothing ready to
+     * run, the thread's time jumps to the next timer deadline, so sleeps and timeouts cost no wall time.
+     * Work posted from other threads is only waited for while no timer is pending.
+     */
+    inline void RunLoop(boost::asio::io_context& io) {
+        if (!Time::IsVirtual()) {
+            io.run();
+            return;
+        }
+        auto& timers = VirtualTimers::ThisThread();
+        while (!io.stopped()) {
+            if (io.poll() > 0 || io.stopped())
+                continue;
+            if (!timers.Advance())
+                io.run_one();
+        }
+    }
+
+    /**
+     * Runs a task to completion on an event loop, for callers that are not coroutines. The loop must be
+     * out of work; it is restarted, so callers running many tasks can reuse one.
+     * \throws Whatever the task throws
+     */
+    template <typename T>
+    T Run(boost::asio::io_context& io, Task<T> task) {
+        std::exception_ptr error;
+        std::optional<T> result;
+        boost::asio::co_spawn(io, std::move(task), [&](std::exception_ptr e, T value) {
+            error = e;
+            if (!e)
+                result.emplace(std::move(value));
+        });
+        io.restart();
+        RunLoop(io);
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*result);
+    }
+
+    inline void Run(boost::asio::io_context& io, Task<void> task) {
+        std::exception_ptr error;
+        boost::asio::co_spawn(io, std::move(task), [&](std::exception_ptr e) { error = e; });
+        io.restart();
+        RunLoop(io);
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /**
+     * Runs a task to completion on an event loop of its own.
+     * \throws Whatever the task throws
+     */
+    template <typename T>
+    T Run(Task<T> task) {
+        boost::asio::io_context io;
+        return Run(io, std::move(task));
+    }
+
+    inline void Run(Task<void> task) {
+        boost::asio::io_context io;
+        Run(io, std::move(task));
+    }
+
+    /**
+     * Wakes a coroutine waiting on an event loop from any other thread.
+     * Notify sets a flag and cancels the timer of the wait in progress, if any. The cancel is posted to the
+     * waiter's event loop, so the timer is only touched from that loop. A notification sent while no one
+     * waits is kept for the next wait.
+     */
+    class Signal {
+    public:
+        void Notify() {
+            notified_.store(true);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (auto timer = waiting_.lock())
+                boost::asio::post(timer->get_executor(), [timer]() { timer->cancel(); });
+        }
+
+        /**
+         * \return true if notified before the deadline. Clears the notification.
+         */
+        Task<bool> WaitUntil(Clock::time_point deadline) {
+            auto timer = MakeTimer(co_await boost::asio::this_coro::executor, deadline);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiting_ = timer;
+            }
+            if (!notified_.load()) {
+                boost::system::error_code ec;
+                co_await timer->async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiting_.reset();
+            }
+            co_return notified_.exchange(false);
+        }
+
+    private:
+        std::atomic<bool> notified_{false};
+        std::mutex mutex_;
+        std::weak_ptr<Timer> waiting_;
+    };
+
+    /**
+     * Awaits values from a Mailbox without blocking the event loop. Registers itself as the mailbox's
+     * listener, so it must outlive the producer publishing to the mailbox.
+     */
+    template <typename T>
+    class MailboxWaiter : public PublishListener {
+    public:
+        explicit MailboxWaiter(Mailbox<T>& mailbox) : mailbox_(mailbox) {
+            mailbox_.SetListener(this);
+        }
+
+        ~MailboxWaiter() {
+            mailbox_.SetListener(nullptr);
+        }
+
+        MailboxWaiter(const MailboxWaiter&) = delete;
+        MailboxWaiter& operator=(const MailboxWaiter&) = delete;
+
+        void Published() override {
+            signal_.Notify();
+        }
+
+        /**
+         * Coroutine version of Mailbox::WaitFor.
+         * \return false on timeout
+         */
+        Task<bool> WaitFor(T& value, FrameInfo& info, uint64_t after_sequence, Clock::time_point after_time,
+                           std::chrono::nanoseconds timeout) {
+            auto deadline = Clock::now() + timeout;
+            while (true) {
+                if (mailbox_.WaitFor(value, info, after_sequence, after_time, std::chrono::nanoseconds(0)))
+                    co_return true;
+                if (Clock::now() >= deadline)
+                    co_return false;
+                co_await signal_.WaitUntil(deadline);
+            }
+        }
+
+    private:
+        Mailbox<T>& mailbox_;
+        Signal signal_;
+    };
+}
+
+#endif // ASYNC_H
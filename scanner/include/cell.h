@@ -0,0 +1,252 @@
+#ifndef CELL_H
+#define CELL_H
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "logging.h"
+#include "simple_serial.h"
+#include "sel_interface.h"
+#include "gripper_interface.h"
+#include "commander.h"
+#include "halt_watchdog.h"
+#include "motion_planner.h"
+#include "scanner.h"
+#include "cycle_parameters.h"
+#include "xy.h"
+
+constexpr int PYLON_DEFAULT_MAX_NUM_BUFFER = 10; // Grab buffers pylon allocates unless MaxNumBuffer is set
+constexpr int FREE_GRAB_BUFFERS = 2;             // Buffers retained images must leave for grabbing and processing
+
+/**
+ * Serial ports and recipe of a single scanner cell.
+ */
+struct CellConfig {
+    std::string name;
+    std::string sel_port{"COM3"};
+    uint32_t sel_rate{9600};
+    bool probe_sel_rate{false}; // Switch the port to the highest rate the controller answers, sel_rate if none
+    std::string gripper_port{"COM6"};
+    uint32_t gripper_rate{115200};
+    std::string recipe_path{SCANNER_RECIPE};
+    std::vector<std::pair<std::string, std::string>> extra_recipes; // Name and path of recipes preloaded next to recipe_path
+    int retained_frames{8};                  // Recipe results kept for dumping after a failed cycle, 0 for none
+    std::string dump_directory{"frame_dumps"}; // Where retained results are dumped, one directory per dump
+};
+
+/**
+ * Everything needed to drive one scanner cell: its serial links, commander and recipe.
+ * Cells share no state, so several can run concurrently from one process.
+ */
+class Cell {
+public:
+    CellConfig config;
+    CycleParameters parameters;
+
+    SimpleSerial sel;
+    SimpleSerial gripper_link;
+    Gripper_Interface::Driver gripper;
+    Commander commander;
+    std::unique_ptr<PylonRecipe> recipe;
+
+    /**
+     * Opens both serial links and halts the XY axes.
+     * \throws boost::system::system_error if a serial port cannot be opened
+     */
+    Cell(const CellConfig& config, const CycleParameters& parameters)
+        : config(config), parameters(parameters),
+          sel(config.sel_port, config.sel_rate),
+          gripper_link(config.gripper_port, config.gripper_rate),
+          gripper(gripper_link),
+          commander(sel, gripper) {
+        if (config.probe_sel_rate)
+            SEL_Interface::ProbeBaudRate(sel);
+        commander.link.SetRate(sel.baudRate());
+
+        SEL_Interface::HaltAll(sel); // Halt all for safety
+        HaltWatchdog::Instance().Register(sel);
+        SetParameters(parameters);
+    }
+
+    ~Cell() {
+        HaltWatchdog::Instance().Unregister(sel);
+    }
+
+    Cell(const Cell&) = delete;
+    Cell& operator=(const Cell&) = delete;
+
+    /**
+     * Homes the end effector, initializes the gripper and loads the recipes.
+     */
+    void Initialize() {
+        HaltWatchdog::Instance().Release(sel);
+
+        // Ensure the end effector starts from the origin
+        commander.MoveRC(RCPositions::HOME);
+        commander.waitForZMotionComplete();
+
+        commander.UpdateSEL();
+        commander.MoveTo(parameters.mobileScanStart());
+        commander.waitForXYMotionComplete();
+
+        // Initialize the gripper
+        gripper.Initialize();
+        gripper.WaitForInitialized();
+
+        gripper.Open();
+
+        // Initialize object recognition model. A re-initialization must release the camera before reopening it.
+        Shutdown();
+        recipe = std::make_unique<PylonRecipe>(config.recipe_path.c_str(), parameters.camera_alignment);
+        for (auto& [name, path] : config.extra_recipes) {
+            recipe->Preload(name, path.c_str());
+        }
+        recipe->RetainFrames(config.retained_frames, config.dump_directory);
+        SetParameters(parameters);
+        recipe->SetPhase(RecipePhase::SCAN);
+    }
+
+    /**
+     * Switches to new cycle parameters. Call between cycles only; the serial links and loaded recipes are kept.
+     */
+    void SetParameters(const CycleParameters& new_parameters) {
+        parameters = new_parameters;
+        commander.planner.x_limits = parameters.x_axis_limits;
+        commander.planner.y_limits = parameters.y_axis_limits;
+        commander.travel = parameters.stage_travel;
+        commander.link.SetBudget(parameters.link_budget);
+        commander.status_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(parameters.scan_status_period));
+        if (recipe) {
+            recipe->alignment = parameters.camera_alignment;
+            recipe->frame_latency = parameters.frame_latency;
+            recipe->SetPhaseSettings(RecipePhase::SCAN, parameters.scan_phase);
+            recipe->SetPhaseSettings(RecipePhase::REFINE, parameters.refine_phase);
+        }
+    }
+
+    /**
+     * Finds and grasps the mobile connector, then finds the fixed connector and mates the two.
+     * Runs Cycle on an event loop of its own.
+     * \return true if the connectors were mated
+     */
+    bool RunCycle() {
+        return Async::Run(Cycle());
+    }
+
+    /**
+     * Coroutine version of RunCycle. Waits for the stage, the Z axis and the camera suspend the coroutine.
+     */
+    Async::Task<bool> Cycle() {
+        auto& p = parameters;
+        XY mobile_scan_start = p.mobileScanStart();
+
+        // Scan path and the progress along it, shared by the mobile and fixed scans
+        ScanState scan(mobile_scan_start, p.workspace, p.scan_width);
+
+        // Find mobile connector, record fixed connector location if seen
+        recipe->SetPhase(RecipePhase::SCAN);
+        auto fixed_position = XY();
+        bool success, fixed_found;
+        {
+            AllocStats::Scope phase(AllocStats::Kind::PHASE, "scan mobile");
+            std::tie(success, fixed_found) = co_await ScanForMobile(commander, *recipe, scan, p.scan_speed, fixed_position, p.tracker);
+        }
+
+        if (success) {
+            AllocStats::Scope phase(AllocStats::Kind::PHASE, "refine mobile");
+            recipe->SetPhase(RecipePhase::REFINE);
+            success = co_await RefineToMobile(commander, *recipe, p.refinement_speed, p.mobile_tolerance, p.mobile_scale_factor, p.refinement);
+        }
+
+        if (success) {
+            {
+                // Grasp mobile connector
+                AllocStats::Scope phase(AllocStats::Kind::PHASE, "grasp");
+                co_await commander.GraspMobile(p.camera_to_gripper, p.scan_speed, false);
+
+                // Set up to find fixed connector
+                auto fixed_scan_start = (fixed_found ? fixed_position : (commander.position - p.camera_to_gripper));
+
+                commander.MoveTo(fixed_scan_start);
+
+                co_await commander.AllDone();
+            }
+
+            AllocStats::Scope phase(AllocStats::Kind::PHASE, "scan fixed");
+            recipe->SetPhase(RecipePhase::SCAN);
+            success = co_await ScanForFixed(commander, *recipe, scan, p.scan_speed, p.tracker);
+
+            if (!success) {
+                // Search the whole path once more, in case the fixed connector was missed the first time
+                scan.Rewind();
+                success = co_await ScanForFixed(commander, *recipe, scan, p.scan_speed, p.tracker);
+            }
+        }
+
+        if (success) {
+            AllocStats::Scope phase(AllocStats::Kind::PHASE, "refine fixed");
+            recipe->SetPhase(RecipePhase::REFINE);
+            success = co_await RefineToFixed(commander, *recipe, p.refinement_speed, p.fixed_tolerance, p.fixed_scale_factor, p.refinement);
+        }
+
+        if (success) {
+            AllocStats::Scope phase(AllocStats::Kind::PHASE, "mate");
+            co_await commander.MateMobileToFixed(p.camera_to_gripper, p.scan_speed, false);
+        }
+
+        if (!success)
+            DumpFrames("failed");
+
+        recipe->SetPhase(RecipePhase::SCAN);
+        recipe->ReportPhaseStats();
+        recipe->ReportLatency();
+        Logger::info(scan.Summary());
+        Logger::info(commander.stage.Summary());
+        commander.stage.ResetStats();
+        Logger::info(commander.link.Summary());
+        commander.link.ResetStats();
+        Logger::info("SEL link faults: " + sel.faults().Summary());
+        gripper.FinishPending(); // The echo check of the last gripper write counts its faults on another thread
+        Logger::info("Gripper link faults: " + gripper_link.faults().Summary());
+
+        co_await commander.ReadStatus();
+        commander.MoveTo(mobile_scan_start);
+        co_await commander.AllDone();
+        gripper.Open();
+
+        co_return success;
+    }
+
+    /**
+     * Writes the recipe results retained before a failure, or on request, to disk in the background.
+     * \return The directory written to, empty if nothing was retained
+     */
+    std::filesystem::path DumpFrames(const std::string& reason) {
+        return recipe ? recipe->DumpFrames(reason) : std::filesystem::path();
+    }
+
+    /**
+     * Stops the recipe and releases its pylon resources.
+     */
+    void Shutdown() {
+        if (recipe) {
+            recipe->Stop();
+            recipe.reset();
+        }
+    }
+
+    /**
+     * Halts the XY axes after a failure. Safe to call while another thread is using the SEL link.
+     */
+    void Halt() {
+        commander.EmergencyHalt();
+    }
+};
+
+#endif // CELL_H
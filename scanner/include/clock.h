@@ -0,0 +1,111 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <chrono>
+#include <thread>
+
+/**
+ * Time source of the cycle: the times of frames and stage positions, move timing, the link budget and the
+ * waits between them.
+ *
+ * Reads std::chrono::steady_clock unless the calling thread runs in virtual time, set up with VirtualTime.
+ * A thread in virtual time only moves its clock forward when it sleeps, or when its event loop has nothing
+ * left to run but waits on timers, which Async::Run then ends in deadline order. The cycle's own waits
+ * therefore take no wall time: moves, status polls, gripper settling and result timeouts. Virtual time is
+ * kept per thread, so simulated cells on worker threads each keep a timeline of their own. Timeouts of real
+ * devices, e.g. serial replies and the halt watchdog, stay on the steady clock, so Cell::Cycle itself still
+ * runs in real time against its SEL, gripper and camera. Its scan and refine loops (scan_refine.h) run in
+ * virtual time in CycleSimulator, against a simulated stage and camera.
+ */
+namespace Time
+{
+    /**
+     * Chrono clock reading the calling thread's time. Shares the time_point type of steady_clock, so its
+     * time points are stored and compared wherever steady_clock ones are.
+     */
+    struct Clock {
+        using duration = std::chrono::steady_clock::duration;
+        using rep = duration::rep;
+        using period = duration::period;
+        using time_point = std::chrono::steady_clock::time_point;
+        static constexpr bool is_steady = true;
+
+        static time_point now() noexcept;
+    };
+
+    namespace Detail
+    {
+        struct ThreadTime {
+            bool is_virtual{false};
+            Clock::time_point now;
+        };
+
+        inline thread_local ThreadTime thread_time;
+    }
+
+    inline Clock::time_point Clock::now() noexcept {
+        const auto& time = Detail::thread_time;
+        return time.is_virtual ? time.now : std::chrono::steady_clock::now();
+    }
+
+    /**
+     * \return true if the calling thread runs in virtual time
+     */
+    inline bool IsVirtual() {
+        return Detail::thread_time.is_virtual;
+    }
+
+    /**
+     * Moves the calling thread's virtual time forward to a point. Does nothing in real time or if the point
+     * has passed.
+     */
+    inline void AdvanceTo(Clock::time_point time) {
+        auto& current = Detail::thread_time;
+        if (current.is_virtual && time > current.now)
+            current.now = time;
+    }
+
+    /**
+     * Blocks for a duration, or advances virtual time by it.
+     */
+    inline void SleepFor(Clock::duration duration) {
+        if (IsVirtual())
+            AdvanceTo(Clock::now() + duration);
+        else if (duration > Clock::duration::zero())
+            std::this_thread::sleep_for(duration);
+    }
+
+    inline void SleepUntil(Clock::time_point time) {
+        if (IsVirtual())
+            AdvanceTo(time);
+        else
+            std::this_thread::sleep_until(time);
+    }
+
+    /**
+     * Runs the calling thread in virtual time while in scope. Scopes nest; the outer one's time is restored.
+     */
+    class VirtualTime {
+    public:
+        /**
+         * \param start Time to start from, by default the steady clock's, so time points from before the
+         * scope still compare as earlier
+         */
+        explicit VirtualTime(Clock::time_point start = std::chrono::steady_clock::now())
+            : previous_(Detail::thread_time) {
+            Detail::thread_time = {true, start};
+        }
+
+        ~VirtualTime() {
+            Detail::thread_time = previous_;
+        }
+
+        VirtualTime(const VirtualTime&) = delete;
+        VirtualTime& operator=(const VirtualTime&) = delete;
+
+    private:
+        Detail::ThreadTime previous_;
+    };
+}
+
+#endif // CLOCK_H
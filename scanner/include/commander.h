@@ -3,11 +3,19 @@
 
 #include <string>
 #include "sel_interface.h"
+#include "gripper_interface.h"
+#include "halt_watchdog.h"
 #include "logging.h"
 #include <vector>
 #include <algorithm>
 #include <thread>
+#include <chrono>
 #include "xy.h"
+#include "motion_planner.h"
+#include "stage_estimator.h"
+#include "link_scheduler.h"
+#include "async.h"
+#include "clock.h"
 
 enum RCPositions {
     HOME = 0,
@@ -36,17 +44,37 @@ public:
     bool in_motion{false};
     XY position{XY(0,0)};
     std::vector<bool> SEL_outputs;
+    Motion::Planner planner;
+    XY travel{XY(400.0, 600.0)}; // mm, largest position MoveTo sends to the SEL controller
+    StageEstimator stage;        // Timestamped history of the positions read by UpdateSEL
+    LinkScheduler link;          // Bandwidth budget of the SEL link, commands first
+    std::chrono::steady_clock::duration status_period{}; // Shortest time between the status polls of PollSEL
 
-    Commander(const Commander&) = delete;
-    Commander& operator=(const Commander&) = delete;
+    static constexpr std::chrono::milliseconds MOTION_POLL_PERIOD{5}; // Shortest time between polls while waiting for a move
+    static constexpr double PLAN_SLEEP_FRACTION{0.9}; // Part of a planned move slept through before polling for its end
 
-    static Commander* getInstance() {
-        static Commander instance;
-        return &instance;
+    /**
+     * \param sel Serial link to this cell's SEL controller
+     * \param gripper Driver for this cell's gripper
+     */
+    Commander(SimpleSerial& sel, Gripper_Interface::Driver& gripper)
+        : SEL_outputs(288, false), sel_(sel), gripper_(gripper) {
     }
 
+    Commander(const Commander&) = delete;
+    Commander& operator=(const Commander&) = delete;
+
     bool UpdateSEL() {
-        auto status_msg = SEL_Interface::AxisInquiry();
+        link.WaitForStatus();
+
+        // The controller samples its position somewhere between the request and the reply
+        auto request_time = Time::Clock::now();
+        std::string status_msg;
+        {
+            Traffic traffic(*this, LinkPriority::STATUS);
+            status_msg = SEL_Interface::AxisInquiry(sel_);
+        }
+        auto sample_time = request_time + (Time::Clock::now() - request_time) / 2;
         uint8_t num_axes = status_msg.at(6) - '0';
 
         if (num_axes < 1) {
@@ -75,7 +103,7 @@ public:
         );
 
         if (y_axis.error_code != "00") {
-            SEL_Interface::HaltAll();
+            HaltAll();
             throw std::runtime_error("Y axis encountered error " + y_axis.error_code);
         }
 
@@ -103,42 +131,164 @@ public:
         );
 
         if (x_axis.error_code != "00") {
-            SEL_Interface::HaltAll();
+            HaltAll();
             throw std::runtime_error("X axis encountered error " + x_axis.error_code);
         }
 
         in_motion = x_axis.in_motion || y_axis.in_motion;
         position = XY(x_axis.position, y_axis.position);
+        stage.Record(sample_time, position, in_motion);
+
+        if (move_pending_ && !in_motion) {
+            LogMoveTiming();
+        }
 
         return true;
     }
 
+    /**
+     * Coroutine version of UpdateSEL. Waits for the link budget on the event loop instead of blocking the thread.
+     */
+    Async::Task<bool> ReadStatus() {
+        co_await link.AwaitStatus();
+        co_return UpdateSEL();
+    }
+
+    /**
+     * Reads the status if status_period has passed since the last read and the link budget allows it.
+     * Loops that process frames call this instead of UpdateSEL so status polls do not crowd out commands.
+     * PositionAt extrapolates over the polls skipped.
+     * \return true if the status was read
+     */
+    bool PollSEL() {
+        if (!link.StatusDue(status_period))
+            return false;
+        return UpdateSEL();
+    }
+
+    /**
+     * Moves to a position with a velocity and acceleration chosen by the motion planner.
+     * Uses the last known position as the start of the move, so call UpdateSEL first if it may be stale.
+     * \param target Position to move to in mm
+     * \param velocity_cap Upper bound on the velocity in mm/s. Zero lets the planner use the axis limits.
+     * \return The plan that was sent to the controller
+     */
+    Motion::MovePlan MoveTo(XY target, double velocity_cap = 0.0) {
+        if (HaltWatchdog::Instance().Latched(sel_))
+            throw std::runtime_error("Commander::MoveTo: " + sel_.portName() + " was halted by the watchdog");
+
+        auto plan = planner.Plan(position, target, velocity_cap);
+        {
+            Traffic traffic(*this, LinkPriority::COMMAND);
+            SEL_Interface::MoveToPosition(sel_, target, travel, plan.velocity, plan.acceleration);
+        }
+        pending_plan_ = plan;
+        move_start_ = Time::Clock::now();
+        move_pending_ = true;
+        stage.SetTarget(target);
+        return plan;
+    }
+
+    /**
+     * Coroutine that moves to a position and waits until the stage has stopped.
+     * \param target Position to move to in mm
+     * \param velocity_cap Upper bound on the velocity in mm/s. Zero lets the planner use the axis limits.
+     * \return The plan that was sent to the controller
+     */
+    Async::Task<Motion::MovePlan> Move(XY target, double velocity_cap = 0.0) {
+        auto plan = MoveTo(target, velocity_cap);
+        co_await XYDone();
+        co_return plan;
+    }
+
+    /**
+     * Estimated position at a time, e.g. when a frame was captured, from the positions read by UpdateSEL.
+     * Call UpdateSEL after the time of interest so the position is interpolated instead of extrapolated.
+     */
+    XY PositionAt(std::chrono::steady_clock::time_point time) {
+        return stage.Empty() ? position : stage.PositionAt(time);
+    }
+
+    /**
+     * Stops X and Y axes. The interrupted move is not logged since its duration says nothing about the model.
+     */
+    void HaltAll() {
+        move_pending_ = false;
+        stage.ClearTarget();
+        Traffic traffic(*this, LinkPriority::COMMAND);
+        SEL_Interface::HaltAll(sel_);
+    }
+
+    /**
+     * Halts X and Y through the halt watchdog, which does not wait for a command in progress on another
+     * thread. Moves are refused until the watchdog releases the link.
+     */
+    void EmergencyHalt() {
+        move_pending_ = false;
+        stage.ClearTarget();
+        HaltWatchdog::Instance().Halt(sel_);
+    }
+
+    /**
+     * Coroutine that waits until X and Y have stopped. Sleeps through most of a planned move, then polls the
+     * status as often as the link budget allows.
+     */
+    Async::Task<void> XYDone() {
+        if (move_pending_) {
+            co_await Async::SleepUntil(move_start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(pending_plan_.duration * PLAN_SLEEP_FRACTION)));
+        }
+        while (true) {
+            co_await link.AwaitStatus();
+            UpdateSEL();
+            if (!x_axis.in_motion && !y_axis.in_motion)
+                co_return;
+            co_await Async::Sleep(MOTION_POLL_PERIOD);
+        }
+    }
+
+    /**
+     * Coroutine that waits until the RC controller reports the Z move complete.
+     */
+    Async::Task<void> ZDone() {
+        while (true) {
+            co_await link.AwaitStatus();
+            if (zMotionComplete())
+                co_return;
+            co_await Async::Sleep(MOTION_POLL_PERIOD);
+        }
+    }
+
+    Async::Task<void> AllDone() {
+        co_await XYDone();
+        co_await ZDone();
+    }
+
     bool zMotionComplete() {
-        auto inputs = SEL_Interface::ReadInputs();
+        link.WaitForStatus();
+        std::string inputs;
+        {
+            Traffic traffic(*this, LinkPriority::STATUS);
+            inputs = SEL_Interface::ReadInputs(sel_);
+        }
         Logger::verbose("Reading value " + std::string(1, inputs[11]) + " for SEL inputs 19-16");
         if (inputs[11] >= '8')
             return true;
         return false;
     }
 
+    // Blocking versions of the waits above, for callers that are not coroutines
     void waitForZMotionComplete() {
         Logger::verbose("Waiting for Z Motion complete.");
-        while(true) {
-            if (zMotionComplete())
-                return;
-        }
+        Async::Run(ZDone());
     }
 
     void waitForXYMotionComplete() {
-        UpdateSEL();
-        while(x_axis.in_motion || y_axis.in_motion) {
-            UpdateSEL();
-        }
+        Async::Run(XYDone());
     }
 
     void waitForAllMotionComplete() {
-        waitForXYMotionComplete();
-        waitForZMotionComplete();
+        Async::Run(AllDone());
     }
 
     void MoveRC(uint8_t point) {
@@ -158,9 +308,10 @@ public:
         }
         Logger::verbose("Attempting to move RC to point " + std::to_string(point) + " [" + debug_position_values + "]");
 
-        SEL_Interface::SetOutputs(position_ports, position_values, SEL_outputs); // Set position
-        SEL_Interface::SetOutputs({302}, {1}, SEL_outputs); // Command start
-        SEL_Interface::SetOutputs({302}, {0}, SEL_outputs);
+        Traffic traffic(*this, LinkPriority::COMMAND);
+        SEL_Interface::SetOutputs(sel_, position_ports, position_values, SEL_outputs); // Set position
+        SEL_Interface::SetOutputs(sel_, {302}, {1}, SEL_outputs); // Command start
+        SEL_Interface::SetOutputs(sel_, {302}, {0}, SEL_outputs);
         Logger::verbose("Successfully sent moveRC command.");
     }
 
@@ -170,10 +321,9 @@ public:
      * \param speed Speed to traverse XY. Z speed is set on RC controller
      * \param pause true to require user input before mating, false for full auto
     */
-    void GraspMobile(XY offset, int speed, bool pause = false) {
-        UpdateSEL();
-        SEL_Interface::MoveToPosition(position + offset, speed);
-        waitForXYMotionComplete();
+    Async::Task<void> GraspMobile(XY offset, int speed, bool pause = false) {
+        co_await ReadStatus();
+        co_await Move(position + offset, speed);
 
         if (pause) {
             Logger::info("Confirm position before grasping.");
@@ -182,15 +332,17 @@ public:
         
         // Z down to grasp connector
         MoveRC(RCPositions::GRASP);
-        waitForZMotionComplete();
+        co_await ZDone();
 
         if (pause) {
             Logger::info("Confirm position before grasping.");
             system("pause");
         }
 
-        Gripper_Interface::Close();
-        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        gripper_.Close();
+        if (co_await gripper_.Settle() != Gripper_Interface::GripState::CAUGHT) {
+            Logger::warn("Commander::GraspMobile: Gripper closed without catching the connector.");
+        }
 
         MoveRC(RCPositions::HOME);
     }
@@ -201,14 +353,13 @@ public:
      * \param speed Speed to traverse XY. Z speed is set on RC controller
      * \param pause true to require user input before mating, false for full auto
     */
-    void MateMobileToFixed(XY offset, int speed, bool pause = false) {
-        UpdateSEL();
-        SEL_Interface::MoveToPosition(position + offset, speed);
-        waitForXYMotionComplete();
+    Async::Task<void> MateMobileToFixed(XY offset, int speed, bool pause = false) {
+        co_await ReadStatus();
+        co_await Move(position + offset, speed);
         
         // Z down to hover over connector
         MoveRC(RCPositions::POUNCE);
-        waitForZMotionComplete();
+        co_await ZDone();
 
         if (pause) {
             Logger::info("Confirm position before mating.");
@@ -217,23 +368,59 @@ public:
 
         // Z down to mate with connector
         MoveRC(RCPositions::MATE);
-        waitForZMotionComplete();
+        co_await ZDone();
 
         // Open gripper
-        Gripper_Interface::MoveTo50();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        gripper_.MoveTo50();
+        co_await gripper_.Settle();
 
         // Z up
         MoveRC(RCPositions::HOME);
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        Gripper_Interface::Open();
+        co_await Async::Sleep(std::chrono::milliseconds(100));
+        gripper_.Open();
     }
 
 private:
-    Commander(): SEL_outputs(288, false) {
+    /**
+     * Charges the bytes written and read on the link while in scope to the link budget.
+     */
+    class Traffic {
+    public:
+        Traffic(Commander& commander, LinkPriority priority)
+            : commander_(commander), priority_(priority), start_(Bytes()) {}
+
+        ~Traffic() {
+            commander_.link.Record(priority_, Bytes() - start_);
+        }
+
+    private:
+        Commander& commander_;
+        LinkPriority priority_;
+        uint64_t start_;
+
+        uint64_t Bytes() const {
+            return commander_.sel_.bytesWritten() + commander_.sel_.bytesRead();
+        }
+    };
+
+    SimpleSerial& sel_;
+    Gripper_Interface::Driver& gripper_;
+
+    bool move_pending_{false};
+    Motion::MovePlan pending_plan_;
+    std::chrono::steady_clock::time_point move_start_;
+
+    // Logs planned against measured duration in a fixed format so the motion model can be fitted offline.
+    // The measured time includes one status round trip, which is the resolution of the measurement.
+    void LogMoveTiming() {
+        move_pending_ = false;
+        double actual = std::chrono::duration<double>(Time::Clock::now() - move_start_).count();
+        Logger::debug("MoveTiming distance_mm=" + std::to_string(pending_plan_.distance) +
+                      " velocity=" + std::to_string(pending_plan_.velocity) +
+                      " acceleration=" + std::to_string(pending_plan_.acceleration) +
+                      " planned_ms=" + std::to_string(pending_plan_.duration * 1000.0) +
+                      " actual_ms=" + std::to_string(actual * 1000.0));
     }
 };
 
-extern Commander* commander;
-
 #endif // COMMANDER_H
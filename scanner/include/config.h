@@ -0,0 +1,507 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cell.h"
+#include "cycle_parameters.h"
+#include "logging.h"
+#include "xy.h"
+
+/**
+ * Everything read from a config file: the cycle parameters shared by all cells and the cells themselves.
+ */
+struct ScannerConfig {
+    CycleParameters parameters;
+    CellConfig cell_defaults;     // [cell], also the cell used when no [cell.<name>] sections are given
+    std::vector<CellConfig> cells; // [cell.<name>], in file order
+};
+
+/**
+ * Reads the scanner's INI config file and checks it against the schema below.
+ *
+ * Lines are "key = value" below a "[section]" header. ';' or '#' after whitespace starts a comment. Every
+ * key not given keeps its compiled-in default, so a file only needs the values being tuned.
+ *
+ *   [cycle]         CycleParameters: tolerances, scale factors, workspace, speeds and motion limits
+ *   [tracker]       TrackerSettings used while scanning
+ *   [refinement]    RefinementSettings used while refining
+ *   [scan_phase]    recipe = <preloaded recipe>, any other key is written to the recipe as a parameter
+ *   [refine_phase]  Same for the refinement phase
+ *   [cell]          Ports, baud rates and recipes shared by all cells
+ *   [cell.<name>]   One cell, starting from the values in [cell]. recipe.<name> = <path> preloads a recipe.
+ *
+ * Unknown sections and keys, values that do not parse, values out of range and repeated keys are all
+ * errors. Load reports every error in the file at once, each with its line number, so a file edited on a
+ * running cell is fixed in one pass.
+ */
+class ConfigLoader {
+public:
+    /**
+     * \param defaults Values of keys missing from the file, e.g. those given on the command line
+     * \throws std::runtime_error listing every problem found, if the file cannot be read or is invalid
+     */
+    static ScannerConfig Load(const std::string& path, const ScannerConfig& defaults) {
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("Could not open config file " + path);
+
+        ConfigLoader loader(path, defaults);
+        std::string line;
+        for (int number = 1; std::getline(file, line); ++number) {
+            loader.ParseLine(line, number);
+        }
+        loader.Validate();
+
+        if (!loader.errors_.empty()) {
+            std::string message = "Invalid config file " + path + ":";
+            for (auto& error : loader.errors_) {
+                message += "\n  " + error;
+            }
+            throw std::runtime_error(message);
+        }
+        return loader.config_;
+    }
+
+private:
+    using Setter = std::function<void(const std::string& value)>;
+
+    std::string path_;
+    ScannerConfig config_;
+    std::vector<std::string> errors_;
+    std::string section_;
+    CellConfig* cell_{nullptr};    // Cell the current section describes, if any
+    PhaseSettings* phase_{nullptr}; // Phase the current section describes, if any
+    std::map<std::string, Setter> fields_;
+    std::map<std::string, int> seen_;  // "section.key" to the line it was first given on
+    bool cells_started_{false};        // [cell] must come before any [cell.<name>]
+    bool unknown_section_{false};      // Keys of an unknown section are not reported again
+
+    ConfigLoader(const std::string& path, const ScannerConfig& defaults) : path_(path), config_(defaults) {
+        config_.cells.clear();
+    }
+
+    void Error(int line, const std::string& message) {
+        errors_.push_back(path_ + ":" + std::to_string(line) + ": " + message);
+    }
+
+    static std::string Trim(const std::string& text) {
+        auto begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string::npos)
+            return "";
+        auto end = text.find_last_not_of(" \t\r");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    static double ParseNumber(const std::string& value) {
+        size_t used = 0;
+        double number;
+        try {
+            number = std::stod(value, &used);
+        }
+        catch (const std::exception&) {
+            used = 0;
+        }
+        if (used == 0 || used != value.size() || !std::isfinite(number))
+            throw std::runtime_error("'" + value + "' is not a number");
+        return number;
+    }
+
+    static Setter Number(double& target, double min, double max) {
+        return [&target, min, max](const std::string& value) {
+            double number = ParseNumber(value);
+            if (number < min || number > max)
+                throw std::runtime_error(value + " is outside [" + Format(min) + ", " + Format(max) + "]");
+            target = number;
+        };
+    }
+
+    static Setter Integer(int& target, int min, int max) {
+        return [&target, min, max](const std::string& value) {
+            double number = ParseNumber(value);
+            if (number != std::floor(number))
+                throw std::runtime_error("'" + value + "' is not a whole number");
+            if (number < min || number > max)
+                throw std::runtime_error(value + " is outside [" + std::to_string(min) + ", " + std::to_string(max) + "]");
+            target = static_cast<int>(number);
+        };
+    }
+
+    static Setter Rate(uint32_t& target) {
+        return [&target](const std::string& value) {
+            static const uint32_t rates[] = {9600, 19200, 38400, 57600, 115200, 230400};
+            double number = ParseNumber(value);
+            if (std::find(std::begin(rates), std::end(rates), number) == std::end(rates))
+                throw std::runtime_error(value + " is not a supported baud rate");
+            target = static_cast<uint32_t>(number);
+        };
+    }
+
+    // +1 if the camera axis points along the stage axis, -1 if it is inverted
+    static Setter Alignment(double& target) {
+        return [&target](const std::string& value) {
+            if (value == "aligned" || value == "1")
+                target = AxisAlignment::ALIGNED;
+            else if (value == "inverted" || value == "-1")
+                target = AxisAlignment::INVERTED;
+            else
+                throw std::runtime_error("'" + value + "' is not one of aligned, inverted");
+        };
+    }
+
+    static Setter Flag(bool& target) {
+        return [&target](const std::string& value) {
+            if (value == "true" || value == "yes" || value == "1")
+                target = true;
+            else if (value == "false" || value == "no" || value == "0")
+                target = false;
+            else
+                throw std::runtime_error("'" + value + "' is not one of true, false");
+        };
+    }
+
+    static Setter Text(std::string& target) {
+        return [&target](const std::string& value) {
+            if (value.empty())
+                throw std::runtime_error("value is empty");
+            target = value;
+        };
+    }
+
+    static std::string Format(double value) {
+        std::ostringstream stream;
+        stream << value;
+        return stream.str();
+    }
+
+    void CycleFields() {
+        auto& p = config_.parameters;
+        fields_ = {
+            {"camera_alignment_x", Alignment(p.camera_alignment.x)},
+            {"camera_alignment_y", Alignment(p.camera_alignment.y)},
+            {"fixed_tolerance", Number(p.fixed_tolerance, 0.001, 10.0)},
+            {"mobile_tolerance", Number(p.mobile_tolerance, 0.001, 10.0)},
+            {"fixed_scale_factor", Number(p.fixed_scale_factor, 0.01, 1.5)},
+            {"mobile_scale_factor", Number(p.mobile_scale_factor, 0.01, 1.5)},
+            {"workspace_x", Number(p.workspace.x, 1.0, 2000.0)},
+            {"workspace_y", Number(p.workspace.y, 1.0, 2000.0)},
+            {"camera_to_gripper_x", Number(p.camera_to_gripper.x, -1000.0, 1000.0)},
+            {"camera_to_gripper_y", Number(p.camera_to_gripper.y, -1000.0, 1000.0)},
+            {"stage_travel_x", Number(p.stage_travel.x, 1.0, 2000.0)},
+            {"stage_travel_y", Number(p.stage_travel.y, 1.0, 2000.0)},
+            {"scan_width", Number(p.scan_width, 1.0, 200.0)},
+            {"scan_speed", Integer(p.scan_speed, 1, 2000)},
+            {"refinement_speed", Integer(p.refinement_speed, 1, 2000)},
+            {"frame_latency", Number(p.frame_latency, 0.0, 1.0)},
+            {"scan_status_period", Number(p.scan_status_period, 0.0, 1.0)},
+            {"link_budget", Number(p.link_budget, 0.05, 1.0)},
+            {"x_max_velocity", Number(p.x_axis_limits.max_velocity, 1.0, 2000.0)},
+            {"x_max_acceleration", Number(p.x_axis_limits.max_acceleration, 0.01, 2.0)},
+            {"y_max_velocity", Number(p.y_axis_limits.max_velocity, 1.0, 2000.0)},
+            {"y_max_acceleration", Number(p.y_axis_limits.max_acceleration, 0.01, 2.0)},
+        };
+    }
+
+    void TrackerFields() {
+        auto& t = config_.parameters.tracker;
+        fields_ = {
+            {"confirm_hits", Integer(t.confirm_hits, 1, 100)},
+            {"min_confidence", Number(t.min_confidence, 0.0, 1.0)},
+            {"gate", Number(t.gate, 0.1, 100.0)},
+            {"max_misses", Integer(t.max_misses, 0, 100)},
+            {"smoothing", Number(t.smoothing, 0.0, 1.0)},
+        };
+    }
+
+    void RefinementFields() {
+        auto& r = config_.parameters.refinement;
+        fields_ = {
+            {"min_frames", Integer(r.min_frames, 1, 100)},
+            {"max_frames", Integer(r.max_frames, 1, 100)},
+            {"frame_noise", Number(r.frame_noise, 0.0, 10.0)},
+            {"confidence", Number(r.confidence, 0.0, 10.0)},
+            {"trim_fraction", Number(r.trim_fraction, 0.0, 0.5)},
+            {"lost_frames", Integer(r.lost_frames, 1, 100)},
+            {"search_rings", Integer(r.search_rings, 0, 10)},
+            {"field_of_view", Number(r.field_of_view, 1.0, 500.0)},
+        };
+    }
+
+    void CellFields(CellConfig& cell) {
+        fields_ = {
+            {"sel_port", Text(cell.sel_port)},
+            {"sel_rate", Rate(cell.sel_rate)},
+            {"probe_sel_rate", Flag(cell.probe_sel_rate)},
+            {"gripper_port", Text(cell.gripper_port)},
+            {"gripper_rate", Rate(cell.gripper_rate)},
+            {"recipe_path", Text(cell.recipe_path)},
+            {"retained_frames", Integer(cell.retained_frames, 0, 1000)},
+            {"dump_directory", Text(cell.dump_directory)},
+        };
+    }
+
+    void BeginSection(const std::string& name, int line) {
+        section_ = name;
+        cell_ = nullptr;
+        phase_ = nullptr;
+        unknown_section_ = false;
+        fields_.clear();
+
+        if (name == "cycle") {
+            CycleFields();
+        }
+        else if (name == "tracker") {
+            TrackerFields();
+        }
+        else if (name == "refinement") {
+            RefinementFields();
+        }
+        else if (name == "scan_phase" || name == "refine_phase") {
+            phase_ = name == "scan_phase" ? &config_.parameters.scan_phase : &config_.parameters.refine_phase;
+        }
+        else if (name == "cell") {
+            if (cells_started_)
+                Error(line, "[cell] must come before any [cell.<name>] section");
+            cell_ = &config_.cell_defaults;
+            CellFields(*cell_);
+        }
+        else if (name.rfind("cell.", 0) == 0 && name.size() > 5) {
+            std::string cell_name = name.substr(5);
+            for (auto& cell : config_.cells) {
+                if (cell.name == cell_name)
+                    Error(line, "Cell " + cell_name + " is described twice");
+            }
+            cells_started_ = true;
+            config_.cells.push_back(config_.cell_defaults);
+            config_.cells.back().name = cell_name;
+            cell_ = &config_.cells.back();
+            CellFields(*cell_);
+        }
+        else {
+            Error(line, "Unknown section [" + name + "]");
+            unknown_section_ = true;
+        }
+    }
+
+    void ParseLine(const std::string& raw, int line) {
+        // A comment runs from ';' or '#' at the start of the line or after whitespace to the end of the line
+        std::string text = raw;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if ((text[i] == ';' || text[i] == '#') && (i == 0 || text[i - 1] == ' ' || text[i - 1] == '\t')) {
+                text.resize(i);
+                break;
+            }
+        }
+        text = Trim(text);
+        if (text.empty())
+            return;
+
+        if (text.front() == '[') {
+            if (text.back() != ']') {
+                Error(line, "Section header is missing ']'");
+                return;
+            }
+            BeginSection(Trim(text.substr(1, text.size() - 2)), line);
+            return;
+        }
+
+        auto equals = text.find('=');
+        if (equals == std::string::npos) {
+            Error(line, "Expected key = value");
+            return;
+        }
+        std::string key = Trim(text.substr(0, equals));
+        std::string value = Trim(text.substr(equals + 1));
+
+        if (unknown_section_)
+            return;
+        if (section_.empty()) {
+            Error(line, "Key " + key + " comes before the first section");
+            return;
+        }
+
+        auto [previous, inserted] = seen_.emplace(section_ + "." + key, line);
+        if (!inserted) {
+            Error(line, key + " was already given on line " + std::to_string(previous->second));
+            return;
+        }
+
+        try {
+            if (phase_) {
+                // Parameter names depend on the vTools in the recipe, so they are checked when the phase is entered
+                if (key == "recipe")
+                    Text(phase_->recipe)(value);
+                else
+                    phase_->parameters.emplace_back(key, value);
+            }
+            else if (cell_ && key.rfind("recipe.", 0) == 0 && key.size() > 7) {
+                std::string path;
+                Text(path)(value);
+                cell_->extra_recipes.emplace_back(key.substr(7), path);
+            }
+            else if (fields_.count(key)) {
+                fields_[key](value);
+            }
+            else {
+                Error(line, "Unknown key " + key + " in [" + section_ + "]");
+            }
+        }
+        catch (const std::exception& e) {
+            Error(line, key + ": " + e.what());
+        }
+    }
+
+    /**
+     * Checks relations between values that each passed their own range check.
+     */
+    void Validate() {
+        auto fail = [&](const std::string& message) { errors_.push_back(path_ + ": " + message); };
+        auto& p = config_.parameters;
+
+        if (p.refinement.min_frames > p.refinement.max_frames)
+            fail("refinement min_frames is greater than max_frames");
+
+        XY start = p.mobileScanStart();
+        if (start.x >= p.workspace.x)
+            fail("The scan starts at x = " + Format(start.x) + " mm, outside the workspace");
+        if (p.workspace.x > p.stage_travel.x || p.workspace.y > p.stage_travel.y)
+            fail("The workspace " + p.workspace.toString() + " does not fit in the stage travel " + p.stage_travel.toString());
+
+        std::vector<const CellConfig*> cells;
+        for (auto& cell : config_.cells) {
+            cells.push_back(&cell);
+        }
+        if (cells.empty())
+            cells.push_back(&config_.cell_defaults);
+
+        for (auto* phase : {&p.scan_phase, &p.refine_phase}) {
+            if (phase->recipe.empty())
+                continue;
+            for (auto* cell : cells) {
+                bool loaded = phase->recipe == cell->recipe_path;
+                for (auto& extra : cell->extra_recipes) {
+                    loaded = loaded || extra.first == phase->recipe;
+                }
+                if (!loaded)
+                    fail("Phase recipe " + phase->recipe + " is not preloaded by cell " +
+                         (cell->name.empty() ? "[cell]" : cell->name));
+            }
+        }
+
+        // A retained image holds on to its grab buffer, so the camera has to keep enough of them to grab into
+        int buffers = CameraBuffers(p);
+        for (auto* cell : cells) {
+            if (cell->retained_frames > buffers - FREE_GRAB_BUFFERS)
+                fail("retained_frames = " + std::to_string(cell->retained_frames) + " of cell " +
+                     (cell->name.empty() ? "[cell]" : cell->name) + " leaves fewer than " + std::to_string(FREE_GRAB_BUFFERS) +
+                     " of the camera's " + std::to_string(buffers) + " grab buffers (MaxNumBuffer) free");
+        }
+    }
+
+    /**
+     * Grab buffers of the camera: the smallest MaxNumBuffer a phase sets, or pylon's default if none does.
+     */
+    static int CameraBuffers(const CycleParameters& p) {
+        int buffers = 0;
+        const std::string name = "MaxNumBuffer";
+        for (auto* phase : {&p.scan_phase, &p.refine_phase}) {
+            for (auto& parameter : phase->parameters) {
+                if (parameter.first.size() < name.size() ||
+                    parameter.first.compare(parameter.first.size() - name.size(), name.size(), name) != 0)
+                    continue;
+                int value = 0;
+                try {
+                    value = std::stoi(parameter.second);
+                }
+                catch (const std::exception&) {
+                    continue; // The recipe rejects it when the phase is applied
+                }
+                buffers = buffers ? (std::min)(buffers, value) : value;
+            }
+        }
+        return buffers ? buffers : PYLON_DEFAULT_MAX_NUM_BUFFER;
+    }
+};
+
+/**
+ * Watches a config file and reloads it when it changes, keeping the last valid contents if an edit is invalid.
+ */
+class ConfigWatcher {
+public:
+    /**
+     * Loads the file once.
+     * \throws std::runtime_error if the file cannot be read or is invalid
+     */
+    ConfigWatcher(std::string path, const ScannerConfig& defaults)
+        : path_(std::move(path)), defaults_(defaults) {
+        current_ = ConfigLoader::Load(path_, defaults_);
+        modified_ = LastModified();
+        Logger::info("Loaded config " + path_);
+    }
+
+    const ScannerConfig& Current() const {
+        return current_;
+    }
+
+    const std::string& Path() const {
+        return path_;
+    }
+
+    /**
+     * Reloads the file if it was written since the last load.
+     * \return true if new values were loaded. An invalid file is logged and the previous values are kept.
+     */
+    bool ReloadIfChanged() {
+        auto modified = LastModified();
+        if (modified == modified_)
+            return false;
+        modified_ = modified;
+        return Reload();
+    }
+
+    /**
+     * Reloads the file unconditionally.
+     * \return true if the file was valid
+     */
+    bool Reload() {
+        try {
+            current_ = ConfigLoader::Load(path_, defaults_);
+            Logger::info("Reloaded config " + path_);
+            return true;
+        }
+        catch (const std::exception& e) {
+            last_error_ = e.what();
+            Logger::error(last_error_ + "\nKeeping the previous config");
+            return false;
+        }
+    }
+
+    const std::string& LastError() const {
+        return last_error_;
+    }
+
+private:
+    std::string path_;
+    ScannerConfig defaults_;
+    ScannerConfig current_;
+    std::filesystem::file_time_type modified_;
+    std::string last_error_;
+
+    std::filesystem::file_time_type LastModified() const {
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(path_, error);
+        return error ? std::filesystem::file_time_type::min() : time;
+    }
+};
+
+#endif // CONFIG_H
@@ -0,0 +1,87 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC-16/Modbus (reflected polynomial 0xA001, initial value 0xFFFF).
+ * The lookup tables are generated at compile time, so every function here can be used in constant expressions.
+ */
+namespace Crc16
+{
+    constexpr uint16_t POLYNOMIAL = 0xA001;
+    constexpr uint16_t INITIAL = 0xFFFF;
+
+    using Table = std::array<uint16_t, 256>;
+
+    /**
+     * Builds the slicing tables. tables[k][b] is the CRC contribution of byte b followed by k zero bytes,
+     * which lets four input bytes be folded into the CRC with four independent lookups.
+     */
+    constexpr std::array<Table, 4> MakeTables() {
+        std::array<Table, 4> tables{};
+        for (uint16_t byte = 0; byte < 256; ++byte) {
+            uint16_t crc = byte;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 0x0001) ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+            }
+            tables[0][byte] = crc;
+        }
+        for (size_t k = 1; k < tables.size(); ++k) {
+            for (uint16_t byte = 0; byte < 256; ++byte) {
+                uint16_t previous = tables[k - 1][byte];
+                tables[k][byte] = (previous >> 8) ^ tables[0][previous & 0xFF];
+            }
+        }
+        return tables;
+    }
+
+    constexpr std::array<Table, 4> tables = MakeTables();
+
+    /**
+     * Reference implementation, one bit at a time. Kept to validate the table driven versions.
+     */
+    constexpr uint16_t Bitwise(const uint8_t* data, size_t length, uint16_t crc = INITIAL) {
+        for (size_t pos = 0; pos < length; ++pos) {
+            crc ^= data[pos];
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 0x0001) ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+            }
+        }
+        return crc;
+    }
+
+    /**
+     * Classic table driven CRC, one byte per lookup.
+     */
+    constexpr uint16_t Bytewise(const uint8_t* data, size_t length, uint16_t crc = INITIAL) {
+        for (size_t pos = 0; pos < length; ++pos) {
+            crc = (crc >> 8) ^ tables[0][(crc ^ data[pos]) & 0xFF];
+        }
+        return crc;
+    }
+
+    /**
+     * Slice-by-4 CRC. Four bytes per step with independent lookups, then finishes the tail bytewise.
+     */
+    constexpr uint16_t Compute(const uint8_t* data, size_t length, uint16_t crc = INITIAL) {
+        size_t pos = 0;
+        for (; pos + 4 <= length; pos += 4) {
+            crc ^= static_cast<uint16_t>(data[pos] | (data[pos + 1] << 8));
+            crc = tables[3][crc & 0xFF] ^ tables[2][crc >> 8] ^ tables[1][data[pos + 2]] ^ tables[0][data[pos + 3]];
+        }
+        return Bytewise(data + pos, length - pos, crc);
+    }
+
+    template <size_t N>
+    constexpr uint16_t Compute(const std::array<uint8_t, N>& data) {
+        return Compute(data.data(), N);
+    }
+}
+
+static_assert(Crc16::Compute(std::array<uint8_t, 9>{'1', '2', '3', '4', '5', '6', '7', '8', '9'}) == 0x4B37,
+              "Crc16::Compute must produce the CRC-16/Modbus check value");
+
+#endif // CRC16_H
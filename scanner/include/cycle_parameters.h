@@ -0,0 +1,55 @@
+#ifndef CYCLE_PARAMETERS_H
+#define CYCLE_PARAMETERS_H
+
+#include "detection_tracker.h"
+#include "motion_planner.h"
+#include "recipe_phase.h"
+#include "refine_estimator.h"
+#include "xy.h"
+
+enum AxisAlignment {
+    ALIGNED = 1,
+    INVERTED = -1
+};
+
+/**
+ * Tuning parameters of a scan, grasp and mate cycle. Shared by all cells driven from one process.
+ */
+struct CycleParameters {
+    // Camera parameters
+    XY camera_alignment{XY(AxisAlignment::INVERTED, AxisAlignment::ALIGNED)};
+    double fixed_tolerance{0.1}; // mm
+    double mobile_tolerance{1.0}; // mm
+    double fixed_scale_factor{0.59}; // Prevents overshoot if the distance measured is greater than actual distance
+    double mobile_scale_factor{0.59};
+
+    // Workspace parameters
+    XY workspace{XY(400.0, 450.0)};
+    XY camera_to_gripper{XY(-164.1, 0.5)}; // mm
+    XY stage_travel{XY(400.0, 600.0)}; // mm, SEL travel every XY move is checked against. Must contain the workspace.
+
+    // Scanning parameters
+    double scan_width{35.0}; // mm
+    int scan_speed{200}; // mm/s
+    int refinement_speed{200}; // mm/s
+    double frame_latency{0.0}; // s, from exposure until the result arrives. Detections use the position at exposure.
+    double scan_status_period{0.0}; // s, shortest time between status polls while scanning. 0 polls after every frame.
+    double link_budget{0.8}; // Fraction of the SEL link capacity used. Commands go first, status polls share the rest.
+    TrackerSettings tracker; // When a detection seen while scanning is trusted enough to stop for
+    RefinementSettings refinement; // Frames averaged per correction while refining
+
+    // Recipe parameters for each phase, e.g. a smaller ROI and shorter exposure while refining.
+    // Parameter names depend on the vTool names in the recipe, so both are empty by default.
+    PhaseSettings scan_phase;
+    PhaseSettings refine_phase;
+
+    // Motion limits used by the move planner. Refit these from the MoveTiming debug logs.
+    Motion::AxisLimits x_axis_limits{400.0, 0.5}; // mm/s, G
+    Motion::AxisLimits y_axis_limits{400.0, 0.5}; // mm/s, G
+
+    XY mobileScanStart() const {
+        return XY(-camera_to_gripper.x + scan_width, 0.0);
+    }
+};
+
+#endif // CYCLE_PARAMETERS_H
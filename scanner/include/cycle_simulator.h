@@ -0,0 +1,557 @@
+#ifndef CYCLE_SIMULATOR_H
+#define CYCLE_SIMULATOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async.h"
+#include "clock.h"
+#include "cycle_parameters.h"
+#include "motion_planner.h"
+#include "recipe_phase.h"
+#include "scan_refine.h"
+#include "scan_state.h"
+#include "tolerance_stack.h"
+#include "xoshiro.h"
+#include "xy.h"
+
+/**
+ * The parts of a cell the cycle simulation stands in for: camera, stage and gripper.
+ */
+struct SimulatedWorld {
+    double frame_rate{30.0};          // Hz, results per second from the recipe
+    double field_of_view{35.0};       // mm, square
+    double detection_rate{0.9};       // Probability a connector in view is detected when the stage is at rest
+    double blur_speed{1500.0};        // mm/s at which motion blur has removed every detection, falling linearly
+    double scan_noise{0.5};           // mm, uniform error of a detection taken while scanning
+    double false_positive_rate{0.02}; // Probability of a spurious detection per frame
+    double grasp_time{1.5};           // s, Z moves and gripper closing in GraspMobile
+    double mate_time{1.5};            // s, Z moves and gripper opening in MateMobileToFixed
+    double max_cycle_time{300.0};     // s, cycles still running after this count as failed in the phase they reached
+    ToleranceModel tolerances;        // Encoder, gripper and camera uncertainties and the mate tolerance
+};
+
+namespace Detail
+{
+    inline std::chrono::steady_clock::duration Seconds(double seconds) {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    inline double SecondsBetween(Time::Clock::time_point from, Time::Clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
+    }
+}
+
+/**
+ * Stands in for Commander in the scan and refine loops of scan_refine.h. Moves follow the trapezoidal
+ * profile of the plan Motion::Planner makes for them, on Time::Clock, and end off target by the encoder
+ * uncertainty. Status reads return the actual position.
+ */
+class SimulatedStage {
+public:
+    XY position;            // mm, as of the last status read
+    bool in_motion{false};  // As of the last status read
+    XY travel;              // mm
+    int moves{0};           // Moves started since Reset
+
+    SimulatedStage(const CycleParameters& parameters, const SimulatedWorld& world, UniformBuffer& uniform)
+        : travel(parameters.stage_travel), world_(world), uniform_(uniform) {
+        planner_.x_limits = parameters.x_axis_limits;
+        planner_.y_limits = parameters.y_axis_limits;
+    }
+
+    /**
+     * Places the stage at rest and starts the cycle's time limit.
+     */
+    void Reset(XY start) {
+        segment_ = Segment();
+        segment_.from = start;
+        segment_.to = start;
+        segment_.start = Time::Clock::now();
+        cycle_start_ = segment_.start;
+        position = start;
+        in_motion = false;
+        moves = 0;
+    }
+
+    Motion::MovePlan MoveTo(XY target, double velocity_cap = 0.0) {
+        CheckTime();
+        auto now = Time::Clock::now();
+        XY from = PositionAt(now);
+        auto plan = planner_.Plan(from, target, velocity_cap);
+        XY to = target + UniformXY(world_.tolerances.encoder_xy);
+        double accel_mm = plan.acceleration * Motion::MM_PER_G;
+        double distance = (to - from).magnitude();
+        double velocity = (std::min)(double(plan.velocity), std::sqrt(distance * accel_mm));
+        segment_ = Segment{from, to, now, 0.0, velocity, accel_mm};
+        ++moves;
+        return plan;
+    }
+
+    Async::Task<Motion::MovePlan> Move(XY target, double velocity_cap = 0.0) {
+        auto plan = MoveTo(target, velocity_cap);
+        co_await XYDone();
+        co_return plan;
+    }
+
+    Async::Task<void> XYDone() {
+        Time::SleepUntil(segment_.End());
+        Update();
+        co_return;
+    }
+
+    Async::Task<bool> ReadStatus() {
+        Update();
+        co_return true;
+    }
+
+    bool PollSEL() {
+        CheckTime();
+        Update();
+        return true;
+    }
+
+    /**
+     * Stops with the full deceleration of the move in progress.
+     */
+    void HaltAll() {
+        auto now = Time::Clock::now();
+        double speed = 0.0;
+        XY from = segment_.At(now, speed);
+        XY direction = segment_.Direction();
+        double distance = segment_.acceleration > 0.0 ? speed * speed / (2.0 * segment_.acceleration) : 0.0;
+        segment_ = Segment{from, from + direction * distance, now, speed, speed, segment_.acceleration};
+    }
+
+    XY PositionAt(Time::Clock::time_point time) const {
+        double speed = 0.0;
+        return segment_.At(time, speed);
+    }
+
+    double SpeedAt(Time::Clock::time_point time) const {
+        double speed = 0.0;
+        segment_.At(time, speed);
+        return speed;
+    }
+
+private:
+    /**
+     * Straight move from a start speed up to a peak speed, then down to rest.
+     */
+    struct Segment {
+        XY from;
+        XY to;
+        Time::Clock::time_point start;
+        double start_speed{0.0};  // mm/s
+        double peak_speed{0.0};   // mm/s
+        double acceleration{0.0}; // mm/s^2
+
+        double Distance() const {
+            return (to - from).magnitude();
+        }
+
+        XY Direction() const {
+            double distance = Distance();
+            return distance > 0.0 ? (to - from) * (1.0 / distance) : XY(0, 0);
+        }
+
+        double Duration() const {
+            if (Distance() <= 0.0 || peak_speed <= 0.0 || acceleration <= 0.0)
+                return 0.0;
+            double up = (peak_speed - start_speed) / acceleration;
+            double down = peak_speed / acceleration;
+            double cruise = (Distance() - (start_speed + peak_speed) / 2.0 * up - peak_speed / 2.0 * down) / peak_speed;
+            return up + (std::max)(0.0, cruise) + down;
+        }
+
+        Time::Clock::time_point End() const {
+            return start + Detail::Seconds(Duration());
+        }
+
+        XY At(Time::Clock::time_point time, double& speed) const {
+            double distance = Distance();
+            double t = Detail::SecondsBetween(start, time);
+            double duration = Duration();
+            speed = 0.0;
+            if (duration <= 0.0 || t >= duration)
+                return to;
+            if (t <= 0.0) {
+                speed = start_speed;
+                return from;
+            }
+
+            double up = (peak_speed - start_speed) / acceleration;
+            double down = peak_speed / acceleration;
+            double s;
+            if (t < up) {
+                speed = start_speed + acceleration * t;
+                s = start_speed * t + 0.5 * acceleration * t * t;
+            } else if (t < duration - down) {
+                speed = peak_speed;
+                s = (start_speed + peak_speed) / 2.0 * up + peak_speed * (t - up);
+            } else {
+                double remaining = duration - t;
+                speed = acceleration * remaining;
+                s = distance - 0.5 * acceleration * remaining * remaining;
+            }
+            return from + (to - from) * ((std::min)(s, distance) / distance);
+        }
+    };
+
+    const SimulatedWorld& world_;
+    UniformBuffer& uniform_;
+    Motion::Planner planner_;
+    Segment segment_;
+    Time::Clock::time_point cycle_start_;
+
+    XY UniformXY(double limit) {
+        double x = uniform_.Next(-limit, limit);
+        return XY(x, uniform_.Next(-limit, limit));
+    }
+
+    void Update() {
+        auto now = Time::Clock::now();
+        position = PositionAt(now);
+        in_motion = now < segment_.End();
+    }
+
+    void CheckTime() {
+        if (Detail::SecondsBetween(cycle_start_, Time::Clock::now()) > world_.max_cycle_time)
+            throw std::runtime_error("SimulatedStage: cycle exceeded " + std::to_string(world_.max_cycle_time) + " s");
+    }
+};
+
+/**
+ * Stands in for PylonRecipe in the scan and refine loops of scan_refine.h. The camera runs freely at the
+ * frame rate on Time::Clock and every frame shows the connectors in view, fewer of them the faster the stage
+ * moves. A frame is taken like the recipe's result mailbox hands them out: the newest one not taken yet,
+ * waiting for the next exposure if there is none.
+ */
+class SimulatedCamera {
+public:
+    RecipePhase phase{RecipePhase::SCAN};
+    bool mobile_present{true}; // Cleared once the gripper holds the mobile connector
+    int frames{0};             // Frames taken since Reset
+
+    SimulatedCamera(const SimulatedWorld& world, const SimulatedStage& stage, UniformBuffer& uniform)
+        : world_(world), stage_(stage), uniform_(uniform) {}
+
+    /**
+     * \param first_exposure Time of the first frame, the phase of the free-running camera
+     */
+    void Reset(XY mobile, XY fixed, Time::Clock::time_point first_exposure) {
+        mobile_ = mobile;
+        fixed_ = fixed;
+        first_exposure_ = first_exposure;
+        last_taken_ = -1;
+        phase = RecipePhase::SCAN;
+        mobile_present = true;
+        frames = 0;
+    }
+
+    Async::Task<bool> NextFrame(CameraFrame& frame) {
+        return Take(Time::Clock::time_point::min(), frame);
+    }
+
+    Async::Task<bool> FrameAfter(Time::Clock::time_point after, CameraFrame& frame) {
+        return Take(after, frame);
+    }
+
+private:
+    const SimulatedWorld& world_;
+    const SimulatedStage& stage_;
+    UniformBuffer& uniform_;
+    XY mobile_;
+    XY fixed_;
+    Time::Clock::time_point first_exposure_;
+    int64_t last_taken_{-1};
+
+    Time::Clock::time_point Exposure(int64_t index) const {
+        return first_exposure_ + Detail::Seconds(index / world_.frame_rate);
+    }
+
+    // Index of the first frame exposed at or after a time
+    int64_t FirstAfter(Time::Clock::time_point time) const {
+        return int64_t(std::ceil(Detail::SecondsBetween(first_exposure_, time) * world_.frame_rate - 1e-9));
+    }
+
+    Async::Task<bool> Take(Time::Clock::time_point after, CameraFrame& frame) {
+        int64_t index = last_taken_ + 1;
+        if (after != Time::Clock::time_point::min())
+            index = (std::max)(index, FirstAfter(after));
+        int64_t newest = FirstAfter(Time::Clock::now() + Detail::Seconds(1e-9)) - 1;
+        index = (std::max)(index, newest);
+        Time::SleepUntil(Exposure(index));
+
+        last_taken_ = index;
+        ++frames;
+        frame.capture_time = Exposure(index);
+        XY position = stage_.PositionAt(frame.capture_time);
+        double speed = stage_.SpeedAt(frame.capture_time);
+        frame.mobile.clear();
+        frame.fixed.clear();
+        if (mobile_present)
+            Detect(mobile_, position, speed, frame.mobile);
+        Detect(fixed_, position, speed, frame.fixed);
+        co_return true;
+    }
+
+    XY UniformXY(double limit) {
+        double x = uniform_.Next(-limit, limit);
+        return XY(x, uniform_.Next(-limit, limit));
+    }
+
+    /**
+     * Detections of an object in one frame, as CameraOffset reports them, with spurious ones while scanning.
+     */
+    void Detect(XY object, XY stage, double speed, std::vector<OffsetSample>& samples) {
+        auto& t = world_.tolerances;
+        bool scanning = phase == RecipePhase::SCAN;
+        XY offset = stage - object;
+        double rate = world_.detection_rate * (std::max)(0.0, 1.0 - speed / world_.blur_speed);
+        if (std::abs(offset.x) <= world_.field_of_view / 2.0 && std::abs(offset.y) <= world_.field_of_view / 2.0 &&
+            uniform_.Next(0.0, 1.0) < rate) {
+            samples.push_back({offset * t.camera_gain + UniformXY(scanning ? world_.scan_noise : t.camera_xy), uniform_.Next(0.6, 1.0)});
+        }
+        if (scanning && uniform_.Next(0.0, 1.0) < world_.false_positive_rate)
+            samples.push_back({UniformXY(world_.field_of_view / 2.0), uniform_.Next(0.3, 0.9)});
+    }
+};
+
+enum class CycleFailure {
+    NONE,
+    MOBILE_NOT_FOUND,
+    MOBILE_NOT_REFINED,
+    FIXED_NOT_FOUND,
+    FIXED_NOT_REFINED,
+    OUT_OF_TOLERANCE,
+};
+
+struct CycleOutcome {
+    CycleFailure failure{CycleFailure::NONE};
+    double time{0.0}; // s, from the start of the mobile scan until the mate or the failure
+    int refine_moves{0};
+    int frames{0};
+
+    bool Success() const {
+        return failure == CycleFailure::NONE;
+    }
+};
+
+/**
+ * Simulates the scan, refine, grasp and mate cycle of Cell::Cycle.
+ *
+ * The scan and refine loops are the scanner's own from scan_refine.h, run against a SimulatedStage and a
+ * SimulatedCamera in virtual time, so a simulated cycle takes no wall time. Grasp and mate are a move
+ * under the gripper and a fixed delay. The simulated devices wait with the blocking sleeps of Time::Clock,
+ * not on the event loop's timers: in virtual time both end at once, and polling the loop for every frame
+ * would cost more than the rest of the cycle.
+ */
+class CycleSimulator {
+public:
+    CycleSimulator(const CycleParameters& parameters, const SimulatedWorld& world, uint64_t seed)
+        : p_(parameters), world_(world), seed_(seed), generator_(seed, 0), uniform_(generator_),
+          stage_(p_, world_, uniform_), camera_(world_, stage_, uniform_) {}
+
+    /**
+     * Simulates one cycle. The random numbers of a cycle only depend on the seed and its index, so cycle i
+     * draws the same connector positions whatever the parameters and whichever cycles ran before.
+     * \param cycle Index of the cycle in the run
+     */
+    CycleOutcome Run(uint64_t cycle) {
+        generator_ = Xoshiro256PlusX4(CycleSeed(seed_, cycle), 0);
+        uniform_.Discard();
+
+        Time::VirtualTime virtual_time(Time::Clock::time_point{});
+        auto start_time = Time::Clock::now();
+
+        // Connectors anywhere the camera can be centered on during the scan
+        XY start = p_.mobileScanStart();
+        XY mobile = XY(uniform_.Next(start.x, p_.workspace.x), uniform_.Next(0.0, p_.workspace.y));
+        XY fixed = XY(uniform_.Next(start.x, p_.workspace.x), uniform_.Next(0.0, p_.workspace.y));
+        stage_.Reset(start);
+        camera_.Reset(mobile, fixed, start_time + Detail::Seconds(uniform_.Next(0.0, 1.0 / world_.frame_rate)));
+
+        CycleOutcome outcome;
+        outcome.failure = CycleFailure::MOBILE_NOT_FOUND;
+        refine_moves_ = 0;
+        try {
+            outcome.failure = Async::Run(io_, Cycle(mobile, fixed, outcome.failure));
+        } catch (const std::runtime_error&) {
+            // Out of time, failed in the phase reached
+        }
+        outcome.time = Detail::SecondsBetween(start_time, Time::Clock::now());
+        outcome.frames = camera_.frames;
+        outcome.refine_moves = refine_moves_;
+        return outcome;
+    }
+
+private:
+    CycleParameters p_;
+    SimulatedWorld world_;
+    uint64_t seed_;
+    Xoshiro256PlusX4 generator_;
+    UniformBuffer uniform_;
+    SimulatedStage stage_;
+    SimulatedCamera camera_;
+    boost::asio::io_context io_; // Event loop of the cycles, kept between them
+    int refine_moves_{0};
+
+    // Mixes the cycle index into the seed. Neighbouring seeds of Xoshiro256PlusX4 share most of their
+    // state words, so the index is not simply added.
+    static uint64_t CycleSeed(uint64_t seed, uint64_t cycle) {
+        uint64_t z = seed ^ (cycle * 0xD1B54A32D192ED03ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    XY UniformXY(double limit) {
+        double x = uniform_.Next(-limit, limit);
+        return XY(x, uniform_.Next(-limit, limit));
+    }
+
+    /**
+     * The steps of Cell::Cycle up to the mate.
+     * \param failure Set to the failure of each phase as it starts, so a cycle out of time fails in it
+     * \return The failure, NONE after a mate within tolerance
+     */
+    Async::Task<CycleFailure> Cycle(XY mobile, XY fixed, CycleFailure& failure) {
+        ScanState scan(p_.mobileScanStart(), p_.workspace, p_.scan_width);
+
+        camera_.phase = RecipePhase::SCAN;
+        XY fixed_position;
+        auto [found, fixed_found] = co_await ScanForMobile(stage_, camera_, scan, p_.scan_speed, fixed_position, p_.tracker);
+        if (!found)
+            co_return failure;
+
+        failure = CycleFailure::MOBILE_NOT_REFINED;
+        camera_.phase = RecipePhase::REFINE;
+        if (!co_await Refine(&RefineToMobile<SimulatedStage, SimulatedCamera>, p_.mobile_tolerance, p_.mobile_scale_factor))
+            co_return failure;
+        XY mobile_residual = stage_.PositionAt(Time::Clock::now()) - mobile;
+
+        // GraspMobile, then set up to find the fixed connector
+        failure = CycleFailure::FIXED_NOT_FOUND;
+        co_await stage_.Move(stage_.position + p_.camera_to_gripper, p_.scan_speed);
+        Time::SleepFor(Detail::Seconds(world_.grasp_time));
+        camera_.mobile_present = false;
+        co_await stage_.Move(fixed_found ? fixed_position : stage_.position - p_.camera_to_gripper);
+
+        camera_.phase = RecipePhase::SCAN;
+        found = co_await ScanForFixed(stage_, camera_, scan, p_.scan_speed, p_.tracker);
+        if (!found) {
+            scan.Rewind();
+            found = co_await ScanForFixed(stage_, camera_, scan, p_.scan_speed, p_.tracker);
+        }
+        if (!found)
+            co_return failure;
+
+        failure = CycleFailure::FIXED_NOT_REFINED;
+        camera_.phase = RecipePhase::REFINE;
+        if (!co_await Refine(&RefineToFixed<SimulatedStage, SimulatedCamera>, p_.fixed_tolerance, p_.fixed_scale_factor))
+            co_return failure;
+        XY fixed_residual = stage_.PositionAt(Time::Clock::now()) - fixed;
+
+        // MateMobileToFixed
+        co_await stage_.Move(stage_.position + p_.camera_to_gripper, p_.scan_speed);
+        Time::SleepFor(Detail::Seconds(world_.mate_time));
+
+        auto& t = world_.tolerances;
+        XY error = fixed_residual - mobile_residual + UniformXY(t.gripper_xy) + UniformXY(t.encoder_xy) + UniformXY(t.encoder_xy);
+        double z = uniform_.Next(-t.encoder_z, t.encoder_z) + uniform_.Next(-t.gripper_z, t.gripper_z) +
+                   uniform_.Next(-t.camera_z, t.camera_z);
+        failure = error.magnitude() > t.xy_tolerance || std::abs(z) > t.z_tolerance ? CycleFailure::OUT_OF_TOLERANCE
+                                                                                     : CycleFailure::NONE;
+        co_return failure;
+    }
+
+    using RefineLoop = Async::Task<bool> (*)(SimulatedStage&, SimulatedCamera&, int, double, double, const RefinementSettings&);
+
+    // Runs a refine loop, counting its moves
+    Async::Task<bool> Refine(RefineLoop refine, double tolerance, double scale_factor) {
+        int moves = stage_.moves;
+        bool success = co_await refine(stage_, camera_, p_.refinement_speed, tolerance, scale_factor, p_.refinement);
+        refine_moves_ += stage_.moves - moves;
+        co_return success;
+    }
+};
+
+/**
+ * Outcome of many simulated cycles with one parameter set.
+ */
+struct CycleEstimate {
+    uint64_t cycles{0};
+    uint64_t successes{0};
+    double total_time{0.0};   // s, over all cycles including failed ones
+    uint64_t refine_moves{0};
+    uint64_t failures[6]{};   // Indexed by CycleFailure
+
+    double SuccessRate() const {
+        return cycles ? double(successes) / cycles : 0.0;
+    }
+
+    double MeanTime() const {
+        return cycles ? total_time / cycles : 0.0;
+    }
+
+    void Add(const CycleOutcome& outcome) {
+        ++cycles;
+        successes += outcome.Success();
+        total_time += outcome.time;
+        refine_moves += outcome.refine_moves;
+        ++failures[static_cast<size_t>(outcome.failure)];
+    }
+
+    void Add(const CycleEstimate& other) {
+        cycles += other.cycles;
+        successes += other.successes;
+        total_time += other.total_time;
+        refine_moves += other.refine_moves;
+        for (size_t i = 0; i < 6; ++i) {
+            failures[i] += other.failures[i];
+        }
+    }
+};
+
+/**
+ * Simulates cycles on all cores. Each cycle is seeded from the seed and its index, so with the same seed
+ * cycle i of every parameter set starts from the same connector positions and noise, and differences
+ * between parameter sets are not drowned out by sampling noise. The estimate does not depend on the
+ * number of threads.
+ * \param num_threads Zero uses one thread per hardware thread
+ */
+CycleEstimate SimulateCycles(const CycleParameters& parameters, const SimulatedWorld& world, uint64_t cycles,
+                             uint64_t seed = 1, size_t num_threads = 0) {
+    if (num_threads == 0)
+        num_threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+    num_threads = static_cast<size_t>((std::min)(uint64_t(num_threads), (std::max)(cycles, uint64_t(1))));
+
+    std::vector<CycleEstimate> partial(num_threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < num_threads; ++t) {
+        workers.emplace_back([&, t]() {
+            CycleSimulator simulator(parameters, world, seed);
+            for (uint64_t i = t; i < cycles; i += num_threads) {
+                partial[t].Add(simulator.Run(i));
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    CycleEstimate total;
+    for (auto& estimate : partial) {
+        total.Add(estimate);
+    }
+    return total;
+}
+
+#endif // CYCLE_SIMULATOR_H
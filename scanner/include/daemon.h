@@ -0,0 +1,290 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cell.h"
+#include "config.h"
+#include "logging.h"
+#include "multi_cell.h"
+
+/**
+ * Keeps cells open, homed and with their recipe loaded between cycles, and runs a cycle on request.
+ *
+ * Requests are read line by line from an input stream (stdin when run as scanner.exe --daemon):
+ *   cycle [cell...]   Run a cycle on the named cells, or on all cells, concurrently
+ *   dump [cell...]    Write the recipe results retained by the named cells, or all cells, to disk
+ *   reload            Reload the config file now
+ *   status            Report the cells and the startup time paid once at launch
+ *   quit              Shut down the cells and exit
+ *
+ * Every request gets exactly one reply line starting with "OK" or "ERR". Log lines are written to the same
+ * stream, so clients should only parse lines starting with those tokens.
+ *
+ * With a config file, the file is also reloaded before a cycle whenever it was written since the last load.
+ * New cycle parameters apply to every cell without reopening it; port, baud rate and recipe changes need a
+ * restart.
+ */
+class Daemon {
+public:
+    /**
+     * \param config Config file to reload between cycles, or nullptr
+     */
+    Daemon(std::vector<CellConfig> configs, CycleParameters parameters, ConfigWatcher* config = nullptr)
+        : configs_(std::move(configs)), parameters_(parameters), config_(config) {
+    }
+
+    /**
+     * Opens, homes and initializes every cell. This is the cost a single-shot run pays on every cycle.
+     * \return false if any cell failed to start
+     */
+    bool Start() {
+        auto start = std::chrono::steady_clock::now();
+        bool all_started = true;
+
+        for (auto& config : configs_) {
+            Logger::setContext(config.name);
+            auto result = RunGuarded(config.name,
+                [&]() {
+                    auto cell = std::make_unique<Cell>(config, parameters_);
+                    cell->Initialize();
+                    cells_.push_back(std::move(cell));
+                    return true;
+                },
+                []() {});
+            all_started = all_started && result.success;
+        }
+        Logger::setContext("");
+
+        startup_time_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Logger::info("Daemon::Start: " + std::to_string(cells_.size()) + " of " + std::to_string(configs_.size()) +
+                     " cells ready after " + std::to_string(startup_time_) + " s");
+        return all_started;
+    }
+
+    /**
+     * Serves requests until "quit" or the end of the input.
+     */
+    void Serve(std::istream& in, std::ostream& out) {
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream request(line);
+            std::string command;
+            request >> command;
+
+            if (command.empty())
+                continue;
+
+            if (command == "quit")
+                break;
+
+            if (command == "status") {
+                out << "OK ready cells=" << cells_.size() << " cycles=" << cycles_
+                    << " startup_ms=" << startup_time_ * 1000.0 << std::endl;
+                continue;
+            }
+
+            if (command == "reload") {
+                if (!config_) {
+                    out << "ERR no config file" << std::endl;
+                }
+                else if (config_->Reload()) {
+                    ApplyConfig();
+                    out << "OK reloaded " << config_->Path() << std::endl;
+                }
+                else {
+                    out << "ERR " << OneLine(config_->LastError()) << std::endl;
+                }
+                continue;
+            }
+
+            if (command == "dump") {
+                out << HandleDump(Names(request)) << std::endl;
+                continue;
+            }
+
+            if (command == "cycle") {
+                out << HandleCycle(Names(request)) << std::endl;
+                continue;
+            }
+
+            out << "ERR unknown command '" << command << "'" << std::endl;
+        }
+
+        Stop();
+    }
+
+    void Stop() {
+        for (auto& cell : cells_) {
+            Logger::setContext(cell->config.name);
+            try {
+                cell->Shutdown();
+            }
+            catch (const std::exception& e) {
+                Logger::error("Daemon::Stop: " + std::string(e.what()));
+            }
+        }
+        Logger::setContext("");
+        cells_.clear();
+    }
+
+private:
+    std::vector<CellConfig> configs_;
+    CycleParameters parameters_;
+    std::vector<std::unique_ptr<Cell>> cells_;
+    double startup_time_{0.0}; // s
+    size_t cycles_{0};
+
+    std::vector<Cell*> faulted_; // Cells whose last cycle threw and must be re-initialized first
+    std::mutex faulted_mutex_;
+    ConfigWatcher* config_;
+
+    // Cell names following a command
+    static std::vector<std::string> Names(std::istream& request) {
+        std::vector<std::string> names;
+        std::string name;
+        while (request >> name) {
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    std::vector<Cell*> Select(const std::vector<std::string>& names) {
+        std::vector<Cell*> selected;
+        for (auto& cell : cells_) {
+            if (names.empty() || std::find(names.begin(), names.end(), cell->config.name) != names.end())
+                selected.push_back(cell.get());
+        }
+        return selected;
+    }
+
+    // Replies are a single line
+    static std::string OneLine(std::string text) {
+        std::replace(text.begin(), text.end(), '\n', ' ');
+        return text;
+    }
+
+    /**
+     * Hands the config just loaded to every cell. Only called between cycles.
+     */
+    void ApplyConfig() {
+        auto& current = config_->Current();
+        parameters_ = current.parameters;
+
+        for (auto& cell : cells_) {
+            Logger::setContext(cell->config.name);
+            cell->SetParameters(parameters_);
+
+            const CellConfig* updated = current.cells.empty() ? &current.cell_defaults : nullptr;
+            for (auto& candidate : current.cells) {
+                if (candidate.name == cell->config.name)
+                    updated = &candidate;
+            }
+            if (updated && (updated->sel_port != cell->config.sel_port || updated->sel_rate != cell->config.sel_rate ||
+                updated->probe_sel_rate != cell->config.probe_sel_rate ||
+                updated->gripper_port != cell->config.gripper_port || updated->gripper_rate != cell->config.gripper_rate ||
+                updated->recipe_path != cell->config.recipe_path || updated->extra_recipes != cell->config.extra_recipes ||
+                updated->retained_frames != cell->config.retained_frames || updated->dump_directory != cell->config.dump_directory)) {
+                Logger::warn("Daemon: Port, baud rate and recipe changes to this cell take effect after a restart");
+            }
+        }
+        Logger::setContext("");
+    }
+
+    CellResult RunRecovering(Cell& cell) {
+        bool faulted;
+        {
+            std::lock_guard<std::mutex> lock(faulted_mutex_);
+            auto it = std::find(faulted_.begin(), faulted_.end(), &cell);
+            faulted = it != faulted_.end();
+            if (faulted)
+                faulted_.erase(it);
+        }
+
+        if (faulted) {
+            Logger::setContext(cell.config.name);
+            Logger::warn("Daemon: Re-initializing cell after a failed cycle");
+            auto init = RunGuarded(cell.config.name, [&]() { cell.Initialize(); return true; }, [&]() { cell.Halt(); });
+            Logger::setContext("");
+            if (!init.success) {
+                std::lock_guard<std::mutex> lock(faulted_mutex_);
+                faulted_.push_back(&cell);
+                return init;
+            }
+        }
+
+        auto result = RunCycle(cell);
+        if (!result.error.empty()) {
+            std::lock_guard<std::mutex> lock(faulted_mutex_);
+            faulted_.push_back(&cell);
+        }
+        return result;
+    }
+
+    std::string HandleDump(const std::vector<std::string>& names) {
+        auto selected = Select(names);
+        if (selected.empty())
+            return "ERR no matching cells";
+
+        std::ostringstream reply;
+        reply << "OK";
+        for (auto* cell : selected) {
+            Logger::setContext(cell->config.name);
+            auto directory = cell->DumpFrames("operator");
+            reply << " " << (cell->config.name.empty() ? "cell" : cell->config.name) << "="
+                  << (directory.empty() ? "none" : directory.string());
+        }
+        Logger::setContext("");
+        return reply.str();
+    }
+
+    std::string HandleCycle(const std::vector<std::string>& names) {
+        if (config_ && config_->ReloadIfChanged())
+            ApplyConfig();
+
+        auto selected = Select(names);
+        if (selected.empty())
+            return "ERR no matching cells";
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<CellResult> results(selected.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < selected.size(); ++i) {
+            workers.emplace_back([&, i]() { results[i] = RunRecovering(*selected[i]); });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        ReportAllocations();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ++cycles_;
+
+        std::ostringstream reply;
+        bool all_succeeded = true;
+        for (auto& result : results) {
+            all_succeeded = all_succeeded && result.success;
+        }
+
+        // A single-shot run would have paid the startup time on top of this cycle.
+        reply << (all_succeeded ? "OK" : "ERR") << " cycle_ms=" << elapsed * 1000.0
+              << " saved_startup_ms=" << startup_time_ * 1000.0
+              << " total_saved_ms=" << startup_time_ * 1000.0 * (cycles_ - 1);
+
+        for (auto& result : results) {
+            reply << " " << (result.name.empty() ? "cell" : result.name) << "=" << (result.success ? "success" : "failure")
+                  << ":" << result.cycle_time * 1000.0;
+        }
+        return reply.str();
+    }
+};
+
+#endif // DAEMON_H
@@ -0,0 +1,152 @@
+#ifndef DETECTION_TRACKER_H
+#define DETECTION_TRACKER_H
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <vector>
+#include "xy.h"
+
+/**
+ * A single detection converted to stage coordinates.
+ */
+struct Detection {
+    XY position; // mm, stage position that would center the camera on the object
+    double score{0.0};
+};
+
+/**
+ * A hypothesis that consecutive detections belong to the same physical object.
+ */
+struct Track {
+    int id{0};
+    XY position;             // mm, score weighted mean of the associated detections
+    double confidence{0.0};  // Smoothed detection score, decays on frames without a detection
+    double weight{0.0};      // Sum of scores folded into position
+    int hits{0};             // Frames with an associated detection
+    int misses{0};           // Consecutive frames without an associated detection
+};
+
+struct TrackerSettings {
+    int confirm_hits{2};        // Hits before a track is trusted
+    double min_confidence{0.5}; // Confidence a confirmed track must keep
+    double gate{10.0};          // mm, furthest a detection may be from a track to be associated with it
+    int max_misses{5};          // Consecutive misses before a track is dropped
+    double smoothing{0.5};      // Weight of the newest score in the confidence
+};
+
+/**
+ * Associates detections across frames so a single-frame false positive does not stop a scan.
+ *
+ * Each frame, detections are matched to existing tracks greedily by distance inside the gate. Unmatched
+ * detections start new tracks and unmatched tracks record a miss. A track becomes confirmed once it has
+ * enough hits and its confidence stays above the threshold.
+ */
+class DetectionTracker {
+public:
+    explicit DetectionTracker(TrackerSettings settings = TrackerSettings()) : settings_(settings) {}
+
+    /**
+     * Feeds the detections of one frame. Call with an empty vector for frames without detections.
+     * \return The best confirmed track, or nullptr if none is confirmed yet
+     */
+    const Track* Update(const std::vector<Detection>& detections) {
+        std::vector<std::tuple<double, size_t, size_t>> pairs; // distance, track, detection
+        for (size_t t = 0; t < tracks_.size(); ++t) {
+            for (size_t d = 0; d < detections.size(); ++d) {
+                double distance = (detections[d].position - tracks_[t].position).magnitude();
+                if (distance <= settings_.gate)
+                    pairs.emplace_back(distance, t, d);
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+
+        std::vector<bool> track_matched(tracks_.size(), false);
+        std::vector<bool> detection_matched(detections.size(), false);
+
+        for (auto& [distance, t, d] : pairs) {
+            if (track_matched[t] || detection_matched[d])
+                continue;
+            track_matched[t] = true;
+            detection_matched[d] = true;
+            Associate(tracks_[t], detections[d]);
+        }
+
+        for (size_t t = 0; t < tracks_.size(); ++t) {
+            if (!track_matched[t]) {
+                ++tracks_[t].misses;
+                tracks_[t].confidence *= (1.0 - settings_.smoothing);
+            }
+        }
+
+        tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(),
+                                     [&](const Track& track) { return track.misses > settings_.max_misses; }),
+                      tracks_.end());
+
+        for (size_t d = 0; d < detections.size(); ++d) {
+            if (!detection_matched[d]) {
+                Track track;
+                track.id = next_id_++;
+                track.position = detections[d].position;
+                track.confidence = detections[d].score;
+                track.weight = (std::max)(detections[d].score, 1e-9);
+                track.hits = 1;
+                tracks_.push_back(track);
+            }
+        }
+
+        return Confirmed();
+    }
+
+    /**
+     * \return The confirmed track with the highest confidence, or nullptr
+     */
+    const Track* Confirmed() const {
+        const Track* best = nullptr;
+        for (auto& track : tracks_) {
+            if (IsConfirmed(track) && (!best || track.confidence > best->confidence))
+                best = &track;
+        }
+        return best;
+    }
+
+    /**
+     * \return The track with the most evidence (hits times confidence) whether confirmed or not, or nullptr
+     */
+    const Track* Best() const {
+        const Track* best = nullptr;
+        for (auto& track : tracks_) {
+            if (!best || track.hits * track.confidence > best->hits * best->confidence)
+                best = &track;
+        }
+        return best;
+    }
+
+    bool IsConfirmed(const Track& track) const {
+        return track.hits >= settings_.confirm_hits && track.confidence >= settings_.min_confidence;
+    }
+
+    const std::vector<Track>& Tracks() const {
+        return tracks_;
+    }
+
+    void Reset() {
+        tracks_.clear();
+    }
+
+private:
+    TrackerSettings settings_;
+    std::vector<Track> tracks_;
+    int next_id_{0};
+
+    void Associate(Track& track, const Detection& detection) {
+        double weight = (std::max)(detection.score, 1e-9);
+        track.position = (track.position * track.weight + detection.position * weight) / (track.weight + weight);
+        track.weight += weight;
+        track.confidence = (1.0 - settings_.smoothing) * track.confidence + settings_.smoothing * detection.score;
+        ++track.hits;
+        track.misses = 0;
+    }
+};
+
+#endif // DETECTION_TRACKER_H
@@ -0,0 +1,271 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "logging.h"
+#include "mailbox.h"
+
+/**
+ * Keeps the last frames pushed by a recipe so a failed cycle can be diagnosed from what the camera saw.
+ *
+ * The slots are allocated once when the ring is sized. Recording copy-assigns into the oldest slot, which
+ * reuses the storage the slot already holds, so after the first lap a frame costs an uncontended lock and a
+ * copy of its detections. Values that share their buffers on copy, like pylon images, are only referenced.
+ * A ring of size zero records nothing and costs a load of a flag. Has no pylon dependency, so a synthetic source can drive it.
+ */
+template <typename T>
+class FrameRing {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        T value;
+        FrameInfo info;           // Sequence counts the frames recorded by this ring
+        const char* tag{nullptr}; // Tag set when the frame was recorded, e.g. the recipe phase
+    };
+
+    explicit FrameRing(size_t capacity = 0) {
+        Resize(capacity);
+    }
+
+    /**
+     * Discards the frames held and allocates room for capacity frames.
+     */
+    void Resize(size_t capacity) {
+        std::vector<Entry> slots(capacity);
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.swap(slots);
+        next_ = 0;
+        enabled_.store(capacity > 0, std::memory_order_relaxed);
+    }
+
+    size_t Capacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return slots_.size();
+    }
+
+    /**
+     * Tags the frames recorded from now on.
+     * \param tag String with static storage duration
+     */
+    void SetTag(const char* tag) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tag_ = tag;
+    }
+
+    /**
+     * Keeps a frame, replacing the oldest one once the ring is full. Safe to call from several producers.
+     */
+    void Record(const T& value, Clock::time_point timestamp) {
+        if (!enabled_.load(std::memory_order_relaxed))
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slots_.empty())
+            return;
+        auto& slot = slots_[next_ % slots_.size()];
+        slot.value = value;
+        slot.info.sequence = ++recorded_;
+        slot.info.timestamp = timestamp;
+        slot.tag = tag_;
+        ++next_;
+    }
+
+    /**
+     * Copies of the frames held, oldest first.
+     */
+    std::vector<Entry> Snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t held = (std::min)(next_, slots_.size());
+        std::vector<Entry> frames;
+        frames.reserve(held);
+        for (size_t i = next_ - held; i < next_; ++i) {
+            frames.push_back(slots_[i % slots_.size()]);
+        }
+        return frames;
+    }
+
+    /**
+     * Frames recorded since the ring was created.
+     */
+    uint64_t Recorded() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return recorded_;
+    }
+
+private:
+    std::atomic<bool> enabled_{false}; // Lets a ring of size zero skip the lock
+    mutable std::mutex mutex_;
+    std::vector<Entry> slots_;
+    size_t next_{0};          // Slot written next, counting laps
+    uint64_t recorded_{0};
+    const char* tag_{nullptr};
+};
+
+/**
+ * Writes snapshots of a FrameRing to disk on a thread of its own, so a dump never delays the cycle or the
+ * recipe. Each dump goes to a new directory holding index.csv, one line per frame, and whatever the writer
+ * adds per frame, e.g. an image file.
+ */
+template <typename T>
+class FrameDumper {
+public:
+    using Entry = typename FrameRing<T>::Entry;
+
+    /**
+     * Writes one frame. Appends the frame's own columns to its index line, each preceded by a comma, and
+     * may write files to the dump directory, named after the frame's sequence number.
+     */
+    using Writer = std::function<void(const Entry& frame, const std::filesystem::path& directory, std::ostream& index)>;
+
+    /**
+     * \param columns Header of the columns the writer appends, starting with a comma
+     */
+    FrameDumper(Writer writer, std::string columns)
+        : writer_(std::move(writer)), columns_(std::move(columns)), thread_([this]() { Run(); }) {}
+
+    /**
+     * Writes the dumps still queued, then stops.
+     */
+    ~FrameDumper() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    FrameDumper(const FrameDumper&) = delete;
+    FrameDumper& operator=(const FrameDumper&) = delete;
+
+    /**
+     * Queues frames to be written below root, in a directory named after the time and the reason.
+     * \return The directory the frames will be written to, empty if there were no frames
+     */
+    std::filesystem::path Dump(std::vector<Entry> frames, const std::filesystem::path& root, const std::string& reason) {
+        if (frames.empty())
+            return {};
+
+        std::time_t now = std::time(nullptr);
+        std::tm local{};
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        std::filesystem::path directory;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::ostringstream name;
+            name << std::put_time(&local, "%Y%m%d-%H%M%S") << "-" << ++dumps_ << "-" << reason;
+            directory = root / name.str();
+            queue_.push_back({directory, std::move(frames)});
+        }
+        wake_.notify_all();
+        return directory;
+    }
+
+    /**
+     * Blocks until every queued dump has been written.
+     */
+    void Flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]() { return queue_.empty() && !writing_; });
+    }
+
+    /**
+     * Dumps written and dumps that failed with an error.
+     */
+    std::pair<uint64_t, uint64_t> Written() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return {written_, failed_};
+    }
+
+private:
+    struct Job {
+        std::filesystem::path directory;
+        std::vector<Entry> frames;
+    };
+
+    Writer writer_;
+    std::string columns_;
+
+    mutable std::mutex mutex_;
+    uint64_t dumps_{0}; // Numbers the directories, so two dumps in one second do not collide
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<Job> queue_;
+    bool writing_{false};
+    bool stopping_{false};
+    uint64_t written_{0};
+    uint64_t failed_{0};
+    std::thread thread_; // Last, so it starts after the members it uses
+
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+
+            Job job = std::move(queue_.front());
+            queue_.pop_front();
+            writing_ = true;
+            lock.unlock();
+
+            bool ok = Write(job);
+
+            lock.lock();
+            writing_ = false;
+            ++(ok ? written_ : failed_);
+            idle_.notify_all();
+        }
+    }
+
+    bool Write(const Job& job) {
+        try {
+            std::filesystem::create_directories(job.directory);
+            std::ofstream index(job.directory / "index.csv");
+            if (!index)
+                throw std::runtime_error("could not create index.csv");
+
+            // Ages are relative to the newest frame, the one closest to the failure
+            auto newest = job.frames.back().info.timestamp;
+            index << "sequence,age_ms,tag" << columns_ << "\n";
+            for (auto& frame : job.frames) {
+                index << frame.info.sequence << "," << std::fixed << std::setprecision(1)
+                      << std::chrono::duration<double, std::milli>(newest - frame.info.timestamp).count() << ","
+                      << (frame.tag ? frame.tag : "");
+                writer_(frame, job.directory, index);
+                index << "\n";
+            }
+            Logger::info("FrameDumper: Wrote " + std::to_string(job.frames.size()) + " frames to " + job.directory.string());
+            return true;
+        }
+        catch (const std::exception& e) {
+            Logger::error("FrameDumper: Could not write frames to " + job.directory.string() + ": " + e.what());
+            return false;
+        }
+    }
+};
+
+#endif // FRAME_RING_H
@@ -3,138 +3,338 @@
 
 #include <vector>
 #include <string>
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <optional>
+#include <thread>
+#include "../include/async.h"
+#include "../include/clock.h"
 #include "../include/logging.h"
 #include "../include/simple_serial.h"
+#include "../include/crc16.h"
 
+/**
+ * Modbus-RTU driver for the gripper.
+ * Register writes are echoed back by the gripper. The echo is verified on a background task so the caller
+ * can continue immediately; the next transaction on the link waits for the outstanding echo first.
+ */
 namespace Gripper_Interface
 {
-    bool CheckResponse(unsigned char* expected_response) {
-        std::vector<unsigned char> response;
-        response = Gripper->readBytes(sizeof(expected_response));
-        Logger::verbose("Reading " + std::to_string(sizeof(expected_response)) + " bytes from the gripper. "
-            "This may block forever if the expected response is not received."
-        );
-
-        if ( sizeof(expected_response) != response.size() ) {
-            Logger::error("Gripper response length does not match expected length."); // TODO: print the response
-            return false;
+    enum Register : uint16_t {
+        INITIALIZE = 0x0100,
+        FORCE = 0x0101,
+        POSITION = 0x0103,
+        SPEED = 0x0104,
+        INIT_STATE = 0x0200,
+        GRIP_STATE = 0x0201,
+        CURRENT_POSITION = 0x0202,
+    };
+
+    enum FunctionCode : uint8_t {
+        READ_REGISTER = 0x03,
+        WRITE_REGISTER = 0x06,
+    };
+
+    enum GripState {
+        MOVING = 0,
+        REACHED = 1,  // Reached the commanded position without contact
+        CAUGHT = 2,   // Stopped on an object
+        DROPPED = 3,  // Object was caught and then lost
+        UNKNOWN = -1, // No valid reply from the gripper
+    };
+
+    constexpr uint8_t device_id = 0x01;
+    static const std::chrono::milliseconds reply_timeout(50);
+    static const uint16_t position_tolerance = 5; // permille
+    static const std::chrono::milliseconds frame_gap(5); // Silence that ends a Modbus-RTU frame, with margin
+    static const int read_attempts = 2;
+    static const std::chrono::milliseconds settle_poll_period(5); // Between grip state reads while the jaws move
+
+    using Frame = std::array<unsigned char, 8>;
+
+    /**
+     * Builds a Modbus-RTU frame addressing a single register, CRC included.
+     * \param function WRITE_REGISTER to set the register to value, READ_REGISTER to read value registers
+     */
+    constexpr Frame BuildFrame(FunctionCode function, uint16_t reg, uint16_t value) {
+        Frame frame {
+            device_id,
+            function,
+            static_cast<unsigned char>(reg >> 8), static_cast<unsigned char>(reg & 0xFF),
+            static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value & 0xFF),
+            0, 0
+        };
+        uint16_t crc = Crc16::Compute(frame.data(), 6);
+        frame[6] = static_cast<unsigned char>(crc & 0xFF); // Modbus sends the low byte first
+        frame[7] = static_cast<unsigned char>(crc >> 8);
+        return frame;
+    }
+
+    constexpr bool FrameEquals(const Frame& a, const Frame& b) {
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i] != b[i])
+                return false;
         }
+        return true;
+    }
+
+    // Fixed command frames, computed at compile time.
+    constexpr Frame initialize_frame = BuildFrame(FunctionCode::WRITE_REGISTER, Register::INITIALIZE, 1);
+    constexpr Frame open_frame = BuildFrame(FunctionCode::WRITE_REGISTER, Register::POSITION, 1000);
+    constexpr Frame close_frame = BuildFrame(FunctionCode::WRITE_REGISTER, Register::POSITION, 0);
+    constexpr Frame move_45_frame = BuildFrame(FunctionCode::WRITE_REGISTER, Register::POSITION, 450);
+    constexpr Frame move_50_frame = BuildFrame(FunctionCode::WRITE_REGISTER, Register::POSITION, 500);
+    constexpr Frame move_60_frame = BuildFrame(FunctionCode::WRITE_REGISTER, Register::POSITION, 600);
+    constexpr Frame grip_state_frame = BuildFrame(FunctionCode::READ_REGISTER, Register::GRIP_STATE, 1);
+
+    // Frames captured from the gripper vendor software
+    static_assert(FrameEquals(initialize_frame, {0x01, 0x06, 0x01, 0x00, 0x00, 0x01, 0x49, 0xF6}), "Initialize frame mismatch");
+    static_assert(FrameEquals(open_frame, {0x01, 0x06, 0x01, 0x03, 0x03, 0xE8, 0x78, 0x88}), "Open frame mismatch");
+    static_assert(FrameEquals(close_frame, {0x01, 0x06, 0x01, 0x03, 0x00, 0x00, 0x78, 0x36}), "Close frame mismatch");
+    static_assert(FrameEquals(move_45_frame, {0x01, 0x06, 0x01, 0x03, 0x01, 0xC2, 0xF8, 0x37}), "MoveTo45 frame mismatch");
+    static_assert(FrameEquals(move_50_frame, {0x01, 0x06, 0x01, 0x03, 0x01, 0xF4, 0x78, 0x21}), "MoveTo50 frame mismatch");
+    static_assert(FrameEquals(move_60_frame, {0x01, 0x06, 0x01, 0x03, 0x02, 0x58, 0x78, 0xAC}), "MoveTo60 frame mismatch");
+
+    /**
+     * Driver for a single gripper on its own serial link.
+     */
+    class Driver {
+    public:
+        explicit Driver(SimpleSerial& port) : port_(port) {}
+
+        Driver(const Driver&) = delete;
+        Driver& operator=(const Driver&) = delete;
+
+        /**
+         * Reads and verifies the echo of a register write. Runs on the echo task of WriteFrame, reading the
+         * link and counting its faults, so other code only touches either after FinishPending.
+         */
+        bool CheckResponse(const Frame& expected_response) {
+            auto response = port_.readBytes(expected_response.size(), reply_timeout);
+
+            if ( expected_response.size() != response.size() ) {
+                Logger::error("Gripper response length does not match expected length. Received: " + SimpleSerial::toHex(response));
+                ++port_.faults().timeouts;
+                Resync();
+                return false;
+            }
 
-        for (size_t i=0; i < response.size(); ++i) {
-            if(expected_response[i] != response[i]) {
-                Logger::error("Gripper returned an unexpected response."); // TODO: print the response
+            if (!std::equal(response.begin(), response.end(), expected_response.begin())) {
+                Logger::error("Gripper returned an unexpected response. Expected " +
+                              SimpleSerial::toHex(std::vector<unsigned char>(expected_response.begin(), expected_response.end())) +
+                              "received " + SimpleSerial::toHex(response));
+                ++port_.faults().malformed;
+                Resync();
                 return false;
             }
+
+            return true;
         }
 
-        return true;
-    }
+        /**
+         * Waits for the echo of the previous register write, if there is one. Call before reading the faults of
+         * the link from outside the driver.
+         * \return false if the previous write was not acknowledged correctly
+         */
+        bool FinishPending() {
+            if (!pending_echo_.valid())
+                return true;
+            return pending_echo_.get();
+        }
 
-    bool CheckResponseVector(std::vector<unsigned char> expected_response) {
-        std::vector<unsigned char> response;
+        /**
+         * Sends a register write frame. Returns once the frame is sent; the echo is verified in the background.
+         * \return false if the previous write was not acknowledged correctly
+         */
+        bool WriteFrame(const Frame& frame) {
+            bool previous_ok = FinishPending();
+            port_.writeBytes(frame.data(), frame.size());
+            pending_echo_ = std::async(std::launch::async, [this, frame]() { return CheckResponse(frame); });
+            return previous_ok;
+        }
 
-        Logger::verbose("Reading " + std::to_string(expected_response.size()) + " bytes from the gripper. "
-            "This may block forever if the expected response is not received."
-        );
+        bool WriteRegister(uint16_t reg, uint16_t value) {
+            return WriteFrame(BuildFrame(FunctionCode::WRITE_REGISTER, reg, value));
+        }
 
-        response = Gripper->readBytes(expected_response.size());
+        /**
+         * Reads a single register. Blocks until the reply is received or times out. A missing or corrupt reply
+         * is discarded up to the end of its frame and the read is sent again, since reads have no side effects.
+         * \return The register value, or nothing if no attempt got a valid reply
+         */
+        std::optional<uint16_t> ReadRegister(uint16_t reg) {
+            FinishPending();
+            auto request = reg == Register::GRIP_STATE ? grip_state_frame : BuildFrame(FunctionCode::READ_REGISTER, reg, 1);
+            std::chrono::steady_clock::time_point first_fault;
 
-        if ( expected_response.size() != response.size() ) {
-            Logger::error("Gripper response length does not match expected length."); // TODO: print the response
-            return false;
+            for (int attempt = 1; attempt <= read_attempts; ++attempt) {
+                if (attempt > 1)
+                    ++port_.faults().retries;
+                port_.writeBytes(request.data(), request.size());
+
+                // Reply: id, function, byte count, value high, value low, crc low, crc high
+                auto reply = port_.readBytes(7, reply_timeout);
+                if (reply.size() != 7 || reply[0] != device_id || reply[1] != FunctionCode::READ_REGISTER || reply[2] != 2) {
+                    Logger::warn("Gripper_Interface::Driver::ReadRegister: Invalid reply " + SimpleSerial::toHex(reply));
+                    ++(reply.size() != 7 ? port_.faults().timeouts : port_.faults().malformed);
+                    if (attempt == 1)
+                        first_fault = std::chrono::steady_clock::now();
+                    Resync();
+                    continue;
+                }
+
+                uint16_t crc = Crc16::Compute(reply.data(), 5);
+                if ((crc & 0xFF) != reply[5] || (crc >> 8) != reply[6]) {
+                    Logger::warn("Gripper_Interface::Driver::ReadRegister: CRC mismatch in reply " + SimpleSerial::toHex(reply));
+                    ++port_.faults().malformed;
+                    if (attempt == 1)
+                        first_fault = std::chrono::steady_clock::now();
+                    Resync();
+                    continue;
+                }
+
+                if (attempt > 1)
+                    port_.faults().Recovered(std::chrono::steady_clock::now() - first_fault);
+                return static_cast<uint16_t>(reply[3] << 8 | reply[4]);
+            }
+
+            ++port_.faults().unrecovered;
+            return std::nullopt;
         }
 
-        for (size_t i=0; i < response.size(); ++i) {
-            if(expected_response[i] != response[i]) {
-                Logger::error("Gripper returned an unexpected response."); // TODO: print the response
-                return false;
+        GripState ReadGripState() {
+            auto state = ReadRegister(Register::GRIP_STATE);
+            if (!state || *state > GripState::DROPPED)
+                return GripState::UNKNOWN;
+            return static_cast<GripState>(*state);
+        }
+
+        /**
+         * Initializes the gripper.
+         */
+        bool Initialize() {
+            return WriteFrame(initialize_frame);
+        }
+
+        /**
+         * Polls the gripper until initialization finishes.
+         * \return false if the gripper did not report initialized before the timeout
+         */
+        bool WaitForInitialized(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+            auto deadline = Time::Clock::now() + timeout;
+            while (Time::Clock::now() < deadline) {
+                auto state = ReadRegister(Register::INIT_STATE);
+                if (state && *state == 1)
+                    return true;
             }
+            Logger::error("Gripper_Interface::Driver::WaitForInitialized: Gripper did not finish initializing");
+            return false;
         }
-        return true;
-    }
 
-    /**
-     * Initializes the gripper.
-     * TODO: Check response and return failure if unexpected response
-     */
-    bool Initialize() {
-        std::vector<unsigned char> init {0x01, 0x06, 0x01, 0x00, 0x00, 0x01, 0x49, 0xF6}; // TODO: Can we use std::vector instead?
-        Gripper->writeVector(init);
-        // bool success = CheckResponse(init); TODO: CheckResponse uses ReadBytes which doesn't work
-        return true;
-    }
+        /**
+         * Sets the gripping force.
+         * \param percent 20-100 % of the maximum force
+         */
+        bool SetForce(uint16_t percent) {
+            return WriteRegister(Register::FORCE, (std::min)((std::max)(percent, uint16_t(20)), uint16_t(100)));
+        }
 
-    bool Open() {
-        std::vector<unsigned char> open {0x01, 0x06, 0x01, 0x03, 0x03, 0xE8, 0x78, 0x88};
-        Gripper->writeVector(open);
-        // bool success = CheckResponse(open);
-        return true;
-    }
+        /**
+         * Sets the jaw speed.
+         * \param percent 1-100 % of the maximum speed
+         */
+        bool SetSpeed(uint16_t percent) {
+            return WriteRegister(Register::SPEED, (std::min)((std::max)(percent, uint16_t(1)), uint16_t(100)));
+        }
 
-    bool Close() {
-        std::vector<unsigned char> close {0x01, 0x06, 0x01, 0x03, 0x00, 0x00, 0x78, 0x36};
-        Gripper->writeVector(close);
-        // bool success = CheckResponse(close);
-        return true;
-    }
+        /**
+         * Moves gripper jaws to a position.
+         * \param permille Opening in thousandths of the full stroke. 0 is closed, 1000 fully open.
+         */
+        bool MoveTo(uint16_t permille) {
+            commanded_position_ = (std::min)(permille, uint16_t(1000));
+            return WriteRegister(Register::POSITION, commanded_position_);
+        }
 
-    bool MoveTo45(/*int percent*/) {
-        // Multiply percent by 10
-        // Split high and low bytes
-        // Add to move command
-        // Calculate CRC
-        std::vector<unsigned char> move {0x01, 0x06, 0x01, 0x03, 0x01, 0xC2, 0xF8, 0x37};
-        Gripper->writeVector(move);
-        // bool success = CheckResponse(close);
-        return true;
-    }
-    
-    /**
-     * Moves gripper jaws to a certain percentage of open.
-     * TODO: Currently hard-coded to 50%
-    */
-    bool MoveTo50(/*int percent*/) {
-        // Multiply percent by 10
-        // Split high and low bytes
-        // Add to move command
-        // Calculate CRC
-        std::vector<unsigned char> move {0x01, 0x06, 0x01, 0x03, 0x01, 0xF4, 0x78, 0x21};
-        Gripper->writeVector(move);
-        // bool success = CheckResponse(close);
-        return true;
-    }
+        bool Open() {
+            commanded_position_ = 1000;
+            return WriteFrame(open_frame);
+        }
 
-    bool MoveTo60(/*int percent*/) {
-        // Multiply percent by 10
-        // Split high and low bytes
-        // Add to move command
-        // Calculate CRC
-        std::vector<unsigned char> move {0x01, 0x06, 0x01, 0x03, 0x02, 0x58, 0x78, 0xAC};
-        Gripper->writeVector(move);
-        // bool success = CheckResponse(close);
-        return true;
-    }
+        bool Close() {
+            commanded_position_ = 0;
+            return WriteFrame(close_frame);
+        }
+
+        bool MoveTo45() {
+            commanded_position_ = 450;
+            return WriteFrame(move_45_frame);
+        }
+
+        bool MoveTo50() {
+            commanded_position_ = 500;
+            return WriteFrame(move_50_frame);
+        }
+
+        bool MoveTo60() {
+            commanded_position_ = 600;
+            return WriteFrame(move_60_frame);
+        }
+
+        /**
+         * Coroutine that polls the gripper until the jaws settle after the last MoveTo, sleeping on the event
+         * loop between polls. Each poll is a short blocking exchange.
+         * The grip state still reads as settled for a moment after a new command is sent, so CAUGHT and DROPPED
+         * only count once the jaws were seen moving, and REACHED only counts at the commanded position.
+         * \return The final grip state, or UNKNOWN on timeout
+         */
+        Async::Task<GripState> Settle(std::chrono::milliseconds timeout = std::chrono::milliseconds(2000)) {
+            auto deadline = Time::Clock::now() + timeout;
+            bool seen_moving = false;
+
+            for (bool first = true; Time::Clock::now() < deadline; first = false) {
+                if (!first)
+                    co_await Async::Sleep(settle_poll_period);
+                auto state = ReadGripState();
 
-    // TODO: Untested
-    std::vector<unsigned char> CaclulateCRC(const unsigned char* cmd, int len) {
-        uint16_t crc = 0xFFFF;
-        for (int pos = 0; pos < len; pos++) {
-            crc ^= static_cast<uint16_t>(cmd[pos]); // XOR byte into least sig. byte of crc
+                if (state == GripState::MOVING) {
+                    seen_moving = true;
+                    continue;
+                }
 
-            for (int i = 8; i != 0; i--) {    // Loop over each bit
-                if ((crc & 0x0001) != 0) {        // If the LSB is set
-                    crc >>= 1;                    // Shift right and XOR 0xA001
-                    crc ^= 0xA001;
+                if (state == GripState::REACHED) {
+                    auto position = ReadRegister(Register::CURRENT_POSITION);
+                    if (position && std::abs(int(*position) - int(commanded_position_)) <= position_tolerance)
+                        co_return state;
+                    continue;
                 }
-                else                              // Else LSB is not set
-                    crc >>= 1;                    // Just shift right
+
+                if ((state == GripState::CAUGHT || state == GripState::DROPPED) && seen_moving)
+                    co_return state;
             }
+
+            Logger::error("Gripper_Interface::Driver::Settle: Gripper did not settle within " + std::to_string(timeout.count()) + " ms");
+            co_return GripState::UNKNOWN;
         }
-        // Note, this crc has low and high bytes swapped, so use it accordingly (or swap bytes)
-        unsigned char LSB = crc >> 8 & 0xFF;
-        unsigned char MSB = crc & 0xFF;
-        std::vector<unsigned char> crc_bytes {LSB, MSB};
-        return crc_bytes;
-    }
+
+        // Blocking version of Settle, for callers that are not coroutines
+        GripState WaitForSettle(std::chrono::milliseconds timeout = std::chrono::milliseconds(2000)) {
+            return Async::Run(Settle(timeout));
+        }
+
+    private:
+        SimpleSerial& port_;
+
+        // Modbus-RTU frames end with a silence, so a broken frame ends once the link has been quiet
+        void Resync() {
+            port_.discardInput(frame_gap);
+            ++port_.faults().resyncs;
+        }
+
+        std::future<bool> pending_echo_; // Verification of the last register write, if any
+        uint16_t commanded_position_{1000};
+    };
 }
-#endif // GRIPPER_INTERFACE_H
\ No newline at end of file
+#endif // GRIPPER_INTERFACE_H
@@ -0,0 +1,295 @@
+#ifndef HALT_WATCHDOG_H
+#define HALT_WATCHDOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <semaphore.h>
+#endif
+
+#include "logging.h"
+#include "notifier.h"
+#include "sel_interface.h"
+#include "simple_serial.h"
+
+/**
+ * Counting semaphore whose Post may be called from a signal handler: sem_post is async-signal-safe, and on
+ * Windows console control handlers run on a thread of their own.
+ */
+class WakeSemaphore {
+public:
+#if defined(_WIN32)
+    WakeSemaphore() : handle_(CreateSemaphoreW(nullptr, 0, LONG_MAX, nullptr)) {}
+
+    ~WakeSemaphore() {
+        CloseHandle(handle_);
+    }
+
+    void Post() {
+        ReleaseSemaphore(handle_, 1, nullptr);
+    }
+
+    void Wait() {
+        WaitForSingleObject(handle_, INFINITE);
+    }
+#else
+    WakeSemaphore() {
+        sem_init(&semaphore_, 0, 0);
+    }
+
+    ~WakeSemaphore() {
+        sem_destroy(&semaphore_);
+    }
+
+    void Post() {
+        sem_post(&semaphore_);
+    }
+
+    void Wait() {
+        while (sem_wait(&semaphore_) != 0 && errno == EINTR) {
+        }
+    }
+#endif
+
+    WakeSemaphore(const WakeSemaphore&) = delete;
+    WakeSemaphore& operator=(const WakeSemaphore&) = delete;
+
+private:
+#if defined(_WIN32)
+    HANDLE handle_;
+#else
+    sem_t semaphore_;
+#endif
+};
+
+/**
+ * Dedicated thread that halts SEL controllers on request, independently of the thread driving each link.
+ *
+ * A halt is written as soon as any write in progress on the link completes. While the driving thread waits
+ * for a reply, the halt is handed to the event loop of that wait and written from it, so the port is never
+ * used from two threads at once (see SimpleSerial::writeFromOtherThread). The halt reply is skipped by that thread's next readLine, so the link stays in
+ * step. A halted link is latched: Commander refuses new moves on it until Release, e.g. when the cell is
+ * re-initialized.
+ *
+ * Signal handlers only store the signal in an atomic and post the watchdog's semaphore. The watchdog, asleep
+ * until a request or a signal arrives, halts every registered link and exits the process, so no I/O, logging
+ * or locking happens in the handler itself.
+ *
+ * The time from each request until the halt command was handed to the serial port is recorded. Add the
+ * transmit time of the command at the link's baud rate for the time until the controller has received it.
+ */
+class HaltWatchdog {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static HaltWatchdog& Instance() {
+        static HaltWatchdog watchdog;
+        return watchdog;
+    }
+
+    HaltWatchdog(const HaltWatchdog&) = delete;
+    HaltWatchdog& operator=(const HaltWatchdog&) = delete;
+
+    ~HaltWatchdog() {
+        Stop();
+    }
+
+    void Start() {
+        if (running_.exchange(true))
+            return;
+        thread_ = std::thread([this]() { Run(); });
+    }
+
+    void Stop() {
+        if (!running_.exchange(false))
+            return;
+        wake_.Post();
+        thread_.join();
+    }
+
+    void Register(SimpleSerial& sel) {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        auto link = std::make_unique<Link>();
+        link->sel = &sel;
+        links_.push_back(std::move(link));
+    }
+
+    void Unregister(SimpleSerial& sel) {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        links_.erase(std::remove_if(links_.begin(), links_.end(), [&](const std::unique_ptr<Link>& link) { return link->sel == &sel; }),
+                     links_.end());
+    }
+
+    /**
+     * Halts the XY axes of a registered link and latches it. Safe to call while another thread is in the
+     * middle of a command on the link. Without a running watchdog the halt is written from the calling thread.
+     * \return true once the halt has been written, false if the link is not registered or the timeout expired
+     */
+    bool Halt(SimpleSerial& sel, std::chrono::milliseconds timeout = std::chrono::milliseconds(500)) {
+        auto request_time = Clock::now();
+        uint64_t sent;
+        {
+            std::lock_guard<std::mutex> lock(links_mutex_);
+            Link* link = Find(sel);
+            if (!link)
+                return false;
+
+            link->latched = true;
+            sent = link->halts_sent.load();
+            if (!running_) {
+                Send(*link, request_time);
+                return true;
+            }
+            link->request_time.store(request_time.time_since_epoch().count());
+            link->requested = true;
+        }
+        wake_.Post();
+
+        auto deadline = request_time + timeout;
+        while (true) {
+            uint32_t seen = done_.Epoch();
+            {
+                std::lock_guard<std::mutex> lock(links_mutex_);
+                Link* link = Find(sel);
+                if (!link)
+                    return false;
+                if (link->halts_sent.load() != sent)
+                    return true;
+            }
+            auto now = Clock::now();
+            if (now >= deadline || !done_.WaitFor(seen, deadline - now)) {
+                Logger::error("HaltWatchdog::Halt: No halt written to " + sel.portName() + " within " +
+                              std::to_string(timeout.count()) + " ms");
+                return false;
+            }
+        }
+    }
+
+    /**
+     * \return true if the link was halted and not released since
+     */
+    bool Latched(SimpleSerial& sel) {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        Link* link = Find(sel);
+        return link && link->latched;
+    }
+
+    void Release(SimpleSerial& sel) {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        if (Link* link = Find(sel))
+            link->latched = false;
+    }
+
+    /**
+     * Requests a halt of every link followed by exiting with the signal number. Async-signal-safe.
+     */
+    static void RequestFromSignal(int signum) {
+        signal_time_.store(Clock::now().time_since_epoch().count());
+        signal_.store(signum);
+        wake_.Post();
+    }
+
+    /**
+     * Time from a halt request until the halt command was written to the serial port.
+     */
+    const LatencyHistogram& RequestToWrite() const {
+        return latency_;
+    }
+
+private:
+    struct Link {
+        SimpleSerial* sel{nullptr};
+        std::atomic<bool> requested{false};
+        std::atomic<bool> latched{false};
+        std::atomic<Clock::rep> request_time{0};
+        std::atomic<uint64_t> halts_sent{0};
+    };
+
+    std::mutex links_mutex_;
+    std::vector<std::unique_ptr<Link>> links_;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    Notifier done_; // Halt written
+    LatencyHistogram latency_;
+
+    static_assert(std::atomic<int>::is_always_lock_free && std::atomic<Clock::rep>::is_always_lock_free,
+                  "Signal handlers may only touch lock-free atomics");
+    static inline std::atomic<int> signal_{0};
+    static inline std::atomic<Clock::rep> signal_time_{0};
+    static inline WakeSemaphore wake_; // Halt requested, signal received or stopping
+
+    HaltWatchdog() = default;
+
+    Link* Find(SimpleSerial& sel) {
+        for (auto& link : links_) {
+            if (link->sel == &sel)
+                return link.get();
+        }
+        return nullptr;
+    }
+
+    // Called with links_mutex_ held
+    void Send(Link& link, Clock::time_point request_time) {
+        try {
+            SEL_Interface::SendHalt(*link.sel);
+            auto latency = Clock::now() - request_time;
+            latency_.Record(latency);
+            Logger::warn("HaltWatchdog: Halted " + link.sel->portName() + " " +
+                         std::to_string(std::chrono::duration<double, std::micro>(latency).count()) + " us after the request. " +
+                         "Request to write: " + latency_.Summary());
+        }
+        catch (const std::exception& e) {
+            Logger::error("HaltWatchdog: Failed to halt " + link.sel->portName() + ": " + e.what());
+        }
+        ++link.halts_sent;
+        done_.Notify();
+    }
+
+    void Run() {
+        while (running_) {
+            int signum = signal_.load();
+            size_t halted = 0;
+            {
+                std::lock_guard<std::mutex> lock(links_mutex_);
+                halted = links_.size();
+                for (auto& link : links_) {
+                    if (signum) {
+                        link->latched = true;
+                        Send(*link, Clock::time_point(Clock::duration(signal_time_.load())));
+                    }
+                    else if (link->requested.exchange(false)) {
+                        Send(*link, Clock::time_point(Clock::duration(link->request_time.load())));
+                    }
+                }
+            }
+
+            if (signum) {
+                Logger::warn("Interrupt signal '" + std::to_string(signum) + "' received. Exiting after halting " +
+                             std::to_string(halted) + " SEL links.");
+                std::cout << std::flush;
+                std::_Exit(signum); // Other threads may still be inside a command, so skip static destructors
+            }
+
+            wake_.Wait();
+        }
+    }
+};
+
+#endif // HALT_WATCHDOG_H
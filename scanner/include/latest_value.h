@@ -0,0 +1,115 @@
+#ifndef LATEST_VALUE_H
+#define LATEST_VALUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+/**
+ * Lock-free mailbox holding only the newest value, built on a triple buffer.
+ *
+ * The producer fills its back slot and swaps it with the middle slot; the consumer swaps its front slot with
+ * the middle slot when that holds a value it has not seen. Neither side waits for the other and neither
+ * copies a value under a lock. Every value gets a sequence number one higher than the previous one, so the
+ * consumer can tell a fresh value from one it already read, and values replaced before they were read are
+ * counted as overwritten.
+ *
+ * Supports one consumer thread. Producers may run on several threads (e.g. a recipe's thread pool); they
+ * are serialized with a spin flag that is only ever contended by another producer.
+ */
+template <typename T>
+class LatestValue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot {
+        uint64_t sequence{0};       // 0 until the first value is published
+        Clock::time_point timestamp;
+        T value{};
+    };
+
+    /**
+     * Publishes a value, replacing the one waiting to be read.
+     * \param timestamp Time the value was captured
+     * \return false if an unread value was overwritten
+     */
+    bool Publish(T value, Clock::time_point timestamp = Clock::now()) {
+        return PublishSwap(value, timestamp);
+    }
+
+    /**
+     * Publishes a value by swapping it into the back slot, so no storage changes hands. The producer gets
+     * back the value the slot held, whose storage it can fill with the next value instead of allocating.
+     * \param timestamp Time the value was captured
+     * \return false if an unread value was overwritten
+     */
+    bool PublishSwap(T& value, Clock::time_point timestamp = Clock::now()) {
+        while (producer_busy_.test_and_set(std::memory_order_acquire)) {
+        }
+
+        Slot& slot = slots_[back_];
+        slot.sequence = ++published_;
+        slot.timestamp = timestamp;
+        using std::swap;
+        swap(slot.value, value);
+
+        unsigned previous = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel);
+        back_ = previous & INDEX;
+        latest_sequence_.store(slot.sequence, std::memory_order_release);
+
+        producer_busy_.clear(std::memory_order_release);
+
+        if (previous & FRESH) {
+            overwritten_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Takes the newest value if it has not been taken yet. Consumer only.
+     * \return The slot holding the value, valid until the next call to Take, or nullptr if there is nothing new
+     */
+    Slot* Take() {
+        if (!HasFresh())
+            return nullptr;
+        unsigned previous = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = previous & INDEX;
+        return &slots_[front_];
+    }
+
+    bool HasFresh() const {
+        return middle_.load(std::memory_order_acquire) & FRESH;
+    }
+
+    /**
+     * Sequence number of the newest published value, read or not.
+     */
+    uint64_t LatestSequence() const {
+        return latest_sequence_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Number of values replaced before the consumer read them.
+     */
+    uint64_t Overwritten() const {
+        return overwritten_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr unsigned INDEX = 0x3;
+    static constexpr unsigned FRESH = 0x4;
+
+    Slot slots_[3];
+    unsigned back_{0};                 // Producer's slot
+    std::atomic<unsigned> middle_{1};  // Slot in transit, with FRESH set if the consumer has not taken it yet
+    unsigned front_{2};                // Consumer's slot
+
+    std::atomic_flag producer_busy_ = ATOMIC_FLAG_INIT;
+    uint64_t published_{0};            // Guarded by producer_busy_
+    std::atomic<uint64_t> latest_sequence_{0};
+    std::atomic<uint64_t> overwritten_{0};
+};
+
+#endif // LATEST_VALUE_H
@@ -0,0 +1,189 @@
+#ifndef LINK_SCHEDULER_H
+#define LINK_SCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "async.h"
+#include "clock.h"
+
+enum class LinkPriority {
+    COMMAND, // Moves, halts and outputs. Never delayed.
+    STATUS,  // STA and INP inquiries. Sent when the budget allows.
+};
+
+/**
+ * Shares the bandwidth of a SEL link between commands and status inquiries.
+ *
+ * Each request and its reply occupy the half duplex link for their transmit time, so a status poll sent
+ * when a command is due delays the command by a whole exchange. The scheduler keeps the traffic under a
+ * budget, a fraction of the link capacity, with a token bucket. Commands always go out immediately and may
+ * overdraw the bucket. Status inquiries wait until the bucket covers an average status exchange, so after a
+ * burst of commands the status rate drops until the link has caught up. Polling loops additionally ask for
+ * status no more often than their phase needs.
+ *
+ * Used from the thread driving the link only.
+ */
+class LinkScheduler {
+public:
+    using Clock = Time::Clock;
+
+    static constexpr double BITS_PER_BYTE = 10.0; // One start and one stop bit
+    static constexpr double BURST = 0.1;          // s of budget the bucket holds, so idle time is not saved up
+
+    explicit LinkScheduler(uint32_t baud = 9600, double budget = 0.8) : baud_(baud) {
+        SetBudget(budget);
+        ResetStats();
+    }
+
+    /**
+     * Sets the baud rate of the link, e.g. after probing it.
+     */
+    void SetRate(uint32_t baud) {
+        baud_ = baud;
+    }
+
+    /**
+     * \param budget Fraction of the link capacity available to all traffic, in (0, 1]
+     */
+    void SetBudget(double budget) {
+        budget_ = (std::clamp)(budget, 0.01, 1.0);
+    }
+
+    /**
+     * Bytes per second the link carries at its baud rate.
+     */
+    double Capacity() const {
+        return baud_ / BITS_PER_BYTE;
+    }
+
+    double BytesPerSecond() const {
+        return budget_ * Capacity();
+    }
+
+    /**
+     * \return true if period has passed since the last status exchange and the budget covers another one.
+     * A poll that is due but over budget is counted as deferred.
+     */
+    bool StatusDue(Clock::duration period) {
+        auto now = Clock::now();
+        if (now - last_status_ < period)
+            return false;
+        if (StatusDelay(now) > Clock::duration::zero()) {
+            ++deferred_;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Time until the budget covers an average status exchange. Zero if it does now.
+     */
+    Clock::duration StatusDelay() {
+        return StatusDelay(Clock::now());
+    }
+
+    /**
+     * Blocks until the budget covers a status exchange, for loops that need every status reply.
+     */
+    void WaitForStatus() {
+        auto delay = StatusDelay(Clock::now());
+        if (delay > Clock::duration::zero()) {
+            waited_ += delay;
+            Time::SleepFor(delay);
+        }
+    }
+
+    /**
+     * Coroutine version of WaitForStatus. Suspends on the event loop instead of blocking the thread.
+     */
+    Async::Task<void> AwaitStatus() {
+        auto delay = StatusDelay(Clock::now());
+        if (delay > Clock::duration::zero()) {
+            waited_ += delay;
+            co_await Async::Sleep(delay);
+        }
+    }
+
+    /**
+     * Accounts for an exchange that has been sent and answered.
+     * \param bytes Bytes written and read by the exchange
+     */
+    void Record(LinkPriority priority, size_t bytes) {
+        auto now = Clock::now();
+        Refill(now);
+        tokens_ -= static_cast<double>(bytes);
+        if (priority == LinkPriority::COMMAND) {
+            command_bytes_ += bytes;
+            ++commands_;
+        }
+        else {
+            status_bytes_ += bytes;
+            ++polls_;
+            status_size_ += 0.2 * (bytes - status_size_);
+            last_status_ = now;
+        }
+    }
+
+    /**
+     * Link utilization and traffic since the last ResetStats.
+     */
+    std::string Summary() const {
+        double elapsed = std::chrono::duration<double>(Clock::now() - stats_start_).count();
+        double capacity = Capacity() * elapsed;
+        auto percent = [&](uint64_t bytes) { return capacity > 0.0 ? 100.0 * bytes / capacity : 0.0; };
+
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(1) << "Link at " << baud_ << " baud: " << percent(command_bytes_ + status_bytes_)
+               << "% utilized (budget " << budget_ * 100.0 << "%), commands " << percent(command_bytes_) << "% in "
+               << commands_ << ", status " << percent(status_bytes_) << "% in " << polls_ << " polls, " << deferred_
+               << " deferred, " << std::chrono::duration<double, std::milli>(waited_).count() << " ms waited";
+        return stream.str();
+    }
+
+    void ResetStats() {
+        stats_start_ = Clock::now();
+        command_bytes_ = status_bytes_ = 0;
+        commands_ = polls_ = deferred_ = 0;
+        waited_ = Clock::duration::zero();
+    }
+
+private:
+    uint32_t baud_;
+    double budget_{0.8};
+
+    double tokens_{0.0};        // Bytes the budget allows right now, negative after commands overdrew it
+    double status_size_{50.0};  // Average bytes of a status exchange, a STA exchange with two axes to start with
+    Clock::time_point refilled_{Clock::now()};
+    Clock::time_point last_status_{};
+
+    Clock::time_point stats_start_;
+    uint64_t command_bytes_{0};
+    uint64_t status_bytes_{0};
+    uint64_t commands_{0};
+    uint64_t polls_{0};
+    uint64_t deferred_{0};
+    Clock::duration waited_{};
+
+    void Refill(Clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - refilled_).count();
+        refilled_ = now;
+        double burst = (std::max)(BURST * BytesPerSecond(), status_size_);
+        tokens_ = (std::min)(tokens_ + elapsed * BytesPerSecond(), burst);
+    }
+
+    Clock::duration StatusDelay(Clock::time_point now) {
+        Refill(now);
+        double missing = status_size_ - tokens_;
+        if (missing <= 0.0)
+            return Clock::duration::zero();
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(missing / BytesPerSecond()));
+    }
+};
+
+#endif // LINK_SCHEDULER_H
@@ -2,6 +2,8 @@
 #define LOGGING_H
 
 #include <iostream>
+#include <mutex>
+#include <string>
 
 class Logger {
 public:
@@ -56,45 +58,61 @@ public:
             warn("Provided log level '" + level + "' is not recognized.");
     }
 
+    /**
+     * Tags every message logged from the calling thread, e.g. with the name of the cell it drives.
+     * The log level stays shared by all threads.
+     */
+    static void setContext(const std::string& context) {
+        context_ = context.empty() ? "" : "[" + context + "] ";
+    }
+
     static void error(const std::string& message) {
         if (log_level_ >= Level::ERR) {
-            std::cout << RED << "[ERROR] " << message << RESET << std::endl;
+            std::lock_guard<std::mutex> lock(output_mutex_);
+            std::cout << RED << "[ERROR] " << context_ << message << RESET << std::endl;
         }
     }
 
     static void warn(const std::string& message) {
         if (log_level_ >= Level::WARN) {
-            std::cout << ORANGE << "[WARN] " << message << RESET << std::endl;
+            std::lock_guard<std::mutex> lock(output_mutex_);
+            std::cout << ORANGE << "[WARN] " << context_ << message << RESET << std::endl;
         }
     }
 
     static void info(const std::string& message) {
         if (log_level_ >= Level::INFO) {
-            std::cout << "[INFO] " << message << std::endl;
+            std::lock_guard<std::mutex> lock(output_mutex_);
+            std::cout << "[INFO] " << context_ << message << std::endl;
         }
     }
 
     static void debug(const std::string& message) {
         if (log_level_ >= Level::DEBUG) {
-            std::cout << YELLOW << "[DEBUG] " << message << RESET << std::endl;
+            std::lock_guard<std::mutex> lock(output_mutex_);
+            std::cout << YELLOW << "[DEBUG] " << context_ << message << RESET << std::endl;
         }
     }
 
     static void verbose(const std::string& message) {
         if (log_level_ >= Level::VERBOSE) {
-            std::cout << BLUE << "[VERBOSE] " << message << RESET << std::endl;
+            std::lock_guard<std::mutex> lock(output_mutex_);
+            std::cout << BLUE << "[VERBOSE] " << context_ << message << RESET << std::endl;
         }
     }
         
 
     static void verbose_stream(char c){
         if (log_level_ >= Level::VERBOSE) {
+            std::lock_guard<std::mutex> lock(output_mutex_);
             std::cout << BLUE << c << RESET << std::flush;
         }
     }
 
 private:
     static int log_level_;
+    static inline thread_local std::string context_;
+    static inline std::mutex output_mutex_;
     static inline const std::string RED = "\033[31m";       // Red text
     static inline const std::string ORANGE = "\033[32m";   // Orange text 
     static inline const std::string YELLOW = "\033[33m";  // Yellow text
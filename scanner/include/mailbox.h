@@ -0,0 +1,148 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "clock.h"
+#include "latest_value.h"
+#include "notifier.h"
+
+/**
+ * Sequence number and time of a value taken from a Mailbox.
+ */
+struct FrameInfo {
+    uint64_t sequence{0};                            // Increases by one with every value published
+    std::chrono::steady_clock::time_point timestamp; // Time the value was captured
+};
+
+/**
+ * Told about every value published to a Mailbox, e.g. to wake an event loop instead of a blocked thread.
+ * Called on the producer thread, so it must be quick and must not block.
+ */
+class PublishListener {
+public:
+    virtual ~PublishListener() = default;
+    virtual void Published() = 0;
+};
+
+/**
+ * Hands the newest value from producers to one consumer that blocks until a new enough value arrives.
+ * Combines a LatestValue with a Notifier, so a hand-off takes no lock and only enters the kernel when the
+ * consumer is actually asleep. Has no pylon dependency, so a synthetic source can drive it in benchmarks.
+ */
+template <typename T>
+class Mailbox {
+public:
+    using Clock = Time::Clock;
+
+    /**
+     * Publishes a value and wakes the consumer.
+     * \return false if an unread value was overwritten
+     */
+    bool Publish(T value, Clock::time_point timestamp = Clock::now()) {
+        return PublishSwap(value, timestamp);
+    }
+
+    /**
+     * Publishes a value and wakes the consumer, handing back an older value to reuse the storage of.
+     * See LatestValue::PublishSwap.
+     * \return false if an unread value was overwritten
+     */
+    bool PublishSwap(T& value, Clock::time_point timestamp = Clock::now()) {
+        bool fresh = latest_.PublishSwap(value, timestamp);
+        notifier_.Notify();
+        if (auto* listener = listener_.load(std::memory_order_acquire))
+            listener->Published();
+        return fresh;
+    }
+
+    /**
+     * Waits for a value newer than after_sequence and captured no earlier than after_time.
+     * Older values taken while waiting are discarded and counted as stale. Consumer only.
+     * In virtual time the wait does not block: finding no value, it advances the clock to its deadline and
+     * times out.
+     * \return false on timeout
+     */
+    bool WaitFor(T& value, FrameInfo& info, uint64_t after_sequence, Clock::time_point after_time,
+                 std::chrono::nanoseconds timeout) {
+        auto deadline = Clock::now() + timeout;
+        while (true) {
+            uint32_t epoch = notifier_.Epoch();
+
+            if (auto* slot = latest_.Take()) {
+                if (slot->sequence > after_sequence && slot->timestamp >= after_time) {
+                    value = std::move(slot->value);
+                    info.sequence = slot->sequence;
+                    info.timestamp = slot->timestamp;
+                    return true;
+                }
+                ++stale_;
+                continue;
+            }
+
+            auto remaining = deadline - Clock::now();
+            if (Time::IsVirtual()) {
+                Time::AdvanceTo(deadline);
+                return false;
+            }
+            if (remaining <= Clock::duration::zero() ||
+                !notifier_.WaitFor(epoch, std::chrono::duration_cast<std::chrono::nanoseconds>(remaining)))
+                return false;
+        }
+    }
+
+    /**
+     * Takes the newest value without waiting. Consumer only.
+     * \return false if there is no value newer than the last one taken
+     */
+    bool TryTake(T& value, FrameInfo& info) {
+        return WaitFor(value, info, 0, Clock::time_point(), std::chrono::nanoseconds(0));
+    }
+
+    /**
+     * Discards the unread value, if any. Consumer only.
+     */
+    void Clear() {
+        latest_.Take();
+    }
+
+    uint64_t LatestSequence() const {
+        return latest_.LatestSequence();
+    }
+
+    /**
+     * Values replaced by a newer one before the consumer read them.
+     */
+    uint64_t Overwritten() const {
+        return latest_.Overwritten();
+    }
+
+    /**
+     * Values read but discarded for being older than the consumer asked for.
+     */
+    uint64_t Stale() const {
+        return stale_;
+    }
+
+    const LatencyHistogram& WakeLatency() const {
+        return notifier_.WakeLatency();
+    }
+
+    /**
+     * Sets the listener told about every publish, or nullptr for none. A listener removed while the
+     * producer runs may still be called once, so it has to stay alive until the producer has stopped.
+     */
+    void SetListener(PublishListener* listener) {
+        listener_.store(listener, std::memory_order_release);
+    }
+
+private:
+    LatestValue<T> latest_;
+    Notifier notifier_;
+    std::atomic<PublishListener*> listener_{nullptr};
+    uint64_t stale_{0}; // Only touched by the consumer
+};
+
+#endif // MAILBOX_H
@@ -0,0 +1,126 @@
+#ifndef MOTION_PLANNER_H
+#define MOTION_PLANNER_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include "logging.h"
+#include "xy.h"
+
+namespace Motion
+{
+    constexpr double MM_PER_G = 9806.65; // 1 G expressed in mm/s^2
+
+    /**
+     * Velocity and acceleration limits of a single SEL axis.
+     * Units match the MOV command: mm/s and G.
+     */
+    struct AxisLimits {
+        double max_velocity{400.0};
+        double max_acceleration{0.5};
+    };
+
+    /**
+     * Velocity and acceleration chosen for a single MOV command, along with the predicted duration.
+     */
+    struct MovePlan {
+        unsigned int velocity{1};   // mm/s
+        double acceleration{0.0};   // G
+        double distance{0.0};       // mm, along the axis that takes the longest
+        double duration{0.0};       // s, predicted time until both axes report motion complete
+    };
+
+    /**
+     * Time taken to traverse a distance with a symmetric trapezoidal velocity profile.
+     * If the distance is too short to reach the requested velocity the profile becomes triangular.
+     * \param distance Distance to travel in mm
+     * \param velocity Cruise velocity in mm/s
+     * \param acceleration Acceleration and deceleration in mm/s^2
+     * \return Time in seconds
+     */
+    double TrapezoidTime(double distance, double velocity, double acceleration) {
+        distance = std::abs(distance);
+        if (distance <= 0.0)
+            return 0.0;
+
+        if (velocity <= 0.0 || acceleration <= 0.0)
+            throw std::runtime_error("Motion::TrapezoidTime: velocity and acceleration must be positive");
+
+        double ramp_distance = velocity * velocity / acceleration; // Accelerating plus decelerating
+
+        if (distance < ramp_distance)
+            return 2.0 * std::sqrt(distance / acceleration);
+
+        return distance / velocity + velocity / acceleration;
+    }
+
+    /**
+     * Picks the velocity and acceleration for each XY move.
+     *
+     * Both axes receive the same velocity and acceleration in a MOV command and run independently,
+     * so the move finishes when the axis with the longest travel arrives. The planner always uses the
+     * highest acceleration both axes accept and picks the velocity the longer axis can actually reach:
+     * short refinement corrections get a low peak velocity with a hard ramp, long traverses cruise at
+     * the velocity limit.
+     */
+    class Planner {
+    public:
+        AxisLimits x_limits;
+        AxisLimits y_limits;
+        double min_velocity{1.0};   // mm/s, the controller rejects a velocity of zero
+        double settle_time{0.0};    // s, fixed overhead added to every move (command latency, settling)
+
+        /**
+         * Predicts the duration of a move between two points.
+         * \param velocity Commanded velocity in mm/s
+         * \param acceleration Commanded acceleration in G
+         */
+        double PredictDuration(XY from, XY to, double velocity, double acceleration) const {
+            XY delta = to - from;
+            double x_time = TrapezoidTime(delta.x, (std::min)(velocity, x_limits.max_velocity),
+                                          (std::min)(acceleration, x_limits.max_acceleration) * MM_PER_G);
+            double y_time = TrapezoidTime(delta.y, (std::min)(velocity, y_limits.max_velocity),
+                                          (std::min)(acceleration, y_limits.max_acceleration) * MM_PER_G);
+            return (std::max)(x_time, y_time) + settle_time;
+        }
+
+        /**
+         * Plans a move between two points.
+         * \param from Current stage position in mm
+         * \param to Target stage position in mm
+         * \param velocity_cap Upper bound on the velocity in mm/s, e.g. to limit motion blur while scanning.
+         *                     Zero uses the axis limits.
+         */
+        MovePlan Plan(XY from, XY to, double velocity_cap = 0.0) const {
+            MovePlan plan;
+            XY delta = to - from;
+            plan.distance = (std::max)(std::abs(delta.x), std::abs(delta.y));
+            plan.acceleration = Quantize((std::min)(x_limits.max_acceleration, y_limits.max_acceleration));
+
+            double max_velocity = (std::min)(x_limits.max_velocity, y_limits.max_velocity);
+            if (velocity_cap > 0.0)
+                max_velocity = (std::min)(max_velocity, velocity_cap);
+
+            // Peak velocity of a triangular profile over the longer axis. Anything faster is never reached.
+            double reachable_velocity = std::sqrt(plan.distance * plan.acceleration * MM_PER_G);
+            double velocity = (std::max)((std::min)(reachable_velocity, max_velocity), min_velocity);
+            plan.velocity = static_cast<unsigned int>(std::ceil(velocity));
+
+            plan.duration = PredictDuration(from, to, plan.velocity, plan.acceleration);
+
+            Logger::verbose("Motion::Planner::Plan: distance " + std::to_string(plan.distance) + " mm, velocity " +
+                            std::to_string(plan.velocity) + " mm/s, acceleration " + std::to_string(plan.acceleration) +
+                            " G, predicted " + std::to_string(plan.duration * 1000.0) + " ms");
+            return plan;
+        }
+
+    private:
+        // The MOV command carries acceleration with two decimals and rounds anything finer away.
+        static double Quantize(double acceleration) {
+            return std::floor(acceleration * 100.0) / 100.0;
+        }
+    };
+}
+
+#endif // MOTION_PLANNER_H
@@ -0,0 +1,135 @@
+#ifndef MULTI_CELL_H
+#define MULTI_CELL_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "cell.h"
+#include "clock.h"
+#include "logging.h"
+
+/**
+ * Outcome of one cell's cycle.
+ */
+struct CellResult {
+    std::string name;
+    bool success{false};
+    std::string error;
+    double cycle_time{0.0}; // s, wall time of the cycle as run
+};
+
+/**
+ * Runs a step of a cell, turning exceptions into a failed result.
+ * \param step Callable returning true on success
+ * \param abort Callable that halts the cell after an exception
+ */
+template <typename Step, typename Abort>
+CellResult RunGuarded(const std::string& name, Step step, Abort abort) {
+    CellResult result;
+    result.name = name;
+    auto start = Time::Clock::now();
+
+    try {
+        result.success = step();
+    }
+    catch (const Pylon::GenericException& e) {
+        result.error = std::string("pylon exception: ") + e.GetDescription();
+    }
+    catch (const std::exception& e) {
+        result.error = e.what();
+    }
+
+    if (!result.error.empty()) {
+        Logger::error("Cycle aborted: " + result.error);
+        try {
+            abort();
+        }
+        catch (const std::exception& e) {
+            Logger::error("Failed to halt after abort: " + std::string(e.what()));
+        }
+    }
+
+    result.cycle_time = std::chrono::duration<double>(Time::Clock::now() - start).count();
+    return result;
+}
+
+/**
+ * Logs the allocation counts since the last report and starts counting again. The counts are kept for the
+ * whole process, so call this once all cells running concurrently have finished their cycles.
+ */
+void ReportAllocations() {
+    auto allocations = AllocStats::Report();
+    if (!allocations.empty())
+        Logger::info(allocations);
+    AllocStats::Reset();
+}
+
+/**
+ * Runs one cycle on an initialized cell.
+ */
+CellResult RunCycle(Cell& cell) {
+    Logger::setContext(cell.config.name);
+    auto result = RunGuarded(cell.config.name, [&]() { return cell.RunCycle(); },
+        [&]() {
+            cell.Halt();
+            cell.DumpFrames("aborted");
+        });
+    Logger::info("Cycle " + std::string(result.success ? "succeeded" : "failed") + " in " + std::to_string(result.cycle_time) + " s");
+    Logger::setContext("");
+    return result;
+}
+
+/**
+ * Opens a cell, runs one cycle on it and shuts it down again.
+ * The cycle time includes opening the serial links, homing and loading the recipe.
+ */
+CellResult RunCell(const CellConfig& config, const CycleParameters& parameters) {
+    Logger::setContext(config.name);
+    std::unique_ptr<Cell> cell;
+
+    auto result = RunGuarded(config.name,
+        [&]() {
+            cell = std::make_unique<Cell>(config, parameters);
+            cell->Initialize();
+            bool success = cell->RunCycle();
+            cell->Shutdown();
+            return success;
+        },
+        [&]() {
+            if (cell)
+                cell->Halt();
+        });
+
+    Logger::info("Cycle " + std::string(result.success ? "succeeded" : "failed") + " in " + std::to_string(result.cycle_time) + " s");
+    Logger::setContext("");
+    return result;
+}
+
+/**
+ * Drives several cells concurrently from one process, each on a thread of its own that runs the cell's
+ * coroutines on an event loop of its own. Cells are not shared out over fewer threads: serial exchanges
+ * block the thread that sends them, and the log context, the allocation counts and virtual time are kept
+ * per thread, so two cells on one thread would stall each other and mix up their logs and counts.
+ * \return One result per cell, in the order of configs
+ */
+std::vector<CellResult> RunCells(const std::vector<CellConfig>& configs, const CycleParameters& parameters) {
+    std::vector<CellResult> results(configs.size());
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < configs.size(); ++i) {
+        workers.emplace_back([&, i]() { results[i] = RunCell(configs[i], parameters); });
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    if (!configs.empty())
+        ReportAllocations();
+
+    return results;
+}
+
+#endif // MULTI_CELL_H
@@ -0,0 +1,218 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h> // WaitOnAddress, Windows 8 or later, link against Synchronization.lib
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+/**
+ * Histogram of latencies in power of two microsecond buckets. Recording is lock-free.
+ */
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 24; // Bucket i holds latencies below 2^i us, the last one everything above
+
+    void Record(std::chrono::nanoseconds latency) {
+        uint64_t us = static_cast<uint64_t>((std::max)(latency.count(), int64_t(0))) / 1000;
+        size_t bucket = 0;
+        while (bucket + 1 < BUCKETS && (uint64_t(1) << bucket) <= us) {
+            ++bucket;
+        }
+        uint64_t ns = static_cast<uint64_t>((std::max)(latency.count(), int64_t(0)));
+        counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+        total_ns_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = max_ns_.load(std::memory_order_relaxed);
+        while (ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t Count() const {
+        uint64_t count = 0;
+        for (auto& bucket : counts_) {
+            count += bucket.load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+    double MeanMicroseconds() const {
+        uint64_t count = Count();
+        return count ? total_ns_.load(std::memory_order_relaxed) / 1000.0 / count : 0.0;
+    }
+
+    // Exact worst case
+    double MaxMicroseconds() const {
+        return max_ns_.load(std::memory_order_relaxed) / 1000.0;
+    }
+
+    /**
+     * \param fraction 0.5 for the median, 0.99 for the 99th percentile
+     * \return Upper bound of the bucket holding that fraction of the samples, in us
+     */
+    uint64_t PercentileMicroseconds(double fraction) const {
+        uint64_t count = Count();
+        if (count == 0)
+            return 0;
+        uint64_t target = static_cast<uint64_t>(fraction * count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen > target)
+                return uint64_t(1) << i;
+        }
+        return uint64_t(1) << (BUCKETS - 1);
+    }
+
+    std::string Summary() const {
+        return std::to_string(Count()) + " samples, mean " + std::to_string(MeanMicroseconds()) + " us, p50 < " +
+               std::to_string(PercentileMicroseconds(0.5)) + " us, p99 < " + std::to_string(PercentileMicroseconds(0.99)) + " us, max " +
+               std::to_string(MaxMicroseconds()) + " us";
+    }
+
+    void Reset() {
+        for (auto& bucket : counts_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        total_ns_.store(0, std::memory_order_relaxed);
+        max_ns_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> counts_{};
+    std::atomic<uint64_t> total_ns_{0};
+    std::atomic<uint64_t> max_ns_{0};
+};
+
+/**
+ * Wakes threads waiting for an event, e.g. a new camera result.
+ *
+ * Waiters read the epoch, check their condition and then wait for the epoch to move on, so a notification
+ * between the check and the wait is never lost. Notify only enters the kernel when a thread is waiting.
+ * Waits use a futex on Linux and WaitOnAddress on Windows, and a condition variable elsewhere.
+ * The time from Notify to the waiter running again is recorded in a histogram.
+ */
+class Notifier {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Notifier() = default;
+    Notifier(const Notifier&) = delete;
+    Notifier& operator=(const Notifier&) = delete;
+
+    uint32_t Epoch() const {
+        return epoch_.load(std::memory_order_acquire);
+    }
+
+    void Notify() {
+        notified_at_.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        // Sequentially consistent so either the waiter sees the new epoch or Notify sees the waiter
+        epoch_.fetch_add(1, std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_seq_cst) > 0) {
+            WakeAll();
+        }
+    }
+
+    /**
+     * Waits until the epoch differs from seen or the timeout expires.
+     * \param seen Value of Epoch() read before checking the condition being waited for
+     * \return false on timeout
+     */
+    bool WaitFor(uint32_t seen, std::chrono::nanoseconds timeout) {
+        auto deadline = Clock::now() + timeout;
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+
+        bool woken = true;
+        while (epoch_.load(std::memory_order_seq_cst) == seen) {
+            auto remaining = deadline - Clock::now();
+            if (remaining <= Clock::duration::zero()) {
+                woken = false;
+                break;
+            }
+            Block(seen, std::chrono::duration_cast<std::chrono::nanoseconds>(remaining));
+        }
+
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        if (woken) {
+            Clock::time_point notified{Clock::duration(notified_at_.load(std::memory_order_relaxed))};
+            wake_latency_.Record(Clock::now() - notified);
+        }
+        return woken;
+    }
+
+    /**
+     * Time from Notify until a waiting thread resumed, for waits that actually blocked or spun on the epoch.
+     */
+    const LatencyHistogram& WakeLatency() const {
+        return wake_latency_;
+    }
+
+    LatencyHistogram& WakeLatency() {
+        return wake_latency_;
+    }
+
+private:
+    std::atomic<uint32_t> epoch_{0};
+    std::atomic<uint32_t> waiters_{0};
+    std::atomic<Clock::rep> notified_at_{0};
+    LatencyHistogram wake_latency_;
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex word must be a plain 32 bit integer");
+
+#if defined(_WIN32)
+    void Block(uint32_t seen, std::chrono::nanoseconds timeout) {
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+        WaitOnAddress(&epoch_, &seen, sizeof(seen), static_cast<DWORD>(ms));
+    }
+
+    void WakeAll() {
+        WakeByAddressAll(&epoch_);
+    }
+#elif defined(__linux__)
+    uint32_t* Word() {
+        return reinterpret_cast<uint32_t*>(&epoch_);
+    }
+
+    void Block(uint32_t seen, std::chrono::nanoseconds timeout) {
+        timespec ts;
+        ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+        syscall(SYS_futex, Word(), FUTEX_WAIT_PRIVATE, seen, &ts, nullptr, 0);
+    }
+
+    void WakeAll() {
+        syscall(SYS_futex, Word(), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    }
+#else
+    std::mutex mutex_;
+    std::condition_variable condition_;
+
+    void Block(uint32_t seen, std::chrono::nanoseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait_for(lock, timeout, [&]() { return epoch_.load(std::memory_order_acquire) != seen; });
+    }
+
+    void WakeAll() {
+        std::lock_guard<std::mutex> lock(mutex_); // Orders the wake after a waiter's check of the epoch
+        condition_.notify_all();
+    }
+#endif
+};
+
+#endif // NOTIFIER_H
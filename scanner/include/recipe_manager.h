@@ -0,0 +1,195 @@
+#ifndef RECIPE_MANAGER_H
+#define RECIPE_MANAGER_H
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+// Include files to use the pylon API.
+#include <pylon/PylonIncludes.h>
+// Extend the pylon API for using pylon data processing.
+#include <pylondataprocessing/PylonDataProcessingIncludes.h>
+
+#include "OutputObserver.h"
+#include "logging.h"
+
+/**
+ * Keeps several recipes loaded with their resources allocated and switches between them.
+ *
+ * All recipes push into one shared output observer, registered once per recipe when it is loaded, and only
+ * the active recipe is started. Switching therefore costs a Stop and a Start instead of a Load and a
+ * PreAllocateResources. Recipes that cannot hold their resources at the same time (e.g. two recipes opening
+ * the same camera) fall back to allocating on switch.
+ */
+class RecipeManager {
+public:
+    RecipeManager() {
+        Pylon::PylonInitialize(); // Balanced by the PylonTerminate in Shutdown
+    }
+
+    RecipeManager(const RecipeManager&) = delete;
+    RecipeManager& operator=(const RecipeManager&) = delete;
+
+    ~RecipeManager() {
+        Shutdown();
+    }
+
+    /**
+     * Loads a recipe and allocates its resources without starting it.
+     * \param name Name used to activate the recipe
+     * \param path Path to the .precipe file
+     */
+    void Preload(const std::string& name, const Pylon::String_t& path) {
+        auto start = std::chrono::steady_clock::now();
+        auto entry = std::make_unique<Entry>();
+
+        Logger::verbose("RecipeManager::Preload: Loading recipe " + name);
+        entry->recipe.Load(path);
+
+        Logger::verbose("RecipeManager::Preload: Registering outputs observer");
+        entry->recipe.RegisterAllOutputsObserver(&observer_, Pylon::DataProcessing::RegistrationMode_Append);
+        observer_.RegisterOutputs(entry->recipe.GetOutputNames());
+
+        try {
+            entry->recipe.PreAllocateResources(); // This includes the camera device if used in the recipe.
+            entry->allocated = true;
+        }
+        catch (const Pylon::GenericException& e) {
+            Logger::warn("RecipeManager::Preload: Resources of " + name + " will be allocated on switch: " + e.GetDescription());
+        }
+
+        if (recipes_.count(name)) {
+            if (active_ == name)
+                Deactivate();
+            Release(*recipes_[name]);
+        }
+        recipes_[name] = std::move(entry);
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        startup_time_ += elapsed;
+        Logger::debug("RecipeManager::Preload: Loaded " + name + " in " + std::to_string(elapsed * 1000.0) + " ms");
+    }
+
+    /**
+     * Starts a preloaded recipe, stopping the active one.
+     * \throws std::runtime_error if no recipe with that name was preloaded
+     */
+    void Activate(const std::string& name) {
+        if (name == active_)
+            return;
+
+        auto it = recipes_.find(name);
+        if (it == recipes_.end())
+            throw std::runtime_error("RecipeManager::Activate: No recipe named " + name + " was preloaded");
+
+        auto start = std::chrono::steady_clock::now();
+        Entry& next = *it->second;
+
+        if (!active_.empty()) {
+            Entry& previous = *recipes_[active_];
+            previous.recipe.Stop();
+            if (!next.allocated) {
+                // The two recipes cannot hold their resources at the same time
+                previous.recipe.DeallocateResources();
+                previous.allocated = false;
+            }
+        }
+
+        if (!next.allocated) {
+            next.recipe.PreAllocateResources();
+            next.allocated = true;
+        }
+
+        observer_.ClearOutputData();
+        next.recipe.Start();
+        active_ = name;
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++switches_;
+        switch_time_ += elapsed;
+        max_switch_time_ = (std::max)(max_switch_time_, elapsed);
+        Logger::debug("RecipeManager::Activate: Switched to " + name + " in " + std::to_string(elapsed * 1000.0) + " ms");
+    }
+
+    /**
+     * Stops the active recipe. Its resources stay allocated.
+     */
+    void Deactivate() {
+        if (active_.empty())
+            return;
+        recipes_[active_]->recipe.Stop();
+        active_.clear();
+    }
+
+    /**
+     * Stops all recipes and releases their resources and the pylon runtime.
+     */
+    void Shutdown() {
+        if (terminated_)
+            return;
+        Deactivate();
+        for (auto& [name, entry] : recipes_) {
+            Release(*entry);
+        }
+        recipes_.clear();
+        observer_.GetFrameRing().Resize(0); // Releases the images it references
+        Pylon::PylonTerminate();
+        terminated_ = true;
+    }
+
+    bool Has(const std::string& name) const {
+        return recipes_.count(name) > 0;
+    }
+
+    const std::string& ActiveName() const {
+        return active_;
+    }
+
+    /**
+     * \throws std::runtime_error if no recipe is active
+     */
+    Pylon::DataProcessing::CRecipe& Active() {
+        if (active_.empty())
+            throw std::runtime_error("RecipeManager::Active: No recipe is active");
+        return recipes_[active_]->recipe;
+    }
+
+    RecipeOutputObserver& Observer() {
+        return observer_;
+    }
+
+    void ReportLatency() const {
+        Logger::info("Recipes: " + std::to_string(recipes_.size()) + " preloaded in " + std::to_string(startup_time_ * 1000.0) +
+                     " ms, " + std::to_string(switches_) + " switches, mean " +
+                     std::to_string(switches_ ? switch_time_ / switches_ * 1000.0 : 0.0) + " ms, max " +
+                     std::to_string(max_switch_time_ * 1000.0) + " ms");
+    }
+
+private:
+    struct Entry {
+        Pylon::DataProcessing::CRecipe recipe;
+        bool allocated{false};
+    };
+
+    RecipeOutputObserver observer_; // Shared by all recipes
+    std::map<std::string, std::unique_ptr<Entry>> recipes_;
+    std::string active_;
+    bool terminated_{false};
+
+    double startup_time_{0.0};    // s, total time spent preloading
+    size_t switches_{0};
+    double switch_time_{0.0};     // s, total
+    double max_switch_time_{0.0}; // s
+
+    void Release(Entry& entry) {
+        entry.recipe.UnregisterAllOutputsObserver(&observer_);
+        if (entry.allocated)
+            entry.recipe.DeallocateResources();
+        entry.recipe.Unload();
+        entry.allocated = false;
+    }
+};
+
+#endif // RECIPE_MANAGER_H
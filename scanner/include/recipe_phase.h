@@ -0,0 +1,50 @@
+#ifndef RECIPE_PHASE_H
+#define RECIPE_PHASE_H
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Phases of a cycle with different demands on the camera. Scanning needs the full field of view,
+ * refinement only the area around the image center but as many frames per second as possible.
+ */
+enum class RecipePhase {
+    SCAN = 0,
+    REFINE = 1,
+};
+
+const char* PhaseName(RecipePhase phase) {
+    return phase == RecipePhase::SCAN ? "scan" : "refine";
+}
+
+/**
+ * Recipe parameters applied on entering a phase, as pairs of parameter name and value.
+ * Names are the recipe's parameter paths, e.g. "Camera/@CameraInstance/ExposureTime" for a camera feature.
+ */
+struct PhaseSettings {
+    std::string recipe; // Preloaded recipe to switch to first, e.g. a lighter one for refinement. Empty keeps the active one.
+    std::vector<std::pair<std::string, std::string>> parameters;
+};
+
+/**
+ * Detection statistics collected while a phase is active.
+ */
+struct PhaseStats {
+    size_t frames{0};         // Results received
+    size_t timeouts{0};       // Detect calls that timed out
+    double wait_time{0.0};    // s, total time Detect spent waiting for a result
+    double active_time{0.0};  // s, total time the phase was active
+    double switch_time{0.0};  // s, total time spent applying this phase's settings
+
+    double FrameRate() const {
+        return active_time > 0.0 ? frames / active_time : 0.0;
+    }
+
+    double MeanLatency() const {
+        return frames > 0 ? wait_time / frames : 0.0;
+    }
+};
+
+#endif // RECIPE_PHASE_H
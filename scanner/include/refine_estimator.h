@@ -0,0 +1,195 @@
+#ifndef REFINE_ESTIMATOR_H
+#define REFINE_ESTIMATOR_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "xy.h"
+
+struct RefinementSettings {
+    int min_frames{1};            // Frames averaged per correction at least
+    int max_frames{7};            // Frames averaged per correction at most
+    double frame_noise{0.02};     // mm, standard deviation of a single frame's offset (monte_carlo/constants.py)
+    double confidence{2.0};       // Standard deviations the estimate must be away from the tolerance before acting
+    double trim_fraction{0.25};   // Share of the score weight dropped from each end, 0.5 gives the weighted median
+    int lost_frames{3};           // Frames in a row without the target before searching for it
+    int search_rings{2};          // Rings of the search around where the target was last seen at most, 0 to give up instead
+    double field_of_view{35.0};   // mm, smaller side of the camera's view while refining. Spaces the search positions.
+};
+
+/**
+ * Offset from the camera center to the target in one frame.
+ */
+struct OffsetSample {
+    XY offset;  // mm
+    double score{0.0};
+};
+
+/**
+ * Number of frames to average for a given estimated error.
+ * Far from the tolerance a single frame decides whether to move and a few hundredths of a millimeter of
+ * noise in the correction do not matter. Close to it, the camera noise decides whether another correction
+ * is made, so frames are added until the estimate is clearly inside or outside the tolerance.
+ */
+int FramesForError(const RefinementSettings& settings, double error, double tolerance) {
+    int min_frames = (std::max)(settings.min_frames, 1);
+    int max_frames = (std::max)(settings.max_frames, min_frames);
+
+    double margin = std::abs(error - tolerance);
+    double needed = margin > 0.0 ? std::pow(settings.confidence * settings.frame_noise / margin, 2.0) : max_frames;
+    if (needed >= max_frames)
+        return max_frames;
+    return (std::max)(min_frames, static_cast<int>(std::ceil(needed)));
+}
+
+/**
+ * Weighted trimmed mean. Each value counts with its weight; trim_fraction of the total weight is removed
+ * from each end before averaging, cutting samples at the boundary partially.
+ * \param begin, end Value and weight pairs. Sorted in place.
+ */
+template <typename Iterator>
+double WeightedTrimmedMean(Iterator begin, Iterator end, double trim_fraction) {
+    if (begin == end)
+        return 0.0;
+
+    std::sort(begin, end);
+    Iterator middle = begin + (end - begin) / 2;
+    double total = 0.0;
+    for (auto it = begin; it != end; ++it) {
+        total += it->second;
+    }
+    if (total <= 0.0)
+        return middle->first;
+
+    trim_fraction = (std::min)((std::max)(trim_fraction, 0.0), 0.5);
+    double low = trim_fraction * total;
+    double high = total - low;
+
+    // Weighted median
+    if (high - low < 1e-12 * total) {
+        double cumulative = 0.0;
+        for (auto it = begin; it != end; ++it) {
+            cumulative += it->second;
+            if (cumulative >= total / 2.0)
+                return it->first;
+        }
+        return (end - 1)->first;
+    }
+
+    double sum = 0.0;
+    double kept = 0.0;
+    double start = 0.0;
+    for (auto it = begin; it != end; ++it) {
+        double stop = start + it->second;
+        double overlap = (std::min)(stop, high) - (std::max)(start, low);
+        if (overlap > 0.0) {
+            sum += it->first * overlap;
+            kept += overlap;
+        }
+        start = stop;
+    }
+    return kept > 0.0 ? sum / kept : middle->first;
+}
+
+double WeightedTrimmedMean(std::vector<std::pair<double, double>> samples, double trim_fraction) {
+    return WeightedTrimmedMean(samples.begin(), samples.end(), trim_fraction);
+}
+
+/**
+ * Robust estimate of the offset to the target from several frames taken at the same stage position.
+ * The axes are estimated independently, weighting each frame by its detection score.
+ */
+XY EstimateOffset(const std::vector<OffsetSample>& samples, double trim_fraction) {
+    if (samples.size() == 1)
+        return samples[0].offset;
+
+    // Refinement averages a handful of frames, so avoid allocating for the common case
+    constexpr size_t STACK_SAMPLES = 16;
+    std::array<std::pair<double, double>, STACK_SAMPLES> x_stack, y_stack;
+    std::vector<std::pair<double, double>> x_heap, y_heap;
+    bool on_stack = samples.size() <= STACK_SAMPLES;
+    if (!on_stack) {
+        x_heap.resize(samples.size());
+        y_heap.resize(samples.size());
+    }
+    auto* x = on_stack ? x_stack.data() : x_heap.data();
+    auto* y = on_stack ? y_stack.data() : y_heap.data();
+
+    for (size_t i = 0; i < samples.size(); ++i) {
+        double weight = (std::max)(samples[i].score, 1e-9);
+        x[i] = {samples[i].offset.x, weight};
+        y[i] = {samples[i].offset.y, weight};
+    }
+    return XY(WeightedTrimmedMean(x, x + samples.size(), trim_fraction),
+              WeightedTrimmedMean(y, y + samples.size(), trim_fraction));
+}
+
+/**
+ * What the refinement loop does after a frame.
+ */
+struct RefinementDecision {
+    bool need_more_frames{false}; // The estimate is too close to the tolerance to act on yet
+    bool within_tolerance{false}; // Done, the target is centered
+    XY error;                     // mm, estimated offset to the target
+    XY correction;                // mm, move to make if neither of the above
+};
+
+/**
+ * One step of the refinement loop, shared by the scanner and the tolerance simulations.
+ * \param samples Offsets measured since the stage last came to rest
+ */
+RefinementDecision DecideRefinement(const std::vector<OffsetSample>& samples, const RefinementSettings& settings,
+                                    double tolerance, double scale_factor) {
+    RefinementDecision decision;
+    decision.error = EstimateOffset(samples, settings.trim_fraction);
+    double magnitude = decision.error.magnitude();
+
+    if (static_cast<int>(samples.size()) < FramesForError(settings, magnitude, tolerance)) {
+        decision.need_more_frames = true;
+        return decision;
+    }
+
+    decision.within_tolerance = magnitude < tolerance;
+    decision.correction = decision.error * -scale_factor;
+    return decision;
+}
+
+/**
+ * Stage positions to look for a target lost while refining: its estimated position first, then a square
+ * spiral around it, ring by ring. Neighbouring positions are a field of view apart less an overlap, so their
+ * views tile the area searched. The spiral has as many rings as it takes to reach radius, at least one and at
+ * most search_rings.
+ * \param center Estimated position of the target
+ * \param radius mm, how far from center the target may be, e.g. the length of the last correction
+ * \return Empty if searching is disabled
+ */
+std::vector<XY> SearchPattern(XY center, double radius, const RefinementSettings& settings) {
+    constexpr double OVERLAP = 0.2; // Of the field of view, so a target at the edge of one view is inside the next
+    if (settings.search_rings <= 0)
+        return {};
+
+    double step = settings.field_of_view * (1.0 - OVERLAP);
+    int rings = (std::clamp)(static_cast<int>(std::ceil(radius / step)), 1, settings.search_rings);
+    size_t count = static_cast<size_t>((2 * rings + 1) * (2 * rings + 1));
+
+    // Legs of 1, 1, 2, 2, 3, 3, ... grid steps, turning a quarter after each, pass every point of the rings
+    std::vector<XY> pattern{center};
+    int x = 0, y = 0, dx = 1, dy = 0;
+    for (int leg = 1; pattern.size() < count; ++leg) {
+        for (int side = 0; side < 2; ++side) {
+            for (int i = 0; i < leg; ++i) {
+                x += dx;
+                y += dy;
+                if (std::abs(x) <= rings && std::abs(y) <= rings)
+                    pattern.push_back(center + XY(x, y) * step);
+            }
+            std::swap(dx, dy);
+            dx = -dx;
+        }
+    }
+    return pattern;
+}
+
+#endif // REFINE_ESTIMATOR_H
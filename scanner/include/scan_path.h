@@ -0,0 +1,28 @@
+#ifndef SCAN_PATH_H
+#define SCAN_PATH_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "logging.h"
+#include "xy.h"
+
+typedef std::vector<XY> Path;
+
+Path buildScanPath (XY start, XY max, double width) {
+    Path path {start};
+    int num_passes = std::ceil((max.x - start.x) / width) + 1;
+    for (int i = 0; i < num_passes*2; ++i) {
+        double x_coordinate = (std::min)(width * (i/2) + start.x, max.x);
+        double y_coordinate = max.y * (((i+1)/2) % 2);
+        path.push_back(XY(x_coordinate, y_coordinate));
+    }
+
+    Logger::debug("Scan path:");
+    for (auto& point : path) {
+        Logger::debug(point.toString());
+    }
+    return path;
+}
+
+#endif // SCAN_PATH_H
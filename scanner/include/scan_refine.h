@@ -0,0 +1,295 @@
+#ifndef SCAN_REFINE_H
+#define SCAN_REFINE_H
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async.h"
+#include "clock.h"
+#include "detection_tracker.h"
+#include "logging.h"
+#include "refine_estimator.h"
+#include "scan_state.h"
+#include "xy.h"
+
+/**
+ * The scan and refine loops of the cycle, shared by the scanner and the cycle simulator.
+ *
+ * The loops are templates over the stage and the camera they drive, so the same code runs on a cell and
+ * on the simulated world of tools/tune:
+ *
+ * Stage is Commander or a stand-in with its members: position, in_motion and travel, MoveTo, the
+ * coroutines Move, XYDone and ReadStatus, PollSEL, PositionAt and HaltAll.
+ *
+ * Camera is PylonRecipe or a stand-in with the coroutines NextFrame and FrameAfter, filling a CameraFrame
+ * and returning false on a timeout or a failed result.
+ */
+
+/**
+ * The detections of one camera result, as offsets from the camera center to each object in stage
+ * coordinates. A measured offset overstates the actual distance, which the scale factors compensate for.
+ */
+struct CameraFrame {
+    std::vector<OffsetSample> mobile;
+    std::vector<OffsetSample> fixed;
+    Time::Clock::time_point capture_time; // Estimated time the frame was exposed
+};
+
+/**
+ * Converts the detections of one connector in a frame to the stage positions that would center the camera on
+ * each object.
+ * \param stage_position Stage position when the frame was captured
+ */
+std::vector<Detection> ToStageDetections(const std::vector<OffsetSample>& samples, XY stage_position) {
+    std::vector<Detection> detections;
+    for (auto& sample : samples) {
+        detections.push_back({stage_position - sample.offset, sample.score});
+    }
+    return detections;
+}
+
+/**
+ * Best scoring detection of a connector in a frame.
+ * \return false if the frame holds none
+ */
+bool BestDetection(const std::vector<OffsetSample>& samples, OffsetSample& sample) {
+    if (samples.empty())
+        return false;
+    sample = *std::max_element(samples.begin(), samples.end(),
+                               [](const OffsetSample& a, const OffsetSample& b) { return a.score < b.score; });
+    return true;
+}
+
+/**
+ * Follows the scan path until a connector is confirmed, optionally recording where the other was seen.
+ * \param target, other The detections of the connector to find and of the one to record, nullptr for none
+ * \param scan Progress over the workspace. Left at the point the scan stopped, for the next scan to resume from.
+ * \param other_position Set to where the other connector was seen, if it was
+ * \return Whether the connector was found, with the stage centered on it, and whether the other was seen
+ */
+template <typename Stage, typename Camera>
+Async::Task<std::pair<bool, bool>> ScanFor(std::string name, std::vector<OffsetSample> CameraFrame::*target,
+                                           std::vector<OffsetSample> CameraFrame::*other, Stage& stage, Camera& camera,
+                                           ScanState& scan, int speed, XY& other_position, TrackerSettings tracker_settings) {
+    Logger::debug("Entering " + name + " scan loop");
+
+    // Check if the connector is already in frame. The stage is at rest, so only a frame from now on counts.
+    CameraFrame frame;
+    if (co_await camera.FrameAfter(Time::Clock::now(), frame) && !(frame.*target).empty()) {
+        co_return std::make_pair(true, false);
+    }
+
+    DetectionTracker target_tracker(tracker_settings);
+    DetectionTracker other_tracker(tracker_settings);
+
+    // The other connector is only recorded for later, so the best hypothesis is used even if it never got confirmed.
+    auto record_other = [&]() {
+        const Track* seen = other_tracker.Confirmed();
+        if (!seen)
+            seen = other_tracker.Best();
+        if (!other || !seen)
+            return false;
+        other_position = seen->position;
+        return true;
+    };
+
+    while (!scan.Done()) {
+        stage.MoveTo(scan.Waypoint(), speed);
+        co_await stage.ReadStatus();
+
+        while (stage.in_motion) { // Continously get camera data and check if move has completed
+            // A frame without detections counts as a miss for every track. A timeout or a failed result says
+            // nothing about the connectors, so it leaves the tracks alone.
+            bool received = co_await camera.NextFrame(frame);
+
+            // A status read after the frame brackets its exposure, so the stage position is interpolated.
+            // Frames between the polls the link budget allows use the extrapolated position.
+            stage.PollSEL();
+            if (!received)
+                continue;
+            XY stage_position = stage.PositionAt(frame.capture_time);
+            scan.Observe(stage_position);
+
+            auto found = target_tracker.Update(ToStageDetections(frame.*target, stage_position));
+            if (other)
+                other_tracker.Update(ToStageDetections(frame.*other, stage_position));
+
+            // Only stop for a connector seen consistently over several frames
+            if (found) {
+                XY position = found->position;
+                Logger::info("The " + name + " connector was confirmed at " + position.toString() + " after " +
+                             std::to_string(found->hits) + " frames");
+
+                stage.HaltAll();
+                co_await stage.XYDone();
+                scan.Interrupt(stage.position);
+
+                co_await stage.Move(position);
+                co_return std::make_pair(true, record_other());
+            }
+        }
+        scan.Reached();
+    }
+
+    co_return std::make_pair(false, record_other());
+}
+
+/**
+ * Follows the scan path until the mobile connector is confirmed, recording where the fixed connector was seen.
+ * \param scan Progress over the workspace. Left at the point the scan stopped, for ScanForFixed to resume from.
+ * \return Whether the mobile connector was found, with the stage centered on it, and whether the fixed
+ * connector was seen
+ */
+template <typename Stage, typename Camera>
+Async::Task<std::pair<bool, bool>> ScanForMobile(Stage& stage, Camera& camera, ScanState& scan, int speed, XY& fixed_position,
+                                                 TrackerSettings tracker_settings = TrackerSettings()) {
+    return ScanFor("mobile", &CameraFrame::mobile, &CameraFrame::fixed, stage, camera, scan, speed, fixed_position, tracker_settings);
+}
+
+/**
+ * Follows the rest of the scan path until the fixed connector is confirmed.
+ * \param scan Progress over the workspace, resumed where it was left
+ * \return true with the stage centered on the fixed connector
+ */
+template <typename Stage, typename Camera>
+Async::Task<bool> ScanForFixed(Stage& stage, Camera& camera, ScanState& scan, int speed, TrackerSettings tracker_settings = TrackerSettings()) {
+    XY unused;
+    auto [found, seen] = co_await ScanFor("fixed", &CameraFrame::fixed, nullptr, stage, camera, scan, speed, unused, tracker_settings);
+    co_return found;
+}
+
+/**
+ * Looks for a connector lost while refining, taking one settled frame at each position of a SearchPattern.
+ * \param scale_factor Scales the measured offset, which overstates the actual distance
+ * \return Estimated position of the connector, if a frame showed it
+ */
+template <typename Stage, typename Camera>
+Async::Task<std::optional<XY>> Reacquire(std::vector<OffsetSample> CameraFrame::*target, Stage& stage, Camera& camera,
+                                         std::vector<XY> pattern, int speed, double scale_factor) {
+    CameraFrame frame;
+    OffsetSample sample;
+    for (auto& point : pattern) {
+        if (!point.inBounds(XY(0, 0), stage.travel))
+            continue;
+        co_await stage.Move(point, speed);
+
+        if (co_await camera.FrameAfter(Time::Clock::now(), frame) && BestDetection(frame.*target, sample))
+            co_return stage.position + sample.offset * -scale_factor;
+    }
+    co_return std::nullopt;
+}
+
+/**
+ * Centers the camera on a connector with repeated corrections.
+ * Once the stage has settled, the offset is estimated from several frames, more of them the closer the
+ * previous estimate was to the tolerance, so camera noise near the tolerance does not cause extra moves.
+ * If the connector drops out of view, the stage searches around where it was last seen and refinement
+ * continues from wherever it is found.
+ * \param target The detections of the connector
+ * \return true once the estimated error is below tolerance
+ */
+template <typename Stage, typename Camera>
+Async::Task<bool> RefineTo(std::string name, std::vector<OffsetSample> CameraFrame::*target, Stage& stage, Camera& camera,
+                           int speed, double tolerance, double scale_factor, RefinementSettings settings) {
+    constexpr int MAX_SEARCHES = 3;
+    const int max_misses = (std::max)(10, settings.lost_frames); // Frames in a row without the connector before giving up
+    Logger::debug("Entering " + name + " refinement loop...");
+    int detection_errors = 0;
+    int moves = 0;
+    int frames = 0;
+    int searches = 0;
+    std::vector<OffsetSample> samples;
+    CameraFrame frame;
+    auto settled = Time::Clock::now(); // Frames from before the stage came to rest show a stale error
+
+    // Where the connector is expected, and how far off that may be, for a search if it is lost
+    XY last_seen = stage.position;
+    double last_correction = 0.0;
+
+    auto report = [&](bool success) {
+        Logger::info("Refinement to " + name + (success ? " succeeded" : " failed") + " after " + std::to_string(moves) +
+                     " moves using " + std::to_string(frames) + " frames and " + std::to_string(searches) + " searches");
+        return success;
+    };
+
+    while (detection_errors <= max_misses) {
+        // A frame showing only the other connector counts as a miss too
+        OffsetSample sample;
+        if (!co_await camera.FrameAfter(settled, frame) || !BestDetection(frame.*target, sample)) {
+            Logger::error("No " + name + " connector detected in refinement loop! (" + std::to_string(detection_errors) + ")" );
+            ++detection_errors;
+            if (detection_errors < settings.lost_frames)
+                continue;
+
+            // Searching is disabled or keeps losing the connector again: wait for it in place
+            auto pattern = SearchPattern(last_seen, last_correction, settings);
+            if (pattern.empty() || searches >= MAX_SEARCHES)
+                continue;
+
+            ++searches;
+            auto search_start = Time::Clock::now();
+            auto found = co_await Reacquire(target, stage, camera, pattern, speed, scale_factor);
+            double elapsed_ms = std::chrono::duration<double, std::milli>(Time::Clock::now() - search_start).count();
+            if (!found) {
+                Logger::error("Lost the " + name + " connector. Searched " + std::to_string(pattern.size()) + " positions around " +
+                              last_seen.toString() + " in " + std::to_string(elapsed_ms) + " ms");
+                co_return report(false);
+            }
+
+            Logger::info("Reacquired the " + name + " connector at " + found->toString() + " in " + std::to_string(elapsed_ms) + " ms");
+            last_seen = *found;
+            co_await stage.Move(*found, speed);
+            settled = Time::Clock::now();
+            samples.clear();
+            detection_errors = 0;
+            ++moves;
+            continue;
+        }
+
+        detection_errors = 0;
+        samples.push_back(sample);
+        last_seen = stage.position + sample.offset * -scale_factor;
+        ++frames;
+
+        auto decision = DecideRefinement(samples, settings, tolerance, scale_factor);
+        if (decision.need_more_frames)
+            continue;
+
+        co_await stage.ReadStatus();
+        Logger::info("Current Position: " + stage.position.toString());
+        Logger::info("Detected Error: " + decision.error.toString() + " from " + std::to_string(samples.size()) + " frames");
+
+        if (decision.within_tolerance) {
+            Logger::info("Success! Total error " + std::to_string(decision.error.magnitude()));
+            co_return report(true);
+        }
+
+        XY target_position = stage.position + decision.correction;
+        Logger::info("Target position: " + target_position.toString());
+        co_await stage.Move(target_position, speed);
+        settled = Time::Clock::now();
+        samples.clear();
+        last_correction = decision.correction.magnitude();
+        ++moves;
+    }
+
+    co_return report(false);
+}
+
+template <typename Stage, typename Camera>
+Async::Task<bool> RefineToMobile(Stage& stage, Camera& camera, int speed, double tolerance, double scale_factor,
+                                 const RefinementSettings& settings = RefinementSettings()) {
+    return RefineTo("mobile", &CameraFrame::mobile, stage, camera, speed, tolerance, scale_factor, settings);
+}
+
+template <typename Stage, typename Camera>
+Async::Task<bool> RefineToFixed(Stage& stage, Camera& camera, int speed, double tolerance, double scale_factor,
+                                const RefinementSettings& settings = RefinementSettings()) {
+    return RefineTo("fixed", &CameraFrame::fixed, stage, camera, speed, tolerance, scale_factor, settings);
+}
+
+#endif // SCAN_REFINE_H
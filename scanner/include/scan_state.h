@@ -0,0 +1,185 @@
+#ifndef SCAN_STATE_H
+#define SCAN_STATE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "scan_path.h"
+#include "xy.h"
+
+/**
+ * Progress of the scan over the workspace, shared by the scans of one cycle.
+ *
+ * The mobile scan stops wherever it confirms the mobile connector, and the fixed scan later picks up from
+ * there. The state keeps the segment in progress and the point on it where the stage left the path, so the
+ * next scan moves back to that point and finishes the segment from it instead of sweeping the covered part
+ * again. A second search over the whole path is another lap of the same path.
+ *
+ * The workspace is divided into square cells one scan width wide, centered on the passes. Every frame
+ * marks the cell the camera is centered on as covered, and the distance scanned since the previous frame
+ * counts as fresh or as revisited depending on whether that cell was covered before the scan entered it.
+ * Summary reports how much of the scanning went to area not seen yet.
+ */
+class ScanState {
+public:
+    ScanState(XY start, XY workspace, double width)
+        : path_(buildScanPath(start, workspace, width)), start_(start), width_(width) {
+        columns_ = static_cast<size_t>(std::ceil((workspace.x - start.x) / width)) + 1;
+        rows_ = static_cast<size_t>(std::floor(workspace.y / width)) + 1;
+        covered_.assign(columns_ * rows_, false);
+    }
+
+    /**
+     * \return true once the last segment of the lap has been scanned
+     */
+    bool Done() const {
+        return next_ >= path_.size();
+    }
+
+    /**
+     * The position to move to next: the point an interrupted segment resumes from, otherwise the end of
+     * the segment in progress. Only call while not Done.
+     */
+    XY Waypoint() const {
+        return resume_ ? *resume_ : path_[next_];
+    }
+
+    /**
+     * Records that the stage reached the Waypoint.
+     */
+    void Reached() {
+        if (resume_) {
+            resume_.reset();
+        }
+        else {
+            ++next_;
+            ++segments_;
+        }
+    }
+
+    /**
+     * Records that the stage left the path, e.g. to center on a detection.
+     * \param position Where the stage stopped on the segment in progress
+     */
+    void Interrupt(XY position) {
+        if (Done())
+            return;
+        // The first waypoint is the start of the path, so there is no segment to resume before reaching it
+        if (next_ > 0)
+            resume_ = position;
+        last_.reset(); // Moves off the path are not scanning
+        cell_ = SIZE_MAX;
+        ++interruptions_;
+    }
+
+    /**
+     * Starts another lap over the whole path, e.g. to search again for a connector missed on the first.
+     * The cells covered so far stay covered, so the lap counts as revisiting them.
+     */
+    void Rewind() {
+        next_ = 0;
+        resume_.reset();
+        last_.reset();
+        cell_ = SIZE_MAX;
+        ++laps_;
+    }
+
+    /**
+     * Marks the camera as centered on a position while scanning, e.g. at the capture time of a frame.
+     */
+    void Observe(XY position) {
+        double distance = last_ ? (position - *last_).magnitude() : 0.0;
+        last_ = position;
+
+        // Frames within one cell count the way the frame entering it did
+        size_t cell = Cell(position);
+        if (cell != cell_) {
+            cell_ = cell;
+            fresh_ = !covered_[cell];
+        }
+
+        if (resume_)
+            resuming_distance_ += distance;
+        else if (fresh_)
+            fresh_distance_ += distance;
+        else
+            revisited_distance_ += distance;
+
+        if (!covered_[cell]) {
+            covered_[cell] = true;
+            ++covered_count_;
+        }
+    }
+
+    /**
+     * Fraction of the workspace cells the camera has been centered on.
+     */
+    double Coverage() const {
+        return covered_.empty() ? 0.0 : double(covered_count_) / covered_.size();
+    }
+
+    /**
+     * Fraction of the distance scanned that went over cells not covered before.
+     */
+    double Efficiency() const {
+        double total = fresh_distance_ + revisited_distance_ + resuming_distance_;
+        return total > 0.0 ? fresh_distance_ / total : 1.0;
+    }
+
+    /**
+     * Segments of the path finished, counting every lap.
+     */
+    size_t SegmentsScanned() const {
+        return segments_;
+    }
+
+    std::string Summary() const {
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(1) << "Scan: " << Coverage() * 100.0 << "% of the workspace covered in "
+               << segments_ << " segments over " << laps_ << (laps_ == 1 ? " lap" : " laps") << ", "
+               << fresh_distance_ + revisited_distance_ + resuming_distance_ << " mm scanned, " << Efficiency() * 100.0
+               << "% fresh (" << revisited_distance_ << " mm revisited, " << resuming_distance_ << " mm resuming), "
+               << interruptions_ << " interruptions";
+        return stream.str();
+    }
+
+private:
+    Path path_;
+    XY start_;
+    double width_;
+    size_t columns_{0};
+    size_t rows_{0};
+
+    size_t next_{0};            // Index of the waypoint ending the segment in progress
+    std::optional<XY> resume_;  // Where the segment in progress was left, until the stage is back there
+    std::optional<XY> last_;    // Position of the previous observation while scanning
+    size_t cell_{SIZE_MAX};     // Cell of the previous observation
+    bool fresh_{false};         // Whether that cell was new when the scan entered it
+
+    std::vector<bool> covered_;
+    size_t covered_count_{0};
+    double fresh_distance_{0.0};     // mm
+    double revisited_distance_{0.0}; // mm
+    double resuming_distance_{0.0};  // mm, moving back to an interrupted segment
+    size_t segments_{0};
+    size_t interruptions_{0};
+    size_t laps_{1};
+
+    size_t Cell(XY position) const {
+        auto index = [](double value, size_t count) {
+            return static_cast<size_t>((std::clamp)(value, 0.0, double(count - 1)));
+        };
+        size_t column = index(std::round((position.x - start_.x) / width_), columns_);
+        size_t row = index(std::floor(position.y / width_), rows_);
+        return row * columns_ + column;
+    }
+};
+
+#endif // SCAN_STATE_H
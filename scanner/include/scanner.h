@@ -11,289 +11,392 @@
 #include <vector>
 #include <list>
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
 
+#include "ResultData.h"
+#include "OutputObserver.h"
+#include "async.h"
 #include "logging.h"
+#include "frame_ring.h"
+#include "recipe_phase.h"
+#include "recipe_manager.h"
+#include "scan_refine.h"
 #include "xy.h"
 
 // Namespaces for using pylon objects
 using namespace Pylon;
 using namespace Pylon::DataProcessing;
 
-typedef std::vector<XY> Path;
-
-Path buildScanPath (XY start, XY max, double width) {
-    Path path {start};
-    int num_passes = std::ceil((max.x - start.x) / width) + 1;
-    for (int i = 0; i < num_passes*2; ++i) {
-        double x_coordinate = (std::min)(width * (i/2) + start.x, max.x);
-        double y_coordinate = max.y * (((i+1)/2) % 2);
-        path.push_back(XY(x_coordinate, y_coordinate));
-    }
-
-    Logger::debug("Scan path:");
-    for (auto& point : path) {
-        Logger::debug(point.toString());
-    }
-    return path;
+/**
+ * Offset from the camera center to a detected object in stage coordinates.
+ * \param point Detected position in m, relative to the image center
+ * \param alignment Sign of the camera axes relative to the stage axes
+ * \return Offset in mm
+ */
+XY CameraOffset(const SPointF2D& point, XY alignment) {
+    return XY(point.X * alignment.x, point.Y * alignment.y) * 1000;
 }
 
-// Should be a singleton
+// One per cell. Owns the camera used by that cell's recipe.
 class PylonRecipe {
 public:
     XY alignment;
+    double frame_latency{0.0}; // s, from exposure until the result is pushed to the observer
 
     PylonRecipe(const Pylon::String_t& recipePath, XY alignment)
-        : resultCollector(), recipe(), alignment(alignment) {
+        : alignment(alignment) {
         Logger::debug("Initializing new pylon recipe");
-        PylonInitialize();  // Before using any pylon methods, the pylon runtime must be initialized.
-        Logger::verbose("Loading recipe");
-
-        recipe.Load(recipePath); // Load the recipe file.
-        Logger::verbose("Allocating resources");
-
-        recipe.PreAllocateResources(); // Now we allocate all resources we need. This includes the camera device if used in the recipe.
-        Logger::verbose("Registering Outputs Observer");
-
-        recipe.RegisterAllOutputsObserver(&resultCollector, RegistrationMode_Append); // This is where the output goes.
-        Logger::verbose("Starting recipe");
-
-        // Start the processing.
-        recipe.Start();
+        Load(recipePath);
+        recipes.Observer().GetFrameRing().SetTag(PhaseName(phase));
         Logger::verbose("Successfully initialized pylon recipe");
     }
 
+    /**
+     * Loads a recipe and switches to it. The path doubles as its name for Use.
+     */
     void Load(const Pylon::String_t& recipePath) {
-        Logger::debug("Initializing new pylon recipe");
-        PylonInitialize();  // Before using any pylon methods, the pylon runtime must be initialized.
-        
-        Logger::verbose("Loading recipe");
-        recipe.Load(recipePath); // Load the recipe file.
-        
-        Logger::verbose("Allocating resources");
-        recipe.PreAllocateResources(); // Now we allocate all resources we need. This includes the camera device if used in the recipe.
-        
-        Logger::verbose("Registering Outputs Observer");
-        recipe.RegisterAllOutputsObserver(&resultCollector, RegistrationMode_Append); // This is where the output goes.
-        
-        Logger::verbose("Starting recipe");
-        recipe.Start();
+        std::string name(recipePath.c_str());
+        recipes.Preload(name, recipePath);
+        Use(name);
     }
 
-    bool Detect(ResultData& result) {
-        if (!resultCollector.GetWaitObject().Wait(100)) {// Blocks until image received, wait is ms
-            Logger::error("Scanner::detectObject: Camera data result timeout");
-            return false;
-        }
-
-        resultCollector.GetResultData(result);
+    /**
+     * Loads an additional recipe, e.g. for another connector family, and keeps it ready to switch to.
+     */
+    void Preload(const std::string& name, const Pylon::String_t& recipePath) {
+        recipes.Preload(name, recipePath);
+    }
 
-        if (result.hasError) {
-            std::cout << "Scanner::detectObject: An error occurred while processing recipe: " << result.errorMessage << std::endl; // Todo: Make this work with Logger
-            return false;
-        }
+    /**
+     * Switches to a preloaded recipe. It stays active in phases that do not name a recipe of their own.
+     */
+    void Use(const std::string& name) {
+        recipes.Activate(name);
+        default_recipe = name;
+    }
 
-        if (result.mobile_score.empty() && result.fixed_score.empty()) {
-            Logger::verbose("Scanner::detectObject: No object detected...");
-            return false;
-        }
-        
-        Logger::info(
-            !result.mobile_score.empty() ? "mobile connector detected!\n" : "" + 
-            !result.fixed_score.empty() ? "fixed connector detected!" : ""
-        );
+    /**
+     * Waits for a result the caller has not seen yet.
+     * \return true if the result holds detections
+     */
+    bool Detect(ResultData& result) {
+        return Detect(result, last_frame.sequence, std::chrono::steady_clock::time_point());
+    }
 
-        return true;
+    /**
+     * Waits for a result newer than a given frame, e.g. one from LastFrame().
+     */
+    bool DetectNewer(uint64_t sequence, ResultData& result) {
+        return Detect(result, sequence, std::chrono::steady_clock::time_point());
     }
 
-    void Stop() {
-        Logger::verbose("Stopping recipe.");
-        recipe.Stop(); // Stop the image processing.
-        Logger::verbose("Releasing pylon resources.");
-        PylonTerminate(); // Releases all pylon resources
-        Logger::debug("Recipe stopped. All pylon resources released.");
+    /**
+     * Waits for a result pushed at or after a given time, e.g. the first frame after motion stopped.
+     * Older results are skipped.
+     */
+    bool DetectAfter(std::chrono::steady_clock::time_point after, ResultData& result) {
+        return Detect(result, last_frame.sequence, after);
     }
 
-private:
-    RecipeOutputObserver resultCollector;
-    CRecipe recipe;
-};
+    /**
+     * Coroutine version of Detect. Suspends on the event loop instead of blocking the thread.
+     */
+    Async::Task<bool> NextDetection(ResultData& result) {
+        return DetectAsync(result, last_frame.sequence, std::chrono::steady_clock::time_point());
+    }
 
-std::pair<bool, bool> ScanForMobile (PylonRecipe& recipe, Path& path, int speed, XY& fixed_position) {
-    // Begin scan
-    Logger::debug("Entering mobile scan Loop");
+    /**
+     * Coroutine version of DetectNewer.
+     */
+    Async::Task<bool> DetectionNewerThan(uint64_t sequence, ResultData& result) {
+        return DetectAsync(result, sequence, std::chrono::steady_clock::time_point());
+    }
 
-    // Check if mobile connector is already in frame
-    ResultData res;
-    if (recipe.Detect(res) && !res.mobile_score.empty()) {
-        return {true, false};
+    /**
+     * Coroutine version of DetectAfter.
+     */
+    Async::Task<bool> DetectionAfter(std::chrono::steady_clock::time_point after, ResultData& result) {
+        return DetectAsync(result, last_frame.sequence, after);
     }
 
-    Path path_copy = path;
-    bool fixed_detected = false;
-    double fixed_error = (std::numeric_limits<double>::max)();
+    /**
+     * Waits for a result the caller has not seen yet and converts its detections to offsets in stage
+     * coordinates, for the loops in scan_refine.h.
+     * \return false on a timeout or a failed result
+     */
+    Async::Task<bool> NextFrame(CameraFrame& frame) {
+        return FrameAsync(frame, last_frame.sequence, std::chrono::steady_clock::time_point());
+    }
 
-    for (size_t i = 0; i < path_copy.size(); ++i) {
-        SEL_Interface::MoveToPosition(path_copy[i], speed);
-        commander->UpdateSEL();
+    /**
+     * Like NextFrame, skipping results pushed before a given time.
+     */
+    Async::Task<bool> FrameAfter(std::chrono::steady_clock::time_point after, CameraFrame& frame) {
+        return FrameAsync(frame, last_frame.sequence, after);
+    }
 
-        while(commander->in_motion) { // Continously get camera data and check if move has completed
-            // Get camera data
-            ResultData result;
-            if (!recipe.Detect(result)) {
-                commander->UpdateSEL();
-                continue;
-            }
+    /**
+     * Sequence number and time of the last result returned by Detect.
+     */
+    const FrameInfo& LastFrame() const {
+        return last_frame;
+    }
 
-            // If mobile connector seen
-            if (!result.mobile_score.empty()) {
-                SEL_Interface::HaltAll();
+    /**
+     * Estimated time the last result returned by Detect was exposed.
+     */
+    std::chrono::steady_clock::time_point CaptureTime() const {
+        return last_frame.timestamp - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                          std::chrono::duration<double>(frame_latency));
+    }
 
-                commander->waitForXYMotionComplete();
+    /**
+     * Sets the recipe parameters applied when a phase is entered. Changed settings of the active phase are
+     * applied by the next SetPhase to it.
+     */
+    void SetPhaseSettings(RecipePhase phase, const PhaseSettings& settings) {
+        auto& current = phase_settings[static_cast<size_t>(phase)];
+        if (current.recipe == settings.recipe && current.parameters == settings.parameters)
+            return;
+        current = settings;
+        phase_applied[static_cast<size_t>(phase)] = false;
+    }
 
-                ResultData new_result;
-                if (recipe.Detect(new_result) && !new_result.mobile_score.empty()) {
-                    return {true, fixed_detected};
+    /**
+     * Switches the recipe to the settings of a phase, first switching to the phase's recipe if it names one.
+     * Parameters that can be written while the recipe runs (e.g. exposure) are changed on the fly. If any
+     * parameter is locked while grabbing (e.g. ROI or binning) the processing is stopped and restarted around
+     * the change; the recipe stays loaded and its resources stay allocated.
+     */
+    void SetPhase(RecipePhase new_phase) {
+        if (new_phase == phase && phase_applied[static_cast<size_t>(new_phase)])
+            return;
+
+        auto now = Time::Clock::now();
+        phase_stats[static_cast<size_t>(phase)].active_time += std::chrono::duration<double>(now - phase_start).count();
+
+        auto& settings = phase_settings[static_cast<size_t>(new_phase)];
+        recipes.Activate(settings.recipe.empty() ? default_recipe : settings.recipe);
+        auto& recipe = recipes.Active();
+
+        std::vector<std::pair<std::string, std::string>> locked;
+        for (auto& [name, value] : settings.parameters) {
+            try {
+                CParameter parameter(recipe.GetParameters(), name.c_str());
+                if (!parameter.IsValid()) {
+                    Logger::warn("PylonRecipe::SetPhase: Recipe has no parameter " + name);
+                    continue;
                 }
-
-                SEL_Interface::MoveToPosition(path_copy[(std::max)(i-1, size_t(0))], (std::max)(int(speed/2), 1));
-                commander->UpdateSEL();
-                continue;
+                if (!parameter.IsWritable()) {
+                    locked.emplace_back(name, value);
+                    continue;
+                }
+                parameter.FromString(value.c_str());
             }
+            catch (const GenericException& e) {
+                Logger::warn("PylonRecipe::SetPhase: Could not set " + name + " to " + value + ": " + e.GetDescription());
+            }
+        }
 
-            // if fixed connector seen
-            if (!result.fixed_score.empty()) {
-                commander->UpdateSEL();
-                fixed_detected = true;
-                double error = std::sqrt(std::pow(result.fixed_position[0].X, 2) + std::pow(result.fixed_position[0].Y, 2));
-                if ( error < fixed_error) {
-                    fixed_error = error;
-                    fixed_position = commander->position;
+        if (!locked.empty()) {
+            Logger::debug("PylonRecipe::SetPhase: Restarting processing to change " + std::to_string(locked.size()) + " locked parameters");
+            recipe.Stop();
+            for (auto& [name, value] : locked) {
+                try {
+                    CParameter(recipe.GetParameters(), name.c_str()).FromString(value.c_str());
+                }
+                catch (const GenericException& e) {
+                    Logger::warn("PylonRecipe::SetPhase: Could not set " + name + " to " + value + ": " + e.GetDescription());
                 }
-                continue;
             }
-
-            // This should never be reached but if you somehow end up here, update the commander for good measure
-            commander->UpdateSEL();
+            recipe.Start();
         }
-        path.erase(path.begin());
+
+        // Results still queued were produced with the old settings
+        recipes.Observer().ClearOutputData();
+
+        phase = new_phase;
+        phase_applied.fill(false);
+        phase_applied[static_cast<size_t>(phase)] = true;
+        recipes.Observer().GetFrameRing().SetTag(PhaseName(phase));
+        phase_start = Time::Clock::now();
+        phase_stats[static_cast<size_t>(phase)].switch_time += std::chrono::duration<double>(phase_start - now).count();
+        Logger::debug(std::string("PylonRecipe::SetPhase: Entered ") + PhaseName(phase) + " phase in " +
+                      std::to_string(std::chrono::duration<double, std::milli>(phase_start - now).count()) + " ms");
     }
 
-    return {false, fixed_detected};
-}
+    /**
+     * Logs frame rate and detection latency of each phase since the recipe was started.
+     */
+    void ReportPhaseStats() {
+        auto now = Time::Clock::now();
+        phase_stats[static_cast<size_t>(phase)].active_time += std::chrono::duration<double>(now - phase_start).count();
+        phase_start = now;
+
+        for (auto current : {RecipePhase::SCAN, RecipePhase::REFINE}) {
+            auto& stats = phase_stats[static_cast<size_t>(current)];
+            Logger::info(std::string("Recipe ") + PhaseName(current) + " phase: " + std::to_string(stats.frames) + " frames, " +
+                         std::to_string(stats.FrameRate()) + " fps, mean wait " + std::to_string(stats.MeanLatency() * 1000.0) +
+                         " ms, " + std::to_string(stats.timeouts) + " timeouts, switching " +
+                         std::to_string(stats.switch_time * 1000.0) + " ms");
+        }
 
-bool ScanForFixed (PylonRecipe& recipe, Path path, int speed) {
-    // Begin scan
-    Logger::debug("Entering fixed scan Loop");
-    
-    // Check if fixed connector is already in frame
-    ResultData res;
-    if (recipe.Detect(res) && !res.fixed_score.empty()) {
-        return true;
+        auto& mailbox = recipes.Observer().GetMailbox();
+        Logger::info("Recipe frames: " + std::to_string(mailbox.LatestSequence()) + " pushed, " +
+                     std::to_string(mailbox.Overwritten()) + " overwritten before read, " +
+                     std::to_string(mailbox.Stale()) + " skipped as stale");
+        Logger::info("Recipe result wake latency: " + mailbox.WakeLatency().Summary());
     }
 
-    for (size_t i = 0; i < path.size(); ++i) {
-        SEL_Interface::MoveToPosition(path[i], speed);
-        commander->UpdateSEL();
-
-        while(commander->in_motion) { // Continously get camera data and check if move has completed
-            // Get camera data
-            ResultData result;
-            if (!recipe.Detect(result)) {
-                commander->UpdateSEL();
-                continue;
-            }
+    void ReportLatency() const {
+        recipes.ReportLatency();
+    }
 
-            // If fixed connector seen
-            if (!result.fixed_score.empty()) {
-                SEL_Interface::HaltAll();
+    /**
+     * Keeps the last results pushed by the recipe for DumpFrames, with their images if the recipe has an
+     * output named image.
+     * \param frames Results kept. 0 keeps none.
+     * \param directory Directory the dumps are written below
+     */
+    void RetainFrames(size_t frames, const std::string& directory) {
+        recipes.Observer().GetFrameRing().Resize(frames);
+        dump_directory = directory;
+    }
 
-                commander->waitForXYMotionComplete();
+    /**
+     * Writes the retained results to a new directory below the dump directory. The writing happens on a
+     * thread of its own, so this returns as soon as the results are copied.
+     * \param reason Ends the directory name, e.g. failed
+     * \return The directory the results go to, empty if none were retained
+     */
+    std::filesystem::path DumpFrames(const std::string& reason) {
+        auto frames = recipes.Observer().GetFrameRing().Snapshot();
+        if (frames.empty())
+            return {};
+        if (!dumper)
+            dumper = std::make_unique<FrameDumper<ResultData>>(WriteFrame, ",mobile,fixed,error,image");
+        size_t count = frames.size();
+        auto directory = dumper->Dump(std::move(frames), dump_directory, reason);
+        Logger::info("PylonRecipe::DumpFrames: Writing the last " + std::to_string(count) + " results to " + directory.string());
+        return directory;
+    }
 
-                ResultData new_result;
-                if (recipe.Detect(new_result) && !new_result.fixed_score.empty()) {
-                    return true;
-                }
+    void Stop() {
+        Logger::verbose("Stopping recipes and releasing pylon resources.");
+        dumper.reset(); // Finishes the dumps in progress while their images are still valid
+        recipes.Shutdown();
+        Logger::debug("Recipe stopped. All pylon resources released.");
+    }
 
-                SEL_Interface::MoveToPosition(path[(std::max)(i-1, size_t(0))], (std::max)(int(speed/2), 1));
-                commander->UpdateSEL();
-                continue;
+private:
+    static constexpr std::chrono::milliseconds RESULT_TIMEOUT{100};
+
+    // Declared before the recipes so it outlives their output observer
+    std::unique_ptr<Async::MailboxWaiter<ResultData>> waiter;
+    RecipeManager recipes;
+    std::string default_recipe;
+    FrameInfo last_frame;
+    ResultData frame_result; // Decoded into by NextFrame and FrameAfter, keeping the storage of its arrays
+    std::unique_ptr<FrameDumper<ResultData>> dumper; // Started by the first dump
+    std::string dump_directory{"frame_dumps"};
+
+    // Writes the detections of a retained result to its index line, as score:x:y in m per detection, and
+    // its image, if any, to a PNG file
+    static void WriteFrame(const FrameRing<ResultData>::Entry& frame, const std::filesystem::path& directory, std::ostream& index) {
+        auto& result = frame.value;
+        auto detections = [&](const std::vector<double>& scores, const std::vector<SPointF2D>& positions) {
+            index << ",";
+            for (size_t i = 0; i < (std::min)(scores.size(), positions.size()); ++i) {
+                index << (i ? " " : "") << scores[i] << ":" << positions[i].X << ":" << positions[i].Y;
             }
-
-            commander->UpdateSEL();
+        };
+        detections(result.mobile_score, result.mobile_position);
+        detections(result.fixed_score, result.fixed_position);
+
+        std::string error = result.hasError ? std::string(result.errorMessage.c_str()) : "";
+        std::replace(error.begin(), error.end(), '"', '\'');
+        index << ",\"" << error << "\",";
+
+        if (result.image.IsValid()) {
+            std::string name = "frame_" + std::to_string(frame.info.sequence) + ".png";
+            CImagePersistence::Save(ImageFileFormat_Png, (directory / name).string().c_str(), result.image);
+            index << name;
         }
     }
 
-    return false;
-}
-
-bool RefineToMobile(PylonRecipe& recipe, int speed, double tolerance, double scale_factor, XY alignment) {
-    Logger::debug("Entering mobile refinement loop...");
-    int detection_errors = 0;
-    while (detection_errors <= 10) {
-        ResultData result;
-        if(!recipe.Detect(result)) {
-            Logger::error("No mobile connector detected in refinement loop!");
-            ++detection_errors;
-            continue;
-        }
-
-        detection_errors = 0;
-
-        if (!result.mobile_score.empty()) {
-            commander->UpdateSEL();
-            auto error = XY(result.mobile_position[0].X * alignment.x, result.mobile_position[0].Y * alignment.y) * 1000;
+    bool Detect(ResultData& result, uint64_t after_sequence, std::chrono::steady_clock::time_point after_time) {
+        auto wait_start = Time::Clock::now();
+        bool received = recipes.Observer().WaitForResult(result, last_frame, after_sequence, after_time, RESULT_TIMEOUT);
+        return Accept(result, received, wait_start);
+    }
 
-            Logger::info("Current Position: " + commander->position.toString());
-            Logger::info("Detected Error: " + error.toString());
+    Async::Task<bool> DetectAsync(ResultData& result, uint64_t after_sequence, std::chrono::steady_clock::time_point after_time) {
+        if (!waiter)
+            waiter = std::make_unique<Async::MailboxWaiter<ResultData>>(recipes.Observer().GetMailbox());
+        auto wait_start = Time::Clock::now();
+        bool received = co_await waiter->WaitFor(result, last_frame, after_sequence, after_time, RESULT_TIMEOUT);
+        co_return Accept(result, received, wait_start);
+    }
 
-            if (error.magnitude() < tolerance) {
-                Logger::info("Success! Total error " + std::to_string(error.magnitude()));
-                return true;
+    Async::Task<bool> FrameAsync(CameraFrame& frame, uint64_t after_sequence, std::chrono::steady_clock::time_point after_time) {
+        if (!waiter)
+            waiter = std::make_unique<Async::MailboxWaiter<ResultData>>(recipes.Observer().GetMailbox());
+        auto wait_start = Time::Clock::now();
+        bool received = co_await waiter->WaitFor(frame_result, last_frame, after_sequence, after_time, RESULT_TIMEOUT);
+        Accept(frame_result, received, wait_start);
+        if (!received || frame_result.hasError)
+            co_return false;
+
+        auto offsets = [&](const std::vector<double>& scores, const std::vector<SPointF2D>& positions, std::vector<OffsetSample>& samples) {
+            samples.clear();
+            for (size_t i = 0; i < (std::min)(scores.size(), positions.size()); ++i) {
+                samples.push_back({CameraOffset(positions[i], alignment), scores[i]});
             }
-
-            XY target_position = commander->position - (error * scale_factor);
-            Logger::info("Target position: " + target_position.toString());
-            SEL_Interface::MoveToPosition(target_position, speed);
-            commander->waitForXYMotionComplete();
-        }
+        };
+        offsets(frame_result.mobile_score, frame_result.mobile_position, frame.mobile);
+        offsets(frame_result.fixed_score, frame_result.fixed_position, frame.fixed);
+        frame.capture_time = CaptureTime();
+        co_return true;
     }
 
-    return false;
-}
+    // Updates the phase statistics for a result, or for a timeout if none was received
+    bool Accept(ResultData& result, bool received, std::chrono::steady_clock::time_point wait_start) {
+        auto& stats = phase_stats[static_cast<size_t>(phase)];
 
-bool RefineToFixed(PylonRecipe& recipe, int speed, double tolerance, double scale_factor, XY alignment) {
-    Logger::debug("Entering fixed refinement loop...");
-    int detection_errors = 0;
-    while (detection_errors <= 10) {
-        ResultData result;
-        if(!recipe.Detect(result)) {
-            Logger::error("No fixed connector detected in refinement loop! (" + std::to_string(detection_errors) + ")" );
-            ++detection_errors;
-            continue;
+        if (!received) {
+            ++stats.timeouts;
+            Logger::error("Scanner::detectObject: Camera data result timeout");
+            return false;
         }
 
-        detection_errors = 0;
-
-        if (!result.fixed_score.empty()) {
-            commander->UpdateSEL();
-            auto error = XY(result.fixed_position[0].X * alignment.x, result.fixed_position[0].Y * alignment.y) * 1000;
+        stats.wait_time += std::chrono::duration<double>(Time::Clock::now() - wait_start).count();
+        ++stats.frames;
 
-            Logger::info("Current Position: " + commander->position.toString());
-            Logger::info("Detected Error: " + error.toString());
-
-            if (error.magnitude() < tolerance) {
-                Logger::info("Success! Total error " + std::to_string(error.magnitude()));
-                return true;
-            }
+        if (result.hasError) {
+            std::cout << "Scanner::detectObject: An error occurred while processing recipe: " << result.errorMessage << std::endl; // Todo: Make this work with Logger
+            return false;
+        }
 
-            XY target_position = commander->position - error  * scale_factor;
-            Logger::info("Target position: " + target_position.toString());
-            SEL_Interface::MoveToPosition(target_position, speed);
-            commander->waitForXYMotionComplete();
+        if (result.mobile_score.empty() && result.fixed_score.empty()) {
+            Logger::verbose("Scanner::detectObject: No object detected...");
+            return false;
         }
+        
+        Logger::info(
+            !result.mobile_score.empty() ? "mobile connector detected!\n" : "" + 
+            !result.fixed_score.empty() ? "fixed connector detected!" : ""
+        );
+
+        return true;
     }
 
-    return false;
-}
+    RecipePhase phase{RecipePhase::SCAN};
+    std::chrono::steady_clock::time_point phase_start{Time::Clock::now()};
+    std::array<PhaseSettings, 2> phase_settings;
+    std::array<bool, 2> phase_applied{};     // Whether the recipe runs with a phase's settings, none at first
+    std::array<PhaseStats, 2> phase_stats;
+};
 
 #endif // SCANNER_H
\ No newline at end of file
@@ -1,13 +1,18 @@
 #ifndef SEL_INTERFACE_H
 #define SEL_INTERFACE_H
 
+#include "alloc_stats.h"
 #include "simple_serial.h"
 #include "xy.h"
 #include <sstream>
 #include <iomanip>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 
+// Every command takes the serial link of the SEL controller it is sent to as its first argument.
 namespace SEL_Interface
 {
     enum class Axis {
@@ -53,6 +58,131 @@ namespace SEL_Interface
         return result;
     }
 
+            /******************************************************
+             ***                   Transport                    ***
+             ******************************************************/
+
+    static const std::chrono::milliseconds reply_timeout(500); // Longest wait for a reply, including its transmit time
+    static const int max_attempts = 3; // Tries of an inquiry before giving up
+
+    /**
+     * A command got no valid reply, even after the link was resynchronized.
+     * Commands that change the controller state are not sent again, since the lost reply may belong to a
+     * command that did execute. The caller has to find out, e.g. by reading the status.
+     */
+    class LinkError : public std::runtime_error {
+    public:
+        LinkError(const std::string& what, std::string command)
+            : std::runtime_error(what), command(std::move(command)) {}
+
+        std::string command; // The command as written, without its terminator
+    };
+
+    /**
+     * \return true if reply is a complete reply of the controller to cmd
+     */
+    inline bool AnswersCommand(const std::string& cmd, const std::string& reply) {
+        return reply.size() >= 8 && reply.compare(0, 3, "#99") == 0 && reply.compare(3, 3, cmd, 3, 3) == 0 &&
+               reply.compare(reply.size() - 2, 2, "@@") == 0;
+    }
+
+    /**
+     * Realigns replies with commands after a fault. Discards the rest of the broken frame, then sends a
+     * communication test with a unique text and discards every line up to its echo. The controller answers
+     * in order, so a late reply to an earlier command cannot be taken for the reply to the next one.
+     * \param mid_frame true if the last reply timed out, so its rest may still arrive
+     * \return false if the echo did not come back
+     */
+    inline bool Resync(SimpleSerial& sel, bool mid_frame = false) {
+        static std::atomic<int> marker{0};
+        sel.discardThrough(term, mid_frame, reply_timeout, std::chrono::milliseconds(50));
+
+        std::string text = "SYNC" + format<int>(++marker % 100000, 5);
+        std::string echo = "#99TST" + text + "@@";
+        sel.writeString(inq + "TST" + text + term);
+
+        auto deadline = std::chrono::steady_clock::now() + reply_timeout;
+        std::string line;
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0 || !sel.readLine(line, remaining))
+                return false;
+            // A truncated frame may still precede the echo on the same line
+            if (line.size() >= echo.size() && line.compare(line.size() - echo.size(), echo.size(), echo) == 0)
+                return true;
+        }
+    }
+
+    /**
+     * Writes a command and reads its reply without ever blocking indefinitely.
+     * After a timeout or a garbled reply the link is resynchronized, reopening the port if that fails or the
+     * port itself failed. Inquiries are then sent again. Commands that change the controller state are not.
+     * \param idempotent true if sending cmd twice has the same effect as sending it once
+     * \param valid Additional check of the reply, e.g. its length
+     * \throws LinkError if no valid reply was received
+     */
+    template <typename Validate>
+    std::string Exchange(SimpleSerial& sel, const std::string& cmd, bool idempotent, Validate valid) {
+        auto& faults = sel.faults();
+        std::string name = cmd.substr(0, cmd.size() - term.size());
+        std::chrono::steady_clock::time_point first_fault;
+
+        for (int attempt = 1; ; ++attempt) {
+            std::string problem;
+            bool port_failed = false;
+            bool timed_out = false;
+            try {
+                sel.writeString(cmd);
+                std::string resp;
+                if (!sel.readLine(resp, reply_timeout)) {
+                    ++faults.timeouts;
+                    timed_out = true;
+                    problem = "no reply within " + std::to_string(reply_timeout.count()) + " ms";
+                }
+                else if (!AnswersCommand(cmd, resp) || !valid(resp)) {
+                    ++faults.malformed;
+                    problem = "invalid reply '" + resp + "'";
+                }
+                else {
+                    if (attempt > 1)
+                        faults.Recovered(std::chrono::steady_clock::now() - first_fault);
+                    return resp;
+                }
+            }
+            catch (const boost::system::system_error& e) {
+                ++faults.port_errors;
+                port_failed = true;
+                problem = std::string("port error: ") + e.what();
+            }
+
+            if (attempt == 1)
+                first_fault = std::chrono::steady_clock::now();
+            Logger::warn("SEL_Interface::Exchange: " + name + " on " + sel.portName() + ": " + problem);
+
+            try {
+                if (port_failed || !Resync(sel, timed_out)) {
+                    sel.reopen();
+                    Resync(sel);
+                }
+            }
+            catch (const boost::system::system_error& e) {
+                ++faults.port_errors;
+                Logger::error("SEL_Interface::Exchange: Could not recover " + sel.portName() + ": " + e.what());
+            }
+
+            if (!idempotent || attempt >= max_attempts) {
+                ++faults.unrecovered;
+                throw LinkError("SEL_Interface: " + name + " on " + sel.portName() + " failed: " + problem +
+                                (idempotent ? "" : ". Not resent since it may have executed."), name);
+            }
+            ++faults.retries;
+        }
+    }
+
+    inline std::string Exchange(SimpleSerial& sel, const std::string& cmd, bool idempotent) {
+        return Exchange(sel, cmd, idempotent, [](const std::string&) { return true; });
+    }
+
             /******************************************************
              ***                Inquiry Commands                ***
              ******************************************************/
@@ -63,16 +193,66 @@ namespace SEL_Interface
      * Example command: ?99TST0123456789@@
      * Example response: #99TST0123456789@@
      */
-    std::string Test(const std::string& text) {
+    std::string Test(SimpleSerial& sel, const std::string& text) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "TST");
         if (text.length() > 10) {
             Logger::error("SEL_Interface::Test: Max text length is 10 characters");
             return "";
         }
         std::string code = "TST";
         std::string cmd = inq + code + text + term;
-        SEL->writeString(cmd);
-        std::string resp = SEL->readLine();
-        return resp;
+        return Exchange(sel, cmd, true, [&](const std::string& resp) { return resp == "#99" + code + text + "@@"; });
+    }
+
+    /**
+     * Finds the highest baud rate the controller answers reliably and leaves the port at that rate.
+     * The protocol has no command to change the controller's own rate, so the port steps through the
+     * candidates while the controller stays at the rate set in its parameters. A rate passes once every
+     * communication test echoes correctly within the timeout.
+     * \param candidates Rates to try. The highest are tried first.
+     * \param attempts Communication tests that must all pass at a rate
+     * \param timeout Longest wait for each echo
+     * \return The rate the port was left at. The original rate if no candidate passed.
+     */
+    uint32_t ProbeBaudRate(SimpleSerial& sel, std::vector<uint32_t> candidates = {230400, 115200, 57600, 38400, 19200, 9600},
+                           int attempts = 3, std::chrono::milliseconds timeout = std::chrono::milliseconds(100)) {
+        uint32_t original = sel.baudRate();
+        std::sort(candidates.begin(), candidates.end(), std::greater<uint32_t>());
+
+        for (uint32_t rate : candidates) {
+            try {
+                sel.setBaudRate(rate);
+            }
+            catch (const std::exception& e) {
+                Logger::verbose("SEL_Interface::ProbeBaudRate: Port rejected " + std::to_string(rate) + " baud: " + e.what());
+                continue;
+            }
+            sel.writeString(term); // Ends anything the controller received at the previous rate
+            sel.discardInput(std::chrono::milliseconds(50)); // Including its reply to that
+
+            int passed = 0;
+            for (int i = 0; i < attempts; ++i) {
+                std::string text = "PROBE" + format<int>(i, 5);
+                sel.writeString(inq + "TST" + text + term);
+                std::string resp;
+                if (!sel.readLine(resp, timeout) || resp != "#99TST" + text + "@@")
+                    break;
+                ++passed;
+            }
+
+            if (passed == attempts) {
+                Logger::info("SEL_Interface::ProbeBaudRate: " + sel.portName() + " answers at " + std::to_string(rate) + " baud");
+                return rate;
+            }
+            Logger::verbose("SEL_Interface::ProbeBaudRate: " + std::to_string(passed) + " of " + std::to_string(attempts) +
+                            " tests passed at " + std::to_string(rate) + " baud");
+        }
+
+        Logger::warn("SEL_Interface::ProbeBaudRate: No candidate rate answered on " + sel.portName() + ". Keeping " +
+                     std::to_string(original) + " baud.");
+        sel.setBaudRate(original);
+        sel.discardInput(std::chrono::milliseconds(20));
+        return original;
     }
 
     /**
@@ -80,12 +260,14 @@ namespace SEL_Interface
      * Example command: ?99STA@@
      * Example response: #99STA200000150.000 00000150.000 @@
     */
-    std::string AxisInquiry() {
+    std::string AxisInquiry(SimpleSerial& sel) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "STA");
         std::string code = "STA";
         std::string cmd = inq + code + term;
-        SEL->writeString(cmd);
-        std::string resp = SEL->readLine();
-        return resp;
+        // Axis count, then per axis enabled, homed, in motion, two error digits and a 9 character position
+        return Exchange(sel, cmd, true, [](const std::string& resp) {
+            return resp.size() >= 9 && resp[6] >= '1' && resp[6] <= '9' && resp.size() >= 7u + 14u * (resp[6] - '0') + 2u;
+        });
     }
 
     /**
@@ -93,12 +275,11 @@ namespace SEL_Interface
      * Example command: ?99INP@@
      * Reponse: #99INPC40000FFF... (66 F's) @@
     */
-    std::string ReadInputs() {
+    std::string ReadInputs(SimpleSerial& sel) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "INP");
         std::string code = "INP";
         std::string cmd = inq + code + term;
-        SEL->writeString(cmd);
-        std::string resp = SEL->readLine();
-        return resp;
+        return Exchange(sel, cmd, true, [](const std::string& resp) { return resp.size() >= 12; });
     }
 
 
@@ -113,26 +294,25 @@ namespace SEL_Interface
      * Example command: !99HOM0300@@
      * Example response: #99HOM@@
      */
-    std::string Home(Axis axis) {
+    std::string Home(SimpleSerial& sel, Axis axis) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "HOM");
         std::string code = "HOM";
         std::string axis_pattern_string = format<int>(static_cast<int>(axis), 2, 0);
         std::string cmd = exec + code + axis_pattern_string + "00" + term;
-        SEL->writeString(cmd);
-        std::string resp = SEL->readLine();
-        return resp;
+        return Exchange(sel, cmd, false);
     }
 
     /**
      * Moves actuators to designated position.
      * \param position 2D point to move to. Coordinates are in mm. Both coordinates must be positive.
+     * \param travel Largest position each axis may be sent to, in mm
+     * \throws LinkError if the reply was lost. The move may have started, so it is not sent again.
      * Example command: !99 MOV 03 0000 0200 00050.00 00075.00 @@
      * Example response: #99MOV@@
      */
-    std::string MoveToPosition(XY position, unsigned int velocity = 50, double acceleration = 0.0) {
-        auto workspace_min = XY(0, 0);
-        auto workspace_max = XY(400, 600);
-
-        if (!position.inBounds(workspace_min, workspace_max))
+    std::string MoveToPosition(SimpleSerial& sel, XY position, XY travel, unsigned int velocity = 50, double acceleration = 0.0) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "MOV");
+        if (!position.inBounds(XY(0, 0), travel))
         {
             std::string err = "Requested position " + position.toString() + " is out of bounds.";
             Logger::error(err);
@@ -163,37 +343,44 @@ namespace SEL_Interface
         }
 
         cmd += term;
-        SEL->writeString(cmd);
-        std::string resp = SEL->readLine();
-        return resp;
+        return Exchange(sel, cmd, false, [](const std::string& resp) { return resp == "#99MOV@@"; });
     }
 
     /**
-     * Slows the axis to a stop specified by the axis pattern.
+     * Slows the axis to a stop specified by the axis pattern. Sent again if the reply is lost, since halting
+     * twice is harmless.
      * Note: Do not use the Halt protocol command during homing.
      * \param axis Axis or axes to halt
      * Example command: !99HLT03@@
      * Example response:  #99HLT@@
      */
-    std::string Halt(Axis axis) {
+    std::string Halt(SimpleSerial& sel, Axis axis) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "HLT");
         std::string code = "HLT";
         std::string axis_pattern_string = format<int>(static_cast<int>(axis), 2, 0);
         std::string cmd = exec + code + axis_pattern_string + term;
-        SEL->writeString(cmd);
-        std::string resp = SEL->readLine();
-        if (resp !=  "#99HLT@@") {
-            Logger::warn("SEL_Interface::Halt: Expected response #99HLT@@, recieved " + resp);
-        }
-        return resp;
+        return Exchange(sel, cmd, true, [](const std::string& resp) { return resp == "#99HLT@@"; });
     }
 
 
+    /**
+     * Writes a halt command without reading the reply, for use while another thread may be waiting for the
+     * reply to its own command on the same link. That thread's next readLine skips the halt reply.
+     * \return The command as written
+     */
+    std::string SendHalt(SimpleSerial& sel, Axis axis = Axis::XY) {
+        std::string cmd = exec + "HLT" + format<int>(static_cast<int>(axis), 2, 0) + term;
+        sel.expectUnsolicited("#99HLT@@");
+        sel.writeFromOtherThread(cmd);
+        return cmd;
+    }
+
     /**
      * Stops X and Y axes.
     */
-    void HaltAll() {
+    void HaltAll(SimpleSerial& sel) {
         Logger::verbose("SEL_Interface::HaltAll: Halting all axes");
-        Halt(Axis::XY);
+        Halt(sel, Axis::XY);
     }
 
     /**
@@ -205,23 +392,20 @@ namespace SEL_Interface
      * Example command: !99JOG030.3000501@@
      * Example response: #99JOG@@
     */
-    std::string Jog(Axis axis, Direction direction, uint16_t velocity = 50, double acceleration = 0.3) {
+    std::string Jog(SimpleSerial& sel, Axis axis, Direction direction, uint16_t velocity = 50, double acceleration = 0.3) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "JOG");
         std::string code = "JOG";
         std::string axis_pattern = format<int>(static_cast<int>(axis), 2, 0);
         std::string acceleration_string = format<double>(acceleration, 4, 2);
         std::string velocity_string = format<int16_t>(std::abs(velocity), 4, 0);
         std::string direction_string = std::to_string(direction);
         std::string cmd = exec + code + axis_pattern + acceleration_string + velocity_string + direction_string + term;
-        SEL->writeString(cmd);
-        std::string resp = SEL->readLine();
-        if (resp !=  "#99JOG@@") {
-            Logger::warn("SEL_Interface::Halt: Received unexpected response `" + resp + "` to command `" + cmd + "`");
-        }
-        return resp;
+        return Exchange(sel, cmd, false, [](const std::string& resp) { return resp == "#99JOG@@"; });
     }
 
     // TODO: Make this use uints where appropriate
-    void SetOutputs(std::vector<int> ports, std::vector<bool> values, std::vector<bool>& SEL_outputs) {
+    void SetOutputs(SimpleSerial& sel, std::vector<int> ports, std::vector<bool> values, std::vector<bool>& SEL_outputs) {
+        AllocStats::Scope stats(AllocStats::Kind::COMMAND, "OTS");
         Logger::verbose("Setting SEL outputs");
         if (ports.size() != values.size() ) {
             throw std::runtime_error("SEL_Interface::SetOutputs: ports and values must have the same number of elements");
@@ -275,12 +459,8 @@ namespace SEL_Interface
 
             std::string cmd = exec + code + group_string + group_values_string + term;
 
-            SEL->writeString(cmd);
-            std::string resp = SEL->readLine();
-            if (resp != "#99OTS@@") {
-                Logger::warn("SEL_Interface::SetOutputs: Received unexpected response `" + resp +
-                                         "` to command `" + cmd + "`");
-            }
+            // Not resent: the start output pulses the RC controller, which would run the move twice
+            Exchange(sel, cmd, false, [](const std::string& resp) { return resp == "#99OTS@@"; });
         }
     }
 };
@@ -1,18 +1,22 @@
 #ifndef SIGNAL_HANDLER_H
 #define SIGNAL_HANDLER_H
 
-#include <iostream>
 #include <csignal>
-#include "simple_serial.h" 
-#include "sel_interface.h"
+#include "halt_watchdog.h"
 
+// Only records the signal. The halt watchdog halts every registered SEL link and exits, so nothing here
+// blocks, logs or touches a serial port that another thread may be using.
 void signalHandler(int signum) {
-    Logger::warn("Interrupt signal '" + std::to_string(signum) + "' received. Exiting gracefully...");
-
-    SEL_Interface::HaltAll();
-    SEL->Close();
+    HaltWatchdog::RequestFromSignal(signum);
+}
 
-    exit(signum);
+/**
+ * Starts the halt watchdog and routes SIGINT and SIGTERM to it.
+ */
+void installSignalHandlers() {
+    HaltWatchdog::Instance().Start();
+    std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
 }
 
-#endif // SIGNAL_HANDLER_H
\ No newline at end of file
+#endif // SIGNAL_HANDLER_H
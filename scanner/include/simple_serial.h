@@ -1,9 +1,54 @@
 #ifndef SIMPLE_SERIAL_H
 #define SIMPLE_SERIAL_H
 
+#include <utility> // Boost 1.74 awaitable.hpp uses std::exchange without including it
 #include <boost/asio.hpp>
+#include "alloc_stats.h"
 #include "logging.h"
 #include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Faults seen on a serial link and the time spent recovering from them.
+ */
+struct LinkFaults {
+    uint64_t timeouts{0};      // Replies that did not arrive in time
+    uint64_t malformed{0};     // Replies that arrived garbled or did not answer the command
+    uint64_t port_errors{0};   // Reads or writes the port itself failed
+    uint64_t resyncs{0};       // Times input was discarded to the next frame boundary
+    uint64_t retries{0};       // Requests sent again after a fault
+    uint64_t reopens{0};       // Times the port was closed and opened again
+    uint64_t recovered{0};     // Exchanges that succeeded after a fault
+    uint64_t unrecovered{0};   // Exchanges given up on
+    double recovery_time{0.0};     // s, total from the first fault of an exchange until it succeeded
+    double max_recovery_time{0.0}; // s
+
+    void Recovered(std::chrono::steady_clock::duration duration)
+    {
+        double seconds = std::chrono::duration<double>(duration).count();
+        ++recovered;
+        recovery_time += seconds;
+        max_recovery_time = (std::max)(max_recovery_time, seconds);
+    }
+
+    std::string Summary() const
+    {
+        return std::to_string(timeouts) + " timeouts, " + std::to_string(malformed) + " malformed, " +
+               std::to_string(port_errors) + " port errors, " + std::to_string(resyncs) + " resyncs, " +
+               std::to_string(retries) + " retries, " + std::to_string(reopens) + " reopens, " +
+               std::to_string(recovered) + " recovered in " +
+               std::to_string(recovered ? recovery_time / recovered * 1000.0 : 0.0) + " ms mean, " +
+               std::to_string(max_recovery_time * 1000.0) + " ms max, " + std::to_string(unrecovered) + " unrecovered";
+    }
+};
 
 // Create with help from https://web.archive.org/web/20130825102715/http://www.webalice.it/fede.tft/serial_port/serial_port.html
 class SimpleSerial
@@ -17,13 +62,27 @@ public:
      * serial device
      */
     SimpleSerial(std::string port, uint32_t baud_rate)
-    : io(), serial(io,port), port(port)
+    : io(), serial(io,port), port(port), baud_rate(baud_rate)
     {
         Logger::info("Opening new serial connection on " + port + " at rate " + std::to_string(baud_rate));
-        serial.set_option(boost::asio::serial_port_base::baud_rate(baud_rate));
-        serial.set_option(boost::asio::serial_port_base::character_size(8));
-        serial.set_option(boost::asio::serial_port_base::parity(boost::asio::serial_port_base::parity::none));
-        serial.set_option(boost::asio::serial_port_base::stop_bits(boost::asio::serial_port_base::stop_bits::one));
+        configure();
+    }
+
+    /**
+     * Closes the port and opens it again with the same settings, e.g. after the USB adapter dropped out.
+     * Replies announced with expectUnsolicited are forgotten along with the old connection.
+     * \throws boost::system::system_error if the port cannot be opened
+     */
+    void reopen()
+    {
+        Logger::warn("SimpleSerial::reopen: Reopening " + port);
+        std::lock_guard<std::mutex> lock(write_mutex);
+        boost::system::error_code ignored;
+        serial.close(ignored);
+        serial.open(port);
+        configure();
+        forgetUnsolicited();
+        ++link_faults.reopens;
     }
 
     /**
@@ -34,36 +93,84 @@ public:
     void writeString(std::string s)
     {
         Logger::verbose("Sending: " + s);
+        std::lock_guard<std::mutex> lock(write_mutex);
         boost::asio::write(serial,boost::asio::buffer(s.c_str(),s.size()));
+        bytes_written += s.size();
+        AllocStats::OnIo(AllocStats::Io::WRITE, s.size());
+    }
+
+    void writeBytes(const unsigned char* data, std::size_t length){
+        Logger::verbose("Sending: " + toHex(std::vector<unsigned char>(data, data + length)));
+        std::lock_guard<std::mutex> lock(write_mutex);
+        boost::asio::write(serial, boost::asio::buffer(data, length));
+        bytes_written += length;
+        AllocStats::OnIo(AllocStats::Io::WRITE, length);
     }
 
-    // TODO: Handle logging better
-    void writeBytes(unsigned char* data, std::size_t length){
-        std::cout << std::hex << std::setw(2) << std::setfill('0');
-        std::cout << "SENDING WRITEBYTES COMMAND" << std::endl;
-        // Iterate through each byte in the data array
-        for(std::size_t i = 0; i < length; ++i) {
-            // Print the current byte in hexadecimal format
-            std::cout << static_cast<int>(data[i]) << " ";
+    void writeVector(const std::vector<unsigned char>& data){
+        Logger::verbose("Sending: " + toHex(data));
+        std::lock_guard<std::mutex> lock(write_mutex);
+        boost::asio::write(serial, boost::asio::buffer(data));
+        bytes_written += data.size();
+        AllocStats::OnIo(AllocStats::Io::WRITE, data.size());
+    }
+
+    /**
+     * Writes a string from a thread other than the one driving the link, e.g. the halt watchdog.
+     * serial_port may not be used from two threads at once, and cancelling a timed-out read could abort a
+     * write in progress on it. So while the driving thread waits in a timed read, the write is posted to the
+     * event loop of that read, which wakes at once and makes the write before any cancel. Otherwise it is
+     * written directly, holding off the next read until it is done.
+     * \throws boost::system::system_error on failure
+     */
+    void writeFromOtherThread(const std::string& s)
+    {
+        std::unique_lock<std::mutex> lock(reader_mutex);
+        if (!reading) {
+            writeString(s);
+            return;
         }
 
-        std::cout << std::endl;
+        auto written = std::make_shared<std::promise<void>>();
+        auto result = written->get_future();
+        boost::asio::post(io, [this, s, written]() {
+            try {
+                writeString(s);
+                written->set_value();
+            }
+            catch (...) {
+                written->set_exception(std::current_exception());
+            }
+        });
+        lock.unlock();
+        result.get();
+    }
+
+    /**
+     * Announces a reply to a command written by another thread, e.g. the halt watchdog. The next readLine
+     * receiving that line skips it, so the thread driving the link still gets the reply to its own command.
+     * Writes are serialized, so a command written from another thread never lands inside one in progress.
+     */
+    void expectUnsolicited(const std::string& line)
+    {
+        std::lock_guard<std::mutex> lock(unsolicited_mutex);
+        unsolicited.push_back(line);
+    }
+
+    size_t unsolicitedSkipped() const
+    {
+        std::lock_guard<std::mutex> lock(unsolicited_mutex);
+        return unsolicited_skipped;
+    }
 
-        auto buffer = boost::asio::buffer(data,length);
-        boost::asio::write(serial,buffer);
+    const std::string& portName() const
+    {
+        return port;
     }
 
-    // TODO: Handle logging better
-    void writeVector(std::vector<unsigned char> data){
-        std::cout << std::hex << std::setw(2) << std::setfill('0');
-        std::cout << "Writing vector ";
-        for(std::size_t i = 0; i < data.size(); ++i) {
-            // Print the current byte in hexadecimal format
-            std::cout << static_cast<int>(data[i]) << " ";
-        }
-        std::cout << std::endl;
-        auto buffer = boost::asio::buffer(data, data.size());
-        boost::asio::write(serial,buffer);
+    uint32_t baudRate() const
+    {
+        return baud_rate;
     }
 
     /**
@@ -82,6 +189,8 @@ public:
         for(;;)
         {
             asio::read(serial,asio::buffer(&c,1));
+            ++bytes_read;
+            AllocStats::OnIo(AllocStats::Io::READ, 1);
             Logger::verbose_stream(c);
 
             switch(c)
@@ -90,7 +199,10 @@ public:
                     break;
                 case '\n':
                     Logger::verbose(""); // Send an end line since the above verbose_stream does not
-                    return result;
+                    if (!skipUnsolicited(result))
+                        return result;
+                    result.clear();
+                    break;
                 default:
                     result+=c;
             }
@@ -117,24 +229,197 @@ public:
     }
 
     /**
-     * TODO: This doesn't work correctly, might crash
      * Reads data_length bytes from the serial device. Blocks until data_length bytes have been received.
      * \return a vector of bytes of length data_length
      * \throws boost::system::system_error on failure
      */
     std::vector<unsigned char> readBytes(size_t data_length)
     {
-        Logger::verbose("Receiving: ");
-        using namespace boost;
-        std::vector<unsigned char> data;
-        asio::read(serial,asio::buffer(&data, data_length));
-        for (size_t i = 0; i < data_length; ++i) {
-            std::cout << std::hex << (0xFF & data[i]) << std::flush;
+        std::vector<unsigned char> data(data_length);
+        boost::asio::read(serial, boost::asio::buffer(data));
+        bytes_read += data.size();
+        AllocStats::OnIo(AllocStats::Io::READ, data.size());
+        Logger::verbose("Received: " + toHex(data));
+        return data;
+    }
+
+    /**
+     * Reads up to data_length bytes from the serial device, giving up after timeout.
+     * \return the bytes received, shorter than data_length if the timeout expired first
+     * \throws boost::system::system_error on failure
+     */
+    std::vector<unsigned char> readBytes(size_t data_length, std::chrono::milliseconds timeout)
+    {
+        std::vector<unsigned char> data(data_length);
+        boost::system::error_code result = boost::asio::error::would_block;
+        size_t received = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(reader_mutex);
+            reading = true;
+        }
+        boost::asio::async_read(serial, boost::asio::buffer(data),
+            [&](const boost::system::error_code& ec, size_t n) {
+                result = ec;
+                received = n;
+            });
+
+        io.restart();
+        io.run_for(timeout);
+
+        if (result == boost::asio::error::would_block) {
+            // Timed out. Cancel the read and let its handler run so nothing refers to data afterwards.
+            serial.cancel();
+            io.restart();
+            io.run();
+            result = boost::asio::error::timed_out;
+        }
+
+        // Make the writes posted by writeFromOtherThread since the read ended
+        {
+            std::lock_guard<std::mutex> lock(reader_mutex);
+            reading = false;
+        }
+        io.restart();
+        io.poll();
+
+        data.resize(received);
+        bytes_read += received;
+        AllocStats::OnIo(AllocStats::Io::READ, received);
+
+        if (result && result != boost::asio::error::timed_out && result != boost::asio::error::operation_aborted) {
+            throw boost::system::system_error(result);
         }
-        std::cout << std::endl;
+
+        Logger::verbose("Received: " + toHex(data) + (result ? " (timed out)" : ""));
         return data;
     }
 
+    /**
+     * Reads a line like readLine, giving up after timeout.
+     * \param line Receives the line without its '\r\n', or the partial line on timeout
+     * \return false if no complete line arrived within timeout
+     * \throws boost::system::system_error on failure
+     */
+    bool readLine(std::string& line, std::chrono::milliseconds timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        line.clear();
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+                return false;
+            auto byte = readBytes(1, remaining);
+            if (byte.empty())
+                return false;
+
+            char c = static_cast<char>(byte[0]);
+            if (c == '\r')
+                continue;
+            if (c != '\n') {
+                line += c;
+                continue;
+            }
+            if (!skipUnsolicited(line))
+                return true;
+            line.clear();
+        }
+    }
+
+    /**
+     * Discards everything received until the link has been quiet for the given time.
+     * Replies announced with expectUnsolicited are forgotten, since they went with the discarded input.
+     * \return Number of bytes discarded
+     */
+    size_t discardInput(std::chrono::milliseconds quiet)
+    {
+        size_t discarded = 0;
+        while (!readBytes(1, quiet).empty()) {
+            ++discarded;
+        }
+        forgetUnsolicited();
+        return discarded;
+    }
+
+    /**
+     * Resynchronizes the input after a timeout or a garbled reply: discards the rest of the broken frame
+     * through its boundary, then the whole frames queued behind it until the link has been quiet for the given
+     * time. A frame that has started arriving is read through its boundary, waiting up to frame_timeout for
+     * each byte of it, so a late reply is never cut in two.
+     * Replies announced with expectUnsolicited are forgotten, since they went with the discarded input.
+     * \param mid_frame true if the broken frame's boundary has not been read, e.g. after a reply timed out
+     * \return Number of bytes discarded
+     */
+    size_t discardThrough(const std::string& boundary, bool mid_frame, std::chrono::milliseconds frame_timeout,
+                          std::chrono::milliseconds quiet)
+    {
+        std::string tail;
+        size_t discarded = 0;
+        size_t frames = 0;
+        bool on_boundary = !mid_frame;
+        while (true) {
+            auto byte = readBytes(1, on_boundary ? quiet : frame_timeout);
+            if (byte.empty())
+                break;
+            ++discarded;
+            on_boundary = false;
+            tail += static_cast<char>(byte[0]);
+            if (tail.size() > boundary.size())
+                tail.erase(0, 1);
+            if (tail == boundary) {
+                on_boundary = true;
+                ++frames;
+                tail.clear();
+            }
+        }
+        forgetUnsolicited();
+        ++link_faults.resyncs;
+        Logger::debug("SimpleSerial::discardThrough: Discarded " + std::to_string(discarded) + " bytes in " +
+                      std::to_string(frames) + " frames on " + port + (on_boundary ? ", ending on a frame boundary" : ", ending mid-frame"));
+        return discarded;
+    }
+
+    /**
+     * Fault and recovery counters of this link. Updated by the thread reading the link, which for the gripper
+     * is the echo task of a register write until Gripper_Interface::Driver::FinishPending returns.
+     */
+    LinkFaults& faults()
+    {
+        return link_faults;
+    }
+
+    /**
+     * Changes the baud rate of the open port.
+     * \throws boost::system::system_error if the port rejects the rate
+     */
+    void setBaudRate(uint32_t rate)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        serial.set_option(boost::asio::serial_port_base::baud_rate(rate));
+        baud_rate = rate;
+    }
+
+    // Totals since the port was opened, for link utilization
+    uint64_t bytesWritten() const
+    {
+        return bytes_written;
+    }
+
+    uint64_t bytesRead() const
+    {
+        return bytes_read;
+    }
+
+    static std::string toHex(const std::vector<unsigned char>& data)
+    {
+        std::ostringstream stream;
+        stream << std::hex << std::setfill('0');
+        for (auto byte : data) {
+            stream << std::setw(2) << static_cast<int>(byte) << " ";
+        }
+        return stream.str();
+    }
+
     void Close()
     {
         Logger::info("SimpleSerial::Close: Closing serial port on " + port);
@@ -146,9 +431,45 @@ private:
     boost::asio::io_service io;
     boost::asio::serial_port serial;
     std::string port;
-};
+    std::atomic<uint32_t> baud_rate;
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> bytes_read{0};
+    LinkFaults link_faults;
+
+    std::mutex write_mutex;
+    std::mutex reader_mutex;
+    bool reading{false}; // The driving thread waits in a timed read, running io. Guarded by reader_mutex.
+    mutable std::mutex unsolicited_mutex;
+    std::vector<std::string> unsolicited; // Replies to commands written by other threads, not read yet
+    size_t unsolicited_skipped{0};
 
-extern SimpleSerial* SEL;
-extern SimpleSerial* Gripper;
+    void configure()
+    {
+        serial.set_option(boost::asio::serial_port_base::baud_rate(baud_rate));
+        serial.set_option(boost::asio::serial_port_base::character_size(8));
+        serial.set_option(boost::asio::serial_port_base::parity(boost::asio::serial_port_base::parity::none));
+        serial.set_option(boost::asio::serial_port_base::stop_bits(boost::asio::serial_port_base::stop_bits::one));
+    }
+
+    void forgetUnsolicited()
+    {
+        std::lock_guard<std::mutex> lock(unsolicited_mutex);
+        unsolicited.clear();
+    }
+
+    bool skipUnsolicited(const std::string& line)
+    {
+        std::lock_guard<std::mutex> lock(unsolicited_mutex);
+        for (auto it = unsolicited.begin(); it != unsolicited.end(); ++it) {
+            if (*it == line) {
+                unsolicited.erase(it);
+                ++unsolicited_skipped;
+                Logger::verbose("SimpleSerial::readLine: Skipped reply " + line + " to a command from another thread");
+                return true;
+            }
+        }
+        return false;
+    }
+};
 
 #endif // SIMPLE_SERIAL_H
\ No newline at end of file
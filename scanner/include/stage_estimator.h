@@ -0,0 +1,154 @@
+#ifndef STAGE_ESTIMATOR_H
+#define STAGE_ESTIMATOR_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "xy.h"
+
+/**
+ * Estimates where the stage was at any moment from the status samples read from the SEL controller.
+ *
+ * Status replies arrive at irregular times, interleaved with camera frames, so the last position read is
+ * stale by an unknown amount when a frame is converted to stage coordinates. The estimator keeps a short
+ * history of timestamped samples. Queries between two samples interpolate linearly, which is exact while
+ * the stage cruises. Queries after the newest sample extrapolate with the last velocity for a bounded
+ * time and never past the target of the current move.
+ */
+class StageEstimator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t CAPACITY = 64;
+
+    struct Sample {
+        Clock::time_point time;
+        XY position;
+        bool in_motion{false};
+    };
+
+    double max_extrapolation{0.1}; // s, queries further past the newest sample use its extrapolation at this time
+
+    /**
+     * Adds a status sample. Samples must be recorded in time order.
+     * \param time Time the controller reported the position, e.g. halfway between request and reply
+     */
+    void Record(Clock::time_point time, XY position, bool in_motion) {
+        samples_[next_ % CAPACITY] = {time, position, in_motion};
+        ++next_;
+        if (!in_motion)
+            has_target_ = false;
+    }
+
+    /**
+     * Sets the end of the move in progress, which extrapolation does not run past.
+     */
+    void SetTarget(XY target) {
+        target_ = target;
+        has_target_ = true;
+    }
+
+    /**
+     * Forgets the move target, e.g. after a halt.
+     */
+    void ClearTarget() {
+        has_target_ = false;
+    }
+
+    bool Empty() const {
+        return next_ == 0;
+    }
+
+    /**
+     * Estimated stage position at a time. Returns the oldest sample for times before the history and the
+     * origin if there are no samples.
+     */
+    XY PositionAt(Clock::time_point time) {
+        if (Empty())
+            return XY();
+
+        size_t count = (std::min)(next_, CAPACITY);
+        const Sample& newest = At(0);
+
+        if (time >= newest.time) {
+            if (!newest.in_motion || count < 2) {
+                ++held_;
+                return newest.position;
+            }
+            ++extrapolated_;
+            const Sample& previous = At(1);
+            double span = Seconds(newest.time - previous.time);
+            if (span <= 0.0)
+                return newest.position;
+            double ahead = (std::min)(Seconds(time - newest.time), max_extrapolation);
+            XY step = (newest.position - previous.position) * (ahead / span);
+            return LimitToTarget(newest.position, step);
+        }
+
+        for (size_t i = 1; i < count; ++i) {
+            const Sample& older = At(i);
+            if (older.time <= time) {
+                const Sample& newer = At(i - 1);
+                double span = Seconds(newer.time - older.time);
+                double fraction = span > 0.0 ? Seconds(time - older.time) / span : 1.0;
+                ++interpolated_;
+                return older.position + (newer.position - older.position) * fraction;
+            }
+        }
+
+        ++before_history_;
+        return At(count - 1).position;
+    }
+
+    /**
+     * How the queries since the last Reset were answered.
+     */
+    std::string Summary() const {
+        return "Stage estimates: " + std::to_string(interpolated_) + " interpolated, " + std::to_string(extrapolated_) +
+               " extrapolated, " + std::to_string(held_) + " at rest, " + std::to_string(before_history_) +
+               " older than the history";
+    }
+
+    void ResetStats() {
+        interpolated_ = extrapolated_ = held_ = before_history_ = 0;
+    }
+
+private:
+    std::array<Sample, CAPACITY> samples_{};
+    size_t next_{0}; // Samples recorded so far
+    XY target_;
+    bool has_target_{false};
+
+    size_t interpolated_{0};
+    size_t extrapolated_{0};
+    size_t held_{0};
+    size_t before_history_{0};
+
+    // i-th newest sample
+    const Sample& At(size_t i) const {
+        return samples_[(next_ - 1 - i) % CAPACITY];
+    }
+
+    static double Seconds(Clock::duration duration) {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    /**
+     * Shortens an extrapolated step so it does not overshoot the move target.
+     */
+    XY LimitToTarget(XY from, XY step) const {
+        if (!has_target_)
+            return from + step;
+        XY remaining = target_ - from;
+        double length = step.magnitude();
+        double remaining_length = remaining.magnitude();
+        if (length <= remaining_length)
+            return from + step;
+        return target_;
+    }
+};
+
+#endif // STAGE_ESTIMATOR_H
@@ -0,0 +1,240 @@
+#ifndef TOLERANCE_STACK_H
+#define TOLERANCE_STACK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <thread>
+#include <vector>
+
+#include "refine_estimator.h"
+#include "xoshiro.h"
+#include "xy.h"
+
+/**
+ * Uncertainties and tolerances of a mate, in mm. Defaults mirror monte_carlo/constants.py and the refinement
+ * defaults of CycleParameters. All uncertainties are uniform in [-value, value].
+ */
+struct ToleranceModel {
+    // Position tolerance of the mate
+    double xy_tolerance{0.6}; // Radius on the xy plane
+    double z_tolerance{1.0};  // +/- height
+
+    double encoder_xy{0.01};
+    double encoder_z{0.01};
+    double gripper_xy{0.129};
+    double gripper_z{0.129};
+    double camera_xy{0.0194};
+    double camera_z{0.0802};
+
+    // Refinement, as run by RefineToMobile and RefineToFixed
+    bool simulate_refinement{true}; // false sums one sample of each uncertainty, like monte_carlo.py
+    double mobile_tolerance{1.0};
+    double fixed_tolerance{0.1};
+    double mobile_scale_factor{0.59};
+    double fixed_scale_factor{0.59};
+    double camera_gain{1.5};        // Measured over actual distance, which the scale factors compensate for
+    double initial_error{2.0};      // Largest offset left by the scan
+    int max_moves{30};              // Refinements taking more moves count as failed mates
+    RefinementSettings refinement;
+};
+
+/**
+ * Outcome of a batch of simulated mates.
+ */
+struct ToleranceEstimate {
+    uint64_t trials{0};
+    uint64_t successes{0};     // Within xy_tolerance and z_tolerance
+    uint64_t refine_failures{0};
+    uint64_t moves{0};         // Refinement moves over all trials
+    uint64_t frames{0};        // Refinement frames over all trials
+    double seconds{0.0};       // Wall time
+
+    double Probability() const {
+        return trials ? double(successes) / trials : 0.0;
+    }
+
+    // Binomial standard error of Probability
+    double StandardError() const {
+        if (!trials)
+            return 0.0;
+        double p = Probability();
+        return std::sqrt(p * (1.0 - p) / trials);
+    }
+
+    double MeanMoves() const {
+        return trials ? double(moves) / trials : 0.0;
+    }
+
+    double MeanFrames() const {
+        return trials ? double(frames) / trials : 0.0;
+    }
+
+    double TrialsPerSecond() const {
+        return seconds > 0.0 ? trials / seconds : 0.0;
+    }
+
+    void Add(const ToleranceEstimate& other) {
+        trials += other.trials;
+        successes += other.successes;
+        refine_failures += other.refine_failures;
+        moves += other.moves;
+        frames += other.frames;
+    }
+};
+
+/**
+ * Monte Carlo simulation of the position error of a mate on one thread.
+ */
+class ToleranceStack {
+public:
+    ToleranceStack(const ToleranceModel& model, uint64_t seed, size_t stream)
+        : model_(model), generator_(seed, stream), uniform_(generator_) {}
+
+    ToleranceEstimate Run(uint64_t trials) {
+        return model_.simulate_refinement ? RunRefined(trials) : RunStack(trials);
+    }
+
+private:
+    static constexpr size_t BATCH = 4096;
+
+    ToleranceModel model_;
+    Xoshiro256PlusX4 generator_;
+    UniformBuffer uniform_;
+    std::vector<OffsetSample> samples_;
+
+    /**
+     * One sample each of encoder, gripper and camera error, drawn a batch at a time so both the generator
+     * and the tolerance test vectorize.
+     */
+    ToleranceEstimate RunStack(uint64_t trials) {
+        ToleranceEstimate estimate;
+        std::vector<double> x(BATCH), y(BATCH), z(BATCH), noise(BATCH);
+        const double xy_limit = model_.xy_tolerance * model_.xy_tolerance;
+
+        while (estimate.trials < trials) {
+            size_t count = static_cast<size_t>((std::min)(uint64_t(BATCH), trials - estimate.trials));
+
+            auto sum = [&](std::vector<double>& axis, std::initializer_list<double> limits) {
+                std::fill(axis.begin(), axis.end(), 0.0);
+                for (double limit : limits) {
+                    generator_.Fill(noise.data(), BATCH, -limit, limit);
+                    for (size_t i = 0; i < BATCH; ++i) {
+                        axis[i] += noise[i];
+                    }
+                }
+            };
+            sum(x, {model_.encoder_xy, model_.gripper_xy, model_.camera_xy});
+            sum(y, {model_.encoder_xy, model_.gripper_xy, model_.camera_xy});
+            sum(z, {model_.encoder_z, model_.gripper_z, model_.camera_z});
+
+            uint64_t inside = 0;
+            for (size_t i = 0; i < count; ++i) {
+                inside += (x[i] * x[i] + y[i] * y[i] <= xy_limit) & (std::abs(z[i]) <= model_.z_tolerance);
+            }
+            estimate.successes += inside;
+            estimate.trials += count;
+        }
+        return estimate;
+    }
+
+    XY UniformXY(double limit) {
+        double x = uniform_.Next(-limit, limit);
+        return XY(x, uniform_.Next(-limit, limit));
+    }
+
+    /**
+     * Runs the refinement loop on a simulated camera.
+     * \param residual Actual offset from the camera center to the connector when the loop finished
+     * \return false if the loop did not converge within max_moves
+     */
+    bool Refine(double tolerance, double scale_factor, XY& residual, ToleranceEstimate& estimate) {
+        double angle = uniform_.Next(0.0, 2.0 * std::acos(-1.0));
+        double radius = std::sqrt(uniform_.Next(0.0, 1.0)) * model_.initial_error;
+        XY actual(radius * std::cos(angle), radius * std::sin(angle));
+
+        samples_.clear();
+        for (int moves = 0; moves <= model_.max_moves;) {
+            samples_.push_back({actual * model_.camera_gain + UniformXY(model_.camera_xy), 1.0});
+            ++estimate.frames;
+
+            auto decision = DecideRefinement(samples_, model_.refinement, tolerance, scale_factor);
+            if (decision.need_more_frames)
+                continue;
+
+            if (decision.within_tolerance) {
+                residual = actual;
+                return true;
+            }
+
+            actual = actual + decision.correction + UniformXY(model_.encoder_xy);
+            samples_.clear();
+            ++moves;
+            ++estimate.moves;
+        }
+        return false;
+    }
+
+    /**
+     * Centers the camera on the mobile connector, grasps it, centers the camera on the fixed connector and
+     * mates. The final offset is what both refinements left over plus the gripper and the two offset moves.
+     */
+    ToleranceEstimate RunRefined(uint64_t trials) {
+        ToleranceEstimate estimate;
+        const double xy_limit = model_.xy_tolerance * model_.xy_tolerance;
+
+        for (uint64_t i = 0; i < trials; ++i) {
+            ++estimate.trials;
+
+            XY mobile, fixed;
+            if (!Refine(model_.mobile_tolerance, model_.mobile_scale_factor, mobile, estimate) ||
+                !Refine(model_.fixed_tolerance, model_.fixed_scale_factor, fixed, estimate)) {
+                ++estimate.refine_failures;
+                continue;
+            }
+
+            XY error = fixed - mobile + UniformXY(model_.gripper_xy) + UniformXY(model_.encoder_xy) + UniformXY(model_.encoder_xy);
+            double z = uniform_.Next(-model_.encoder_z, model_.encoder_z) + uniform_.Next(-model_.gripper_z, model_.gripper_z) +
+                       uniform_.Next(-model_.camera_z, model_.camera_z);
+
+            if (error.x * error.x + error.y * error.y <= xy_limit && std::abs(z) <= model_.z_tolerance)
+                ++estimate.successes;
+        }
+        return estimate;
+    }
+};
+
+/**
+ * Simulates mates on all cores. Each thread draws from its own stream of the seed, so a run is reproducible
+ * for a given seed and thread count.
+ * \param num_threads Zero uses one thread per hardware thread
+ */
+ToleranceEstimate SimulateMates(const ToleranceModel& model, uint64_t trials, uint64_t seed = 1, size_t num_threads = 0) {
+    if (num_threads == 0)
+        num_threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ToleranceEstimate> partial(num_threads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < num_threads; ++t) {
+        uint64_t share = trials / num_threads + (t < trials % num_threads ? 1 : 0);
+        workers.emplace_back([&, t, share]() {
+            ToleranceStack stack(model, seed, t);
+            partial[t] = stack.Run(share);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    ToleranceEstimate total;
+    for (auto& estimate : partial) {
+        total.Add(estimate);
+    }
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total;
+}
+
+#endif // TOLERANCE_STACK_H
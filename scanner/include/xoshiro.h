@@ -0,0 +1,137 @@
+#ifndef XOSHIRO_H
+#define XOSHIRO_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Four interleaved xoshiro256+ generators producing uniform doubles in batches.
+ *
+ * The lanes are stored structure-of-arrays so the update loop in Fill is vectorized by the compiler. Each
+ * lane starts 2^128 outputs after the previous one (the xoshiro jump function), so streams handed to
+ * different threads never overlap. xoshiro256+ is intended for floating point output, where the weak low
+ * bits are discarded.
+ */
+class Xoshiro256PlusX4 {
+public:
+    static constexpr size_t LANES = 4;
+
+    /**
+     * \param seed Seed shared by all streams of a run
+     * \param stream Index of the stream, e.g. the thread number. Streams of the same seed never overlap.
+     */
+    Xoshiro256PlusX4(uint64_t seed, size_t stream) {
+        std::array<uint64_t, 4> state;
+        for (auto& word : state) {
+            word = SplitMix64(seed);
+        }
+        for (size_t i = 0; i < stream * LANES; ++i) {
+            Jump(state);
+        }
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            s0_[lane] = state[0];
+            s1_[lane] = state[1];
+            s2_[lane] = state[2];
+            s3_[lane] = state[3];
+            Jump(state);
+        }
+    }
+
+    /**
+     * Fills out with count uniform doubles in [min, max). count is rounded up to a multiple of LANES, so out
+     * must have room for that many.
+     */
+    void Fill(double* out, size_t count, double min = 0.0, double max = 1.0) {
+        const double scale = (max - min) * 0x1.0p-53;
+        for (size_t i = 0; i < count; i += LANES) {
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                uint64_t result = s0_[lane] + s3_[lane];
+                uint64_t t = s1_[lane] << 17;
+                s2_[lane] ^= s0_[lane];
+                s3_[lane] ^= s1_[lane];
+                s1_[lane] ^= s2_[lane];
+                s0_[lane] ^= s3_[lane];
+                s2_[lane] ^= t;
+                s3_[lane] = (s3_[lane] << 45) | (s3_[lane] >> 19);
+                out[i + lane] = min + static_cast<double>(result >> 11) * scale;
+            }
+        }
+    }
+
+private:
+    alignas(32) uint64_t s0_[LANES];
+    alignas(32) uint64_t s1_[LANES];
+    alignas(32) uint64_t s2_[LANES];
+    alignas(32) uint64_t s3_[LANES];
+
+    static uint64_t SplitMix64(uint64_t& state) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t Next(std::array<uint64_t, 4>& s) {
+        uint64_t result = s[0] + s[3];
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = (s[3] << 45) | (s[3] >> 19);
+        return result;
+    }
+
+    // Advances the state by 2^128 outputs.
+    static void Jump(std::array<uint64_t, 4>& s) {
+        static constexpr uint64_t polynomial[] = {0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL,
+                                                  0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL};
+        std::array<uint64_t, 4> jumped{0, 0, 0, 0};
+        for (uint64_t word : polynomial) {
+            for (int bit = 0; bit < 64; ++bit) {
+                if (word & (uint64_t(1) << bit)) {
+                    for (size_t i = 0; i < 4; ++i) {
+                        jumped[i] ^= s[i];
+                    }
+                }
+                Next(s);
+            }
+        }
+        s = jumped;
+    }
+};
+
+/**
+ * Hands out uniform doubles one at a time from batches filled by a Xoshiro256PlusX4.
+ */
+class UniformBuffer {
+public:
+    explicit UniformBuffer(Xoshiro256PlusX4& generator) : generator_(generator) {}
+
+    /**
+     * \return A uniform double in [min, max)
+     */
+    double Next(double min, double max) {
+        if (next_ == values_.size()) {
+            generator_.Fill(values_.data(), values_.size());
+            next_ = 0;
+        }
+        return min + (max - min) * values_[next_++];
+    }
+
+    /**
+     * Drops the values not handed out yet, e.g. after the generator was reseeded.
+     */
+    void Discard() {
+        next_ = values_.size();
+    }
+
+private:
+    Xoshiro256PlusX4& generator_;
+    std::array<double, 1024> values_{};
+    size_t next_{values_.size()};
+};
+
+#endif // XOSHIRO_H
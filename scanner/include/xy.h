@@ -1,6 +1,9 @@
 #ifndef XYZ_H
 #define XYZ_H
 
+#include <cmath>
+#include <string>
+
 struct XY {
     XY(double x = 0.0, double y = 0.0) : x(x), y(y) {}
 
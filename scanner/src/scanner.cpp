@@ -1,183 +1,223 @@
 #include <WinSock2.h>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 
 #include "../include/ResultData.h"
 #include "../include/OutputObserver.h"
 
+#include "../include/alloc_stats.h"       // Optional allocation and serial I/O counts
 #include "../include/logging.h"           // Supports optional verbose logging
 #include "../include/simple_serial.h"     // Handles serial communication
 #include "../include/sel_interface.h"     // Defines SEL controller commands
 #include "../include/gripper_interface.h" // Defines gripper commands
 #include "../include/commander.h"         // Parses and stores system data for easy access
 #include "../include/scanner.h"
+#include "../include/cell.h"              // Serial links, commander and recipe of one cell
+#include "../include/multi_cell.h"        // Runs several cells concurrently
+#include "../include/daemon.h"            // Keeps cells warm between cycles
+#include "../include/config.h"            // Reads and reloads the config file
+#include "../include/signal_handler.h"    // Halts every cell on Ctrl+C
 #include "../include/xy.h"
 
 // Namespaces for using pylon objects
 using namespace Pylon;
 using namespace Pylon::DataProcessing;
 
-// Initialize globals to allow header files access to these objects
-SimpleSerial *SEL = nullptr;
-SimpleSerial *Gripper = nullptr;
-Commander *commander = nullptr; 
-
 int Logger::log_level_ = Logger::Level::INFO;
 
+#ifdef SCANNER_ALLOC_STATS
+// Counting replacements of the global allocation functions, see include/alloc_stats.h. The aligned
+// overloads are left to the library and not counted.
+void* operator new(std::size_t size) {
+    AllocStats::OnAllocate(size);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    if (p)
+        AllocStats::OnFree();
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+#endif
+
+/**
+ * Parses a cell description of the form name,sel_port,gripper_port[,recipe_path].
+ */
+CellConfig parseCell(const std::string& description, const CellConfig& defaults) {
+    std::vector<std::string> fields;
+    std::stringstream stream(description);
+    std::string field;
+    while (std::getline(stream, field, ',')) {
+        fields.push_back(field);
+    }
+
+    if (fields.size() < 3 || fields.size() > 4) {
+        throw std::runtime_error("Invalid cell description '" + description + "'. Expected name,sel_port,gripper_port[,recipe_path]");
+    }
+
+    CellConfig config = defaults;
+    config.name = fields[0];
+    config.sel_port = fields[1];
+    config.gripper_port = fields[2];
+    if (fields.size() == 4)
+        config.recipe_path = fields[3];
+    return config;
+}
+
 int main(int argc, char* argv[])
 {
     // The exit code of the sample application.
     int exitCode = 0;
 
-    // SEL controller default parameters
-    std::string sel_port = "COM3";
-    int sel_rate = 9600;
+    // Default cell, used unless cells are given with --cell
+    CellConfig default_cell;
+    std::vector<CellConfig> cells;
+    std::vector<std::string> cell_descriptions;
+    bool daemon_mode = false;
+    std::string config_path;
 
-    // Gripper default parameters
-    std::string gripper_port = "COM6";
-    int gripper_rate = 115200;
-
-    enum AxisAlignment {
-        ALIGNED = 1,
-        INVERTED = -1
-    };
-
-    // Camera parameters
-    XY camera_alignment = XY(AxisAlignment::INVERTED, AxisAlignment::ALIGNED); 
-    double fixed_tolerance = 0.1;
-    double mobile_tolerance = 1.0; // mm
-    double fixed_scale_factor = 0.59; // Prevents overshoot if the distance measured is greater than actual distance
-    double mobile_scale_factor = 0.59; 
-
-    // Workspace parameters
-    XY workspace = XY(400.0, 450.0);
-    XY camera_to_gripper = XY(-164.1, 0.5); // mm
-
-    // Scanning parameters
-    double scan_width = 35.0; // mm
-    int scan_speed = 200; // mm/s
-    int refinement_speed = 200; // mm/s
-    XY mobile_scan_start = XY(-camera_to_gripper.x + scan_width, 0.0);
+    CycleParameters parameters;
 
     // Handle command line arguments
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "--log-level" || arg == "-log") {
-            if (argc < i+1) {
-                Logger::warn(arg + " flag provided but no value specified. Using default log level.");
-                continue;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--log-level" || arg == "-log") {
+                if (i + 1 >= argc) {
+                    Logger::warn(arg + " flag provided but no value specified. Using default log level.");
+                    continue;
+                }
+                Logger::setLogLevel((argv[i+1]));
+                ++i;
             }
-            Logger::setLogLevel((argv[i+1]));
-            ++i;
-        }
-        else if (arg == "--sel-port") {
-            if (argc < i+1) {
-                Logger::warn(arg + " flag provided but no value specified. Using default SEL port " + sel_port);
-                continue;
+            else if (arg == "--sel-port") {
+                if (i + 1 >= argc) {
+                    Logger::warn(arg + " flag provided but no value specified. Using default SEL port " + default_cell.sel_port);
+                    continue;
+                }
+                default_cell.sel_port = argv[i+1];
+                ++i;
             }
-            sel_port = argv[i+1];
-            ++i;
-        }
-        else if (arg == "--gripper-port") {
-            if (argc < i+1) {
-                Logger::warn(arg + " flag provided but no value specified. Using default gripper port " + gripper_port);
-                continue;
+            else if (arg == "--gripper-port") {
+                if (i + 1 >= argc) {
+                    Logger::warn(arg + " flag provided but no value specified. Using default gripper port " + default_cell.gripper_port);
+                    continue;
+                }
+                default_cell.gripper_port = argv[i+1];
+                ++i;
+            }
+            else if (arg == "--cell") {
+                if (i + 1 >= argc) {
+                    Logger::warn(arg + " flag provided but no value specified. Ignoring.");
+                    continue;
+                }
+                cell_descriptions.push_back(argv[i+1]);
+                ++i;
+            }
+            else if (arg == "--config") {
+                if (i + 1 >= argc) {
+                    Logger::warn(arg + " flag provided but no value specified. Using compiled-in parameters.");
+                    continue;
+                }
+                config_path = argv[i+1];
+                ++i;
+            }
+            else if (arg == "--daemon") {
+                daemon_mode = true;
+            }
+            else {
+                Logger::warn(arg + " flag not recognized. Ignoring.");
             }
-            gripper_port = argv[i+1];
-            ++i;
-        }
-        else {
-            Logger::warn(arg + " flag not recognized. Ignoring.");
         }
     }
+    catch (const std::exception& e) {
+        Logger::error(std::string("Invalid command line argument: ") + e.what());
+        return 1;
+    }
 
-    try
-    {
-        // Initialize serial connections
-        SEL = new SimpleSerial(sel_port, sel_rate);
-        SEL_Interface::HaltAll(); // Halt all for safety
-
-        Gripper = new SimpleSerial(gripper_port, gripper_rate);
-        
-        // Create commander
-        commander = Commander::getInstance();
-
-        // Ensure the end effector starts from the origin
-        commander->MoveRC(RCPositions::HOME);
-        commander->waitForZMotionComplete();
-
-        SEL_Interface::MoveToPosition(mobile_scan_start, scan_speed);
-        commander->waitForXYMotionComplete();
-
-        // Initialize the gripper
-        Gripper_Interface::Initialize();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-        Gripper_Interface::Open();
-
-        // Initialize object recognition model
-        auto Scanner = PylonRecipe(SCANNER_RECIPE, camera_alignment);
-
-        // Create scan path
-        Path scan_path = buildScanPath(mobile_scan_start, workspace, scan_width);
-        
-        // Find mobile connector, record fixed connector location if seen
-        auto fixed_position = XY();
-        auto [success, fixed_found] = ScanForMobile(Scanner, scan_path, scan_speed, fixed_position);
-
-        if (success) {
-            success = RefineToMobile(Scanner, refinement_speed, mobile_tolerance, mobile_scale_factor, camera_alignment);
+    // The config file overrides the compiled-in defaults, cells given with --cell override the file's cells
+    std::unique_ptr<ConfigWatcher> config;
+    if (!config_path.empty()) {
+        try {
+            config = std::make_unique<ConfigWatcher>(config_path, ScannerConfig{parameters, default_cell, {}});
         }
+        catch (const std::exception& e) {
+            Logger::error(e.what());
+            return 1;
+        }
+        parameters = config->Current().parameters;
+        default_cell = config->Current().cell_defaults;
+        cells = config->Current().cells;
+    }
 
-        if (success) {
-            // Grasp mobile connector
-            commander->UpdateSEL();
-            commander->GraspMobile(camera_to_gripper, scan_speed, false);
-        
-            // Set up to find fixed connector
-            auto fixed_scan_start = (fixed_found ? fixed_position : (commander->position - camera_to_gripper));
-
-            SEL_Interface::MoveToPosition(fixed_scan_start, scan_speed);
-
-            commander->waitForAllMotionComplete();
-            
-            success = ScanForFixed(Scanner, scan_path, scan_speed);
-
-            if (!success) {
-                Path new_scan_path = buildScanPath(mobile_scan_start, workspace, scan_width);
-                success = ScanForFixed(Scanner, new_scan_path, scan_speed);
+    if (!cell_descriptions.empty()) {
+        cells.clear();
+        try {
+            for (auto& description : cell_descriptions) {
+                cells.push_back(parseCell(description, default_cell));
             }
         }
-
-        if (success) {
-            success = RefineToFixed(Scanner, refinement_speed, fixed_tolerance, fixed_scale_factor, camera_alignment);
+        catch (const std::exception& e) {
+            Logger::error(e.what());
+            return 1;
         }
+    }
 
-        Scanner.Stop();
+    if (cells.empty()) {
+        cells.push_back(default_cell);
+    }
 
-        if (success) {
-            commander->MateMobileToFixed(camera_to_gripper, scan_speed, false);
-        }
+    installSignalHandlers();
 
-        SEL_Interface::MoveToPosition(mobile_scan_start, scan_speed);
-        commander->waitForAllMotionComplete();
-        Gripper_Interface::Open();
-    }
+    // Initialize the pylon runtime once for all cells; each recipe only adds a reference.
+    PylonInitialize();
 
-    catch (const GenericException& e)
-    {
-        SEL_Interface::HaltAll();
-        std::cerr << "An exception occurred (likely pylon) - " <<std::endl << e.GetDescription() <<std::endl;
-        exitCode = 1;
-        throw;
+    if (daemon_mode) {
+        Daemon daemon(cells, parameters, config.get());
+        if (daemon.Start()) {
+            std::cout << "OK daemon ready" << std::endl;
+        }
+        else {
+            std::cout << "ERR daemon started with failed cells" << std::endl;
+            exitCode = 1;
+        }
+        daemon.Serve(std::cin, std::cout);
+        PylonTerminate();
+        return exitCode;
     }
 
-    catch (const std::exception& e)
-    {
-        SEL_Interface::HaltAll();
-        std::cout << "Exception caught :" << e.what() << std::endl;
-        exitCode = 1;
-        throw;
+    auto results = RunCells(cells, parameters);
+
+    PylonTerminate();
+
+    for (auto& result : results) {
+        if (!result.success) {
+            exitCode = 1;
+        }
+        if (cells.size() > 1) {
+            Logger::info("Cell " + result.name + ": " + (result.success ? "success" : "failure") +
+                         " in " + std::to_string(result.cycle_time) + " s" + (result.error.empty() ? "" : " (" + result.error + ")"));
+        }
     }
 
     return exitCode;
-}
\ No newline at end of file
+}
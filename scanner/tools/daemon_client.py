@@ -0,0 +1,65 @@
+"""Stand-in client for scanner.exe --daemon.
+
+Starts the daemon, requests a number of cycles over its stdin protocol and
+prints the cycle times and startup savings it reports.
+
+Usage: python daemon_client.py path/to/scanner.exe [--cycles N] [-- daemon args...]
+"""
+import argparse
+import subprocess
+import sys
+
+
+def read_reply(process):
+    """Returns the next protocol line, skipping log output."""
+    for line in process.stdout:
+        line = line.strip()
+        if line.startswith("OK") or line.startswith("ERR"):
+            return line
+    raise RuntimeError("daemon exited before replying")
+
+
+def parse_fields(reply):
+    fields = {}
+    for token in reply.split()[1:]:
+        if "=" in token:
+            key, value = token.split("=", 1)
+            fields[key] = value
+    return fields
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("executable")
+    parser.add_argument("--cycles", type=int, default=3)
+    parser.add_argument("daemon_args", nargs=argparse.REMAINDER)
+    args = parser.parse_args()
+
+    daemon_args = [a for a in args.daemon_args if a != "--"]
+    process = subprocess.Popen([args.executable, "--daemon", "--log-level", "err"] + daemon_args,
+                               stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True, bufsize=1)
+
+    print("startup:", read_reply(process))
+
+    process.stdin.write("status\n")
+    print("status:", read_reply(process))
+
+    cycle_times = []
+    for i in range(args.cycles):
+        process.stdin.write("cycle\n")
+        reply = read_reply(process)
+        fields = parse_fields(reply)
+        cycle_times.append(float(fields.get("cycle_ms", "nan")))
+        print("cycle %d: %s" % (i + 1, reply))
+
+    process.stdin.write("quit\n")
+    process.stdin.close()
+    process.wait()
+
+    if cycle_times:
+        print("mean cycle: %.1f ms over %d cycles" % (sum(cycle_times) / len(cycle_times), len(cycle_times)))
+    return process.returncode
+
+
+if __name__ == "__main__":
+    sys.exit(main())
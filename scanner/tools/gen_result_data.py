@@ -0,0 +1,293 @@
+"""Generates include/ResultData.h from the recipe output schema in include/ResultData.schema.
+
+Each line of the schema names a recipe output, its type and whether it pushes an array or a single
+value. The generated header declares a field per output and a ResultDecoder that decodes the pushed
+values straight into those fields.
+
+Usage: python gen_result_data.py [schema] [header]
+       --check compares the header with what the schema generates instead of writing it
+"""
+import argparse
+import os
+import re
+import sys
+
+# Schema type: C++ type of a value, CVariant conversion
+TYPES = {
+    "double": ("double", "ToDouble"),
+    "integer": ("int64_t", "ToInt64"),
+    "boolean": ("bool", "ToBool"),
+    "string": ("Pylon::String_t", "ToString"),
+    "point": ("Pylon::DataProcessing::SPointF2D", "ToPointF2D"),
+    "line": ("Pylon::DataProcessing::SLineF2D", "ToLineF2D"),
+    "rectangle": ("Pylon::DataProcessing::SRectangleF", "ToRectangleF"),
+    "circle": ("Pylon::DataProcessing::SCircleF", "ToCircleF"),
+    "ellipse": ("Pylon::DataProcessing::SEllipseF", "ToEllipseF"),
+    "image": ("Pylon::CPylonImage", "ToImage"),
+}
+
+SHAPES = ("array", "scalar")
+
+MAX_OUTPUTS = 32  # One bit each in ResultDecoder's mask
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_SCHEMA = os.path.join(HERE, "..", "include", "ResultData.schema")
+DEFAULT_HEADER = os.path.join(HERE, "..", "include", "ResultData.h")
+
+
+class Output:
+    def __init__(self, name, type_name, shape, comment):
+        self.name = name
+        self.type_name = type_name
+        self.shape = shape
+        self.comment = comment
+
+    @property
+    def enum(self):
+        return self.name.upper()
+
+    @property
+    def value_type(self):
+        return TYPES[self.type_name][0]
+
+    @property
+    def conversion(self):
+        return TYPES[self.type_name][1]
+
+    @property
+    def field_type(self):
+        return "std::vector<%s>" % self.value_type if self.shape == "array" else self.value_type
+
+
+def parse_schema(path):
+    outputs = []
+    with open(path) as schema:
+        for number, line in enumerate(schema, 1):
+            text, _, comment = line.partition("#")
+            fields = text.split()
+            if not fields:
+                continue
+            where = "%s:%d" % (path, number)
+            if len(fields) != 3:
+                raise ValueError("%s: expected name, type and shape, got %r" % (where, text.strip()))
+            name, type_name, shape = fields
+            if not re.fullmatch(r"[A-Za-z_][A-Za-z0-9_]*", name):
+                raise ValueError("%s: %s is not a C++ identifier" % (where, name))
+            if type_name not in TYPES:
+                raise ValueError("%s: unknown type %s, expected one of %s" % (where, type_name, ", ".join(TYPES)))
+            if shape not in SHAPES:
+                raise ValueError("%s: unknown shape %s, expected array or scalar" % (where, shape))
+            if any(o.name == name for o in outputs):
+                raise ValueError("%s: output %s is listed twice" % (where, name))
+            outputs.append(Output(name, type_name, shape, comment.strip()))
+    if not outputs:
+        raise ValueError("%s: no outputs" % path)
+    if len(outputs) > MAX_OUTPUTS:
+        raise ValueError("%s: at most %d outputs are supported" % (path, MAX_OUTPUTS))
+    return outputs
+
+
+def generate(outputs, schema_name):
+    lines = []
+    emit = lines.append
+
+    emit("// Generated by tools/gen_result_data.py from include/%s." % schema_name)
+    emit("// Edit the schema and regenerate this file instead of editing it, see the README.")
+    emit("#ifndef RESULT_DATA_H")
+    emit("#define RESULT_DATA_H")
+    emit("")
+    emit("// Include files to use the pylon API.")
+    emit("#include <pylon/PylonIncludes.h>")
+    emit("// Extend the pylon API for using pylon data processing.")
+    emit("#include <pylondataprocessing/PylonDataProcessingIncludes.h>")
+    emit("#include <atomic>")
+    emit("#include <cstdint>")
+    emit("#include <string>")
+    emit("#include <vector>")
+    emit("")
+    emit('#include "logging.h"')
+    emit("")
+    emit("// Declare a data class for one set of output data values.")
+    emit("class ResultData")
+    emit("{")
+    emit("public:")
+    emit("    // The outputs of the recipe, in the order of the schema.")
+    emit("    enum Output")
+    emit("    {")
+    for output in outputs:
+        emit("        %s," % output.enum)
+    emit("        OUTPUT_COUNT")
+    emit("    };")
+    emit("")
+    for output in outputs:
+        declaration = "    %s %s;" % (output.field_type, output.name)
+        if output.comment:
+            declaration = "%-36s// %s" % (declaration, output.comment)
+        emit(declaration)
+    emit("")
+    emit("    bool hasError{false};           // If something doesn't work as expected")
+    emit("                                    // while processing data, this is set to true.")
+    emit("    Pylon::String_t errorMessage;   // Contains an error message if")
+    emit("                                    // hasError has been set to true.")
+    emit("")
+    emit("    // Name of an output in the recipe. Built once, so looking an output up constructs no key.")
+    emit("    static const Pylon::String_t& OutputName(Output output)")
+    emit("    {")
+    emit("        static const Pylon::String_t names[OUTPUT_COUNT] = {")
+    for output in outputs:
+        emit('            "%s",' % output.name)
+    emit("        };")
+    emit("        return names[output];")
+    emit("    }")
+    emit("")
+    emit("    // Drops what this result shares with the recipe, e.g. images holding grab buffers,")
+    emit("    // and keeps the storage of its arrays for decoding another result into.")
+    emit("    void Recycle()")
+    emit("    {")
+    for output in outputs:
+        if output.type_name == "image":
+            emit("        %s.%s();" % (output.name, "clear" if output.shape == "array" else "Release"))
+    emit("    }")
+    emit("};")
+    emit("")
+    emit("// Decodes the values a recipe pushes into a ResultData.")
+    emit("// Which outputs the recipes have is resolved when they are registered, so a push only looks up")
+    emit("// outputs that can be in it. Arrays are decoded into the vectors of the result passed in, which")
+    emit("// keep their storage, so decoding into a result that held as many values allocates nothing.")
+    emit("class ResultDecoder")
+    emit("{")
+    emit("public:")
+    emit("    using CVariant = Pylon::DataProcessing::CVariant;")
+    emit("    using CVariantContainer = Pylon::DataProcessing::CVariantContainer;")
+    emit("")
+    emit("    // Adds the outputs of a recipe to those looked up. Until a recipe is registered, all are.")
+    emit("    // Recipe outputs missing from the schema are reported, as they are not decoded.")
+    emit("    void Register(const Pylon::StringList_t& outputNames)")
+    emit("    {")
+    emit("        uint32_t present = 0;")
+    emit("        for (const auto& name : outputNames)")
+    emit("        {")
+    emit("            uint32_t bit = 0;")
+    emit("            for (int output = 0; output < ResultData::OUTPUT_COUNT; ++output)")
+    emit("            {")
+    emit("                if (name == ResultData::OutputName(ResultData::Output(output)))")
+    emit("                    bit = 1u << output;")
+    emit("            }")
+    emit("            if (!bit)")
+    emit('                Logger::warn("ResultDecoder: Recipe output " + std::string(name.c_str()) + " is not in ResultData.schema and is ignored");')
+    emit("            present |= bit;")
+    emit("        }")
+    emit("        // The recipes share one observer, so an output is looked up if any of them has it")
+    emit("        if (m_registered)")
+    emit("            present |= m_present.load(std::memory_order_relaxed);")
+    emit("        m_registered = true;")
+    emit("        m_present.store(present, std::memory_order_release);")
+    emit("    }")
+    emit("")
+    emit("    // Decodes a push into result, replacing the values it held.")
+    emit("    void Decode(const CVariantContainer& variantContainer, ResultData& result) const")
+    emit("    {")
+    emit("        uint32_t present = m_present.load(std::memory_order_acquire);")
+    emit("        if (result.hasError)")
+    emit("        {")
+    emit("            result.hasError = false;")
+    emit("            result.errorMessage = Pylon::String_t();")
+    emit("        }")
+    for output in outputs:
+        emit("")
+        emit("        // %s" % output.name)
+        function = "DecodeArray" if output.shape == "array" else "DecodeValue"
+        emit("        %s(variantContainer, present, ResultData::%s, result.%s, result," % (function, output.enum, output.name))
+        emit("            [](const CVariant& value) { return value.%s(); });" % output.conversion)
+    emit("    }")
+    emit("")
+    emit("private:")
+    emit("    std::atomic<uint32_t> m_present{~0u}; // Bit per output any registered recipe has")
+    emit("    bool m_registered{false};")
+    emit("")
+    emit("    // The value of an output, or nullptr if it was not pushed or carries an error, which is recorded in result.")
+    emit("    static const CVariant* Find(const CVariantContainer& variantContainer, uint32_t present, ResultData::Output output, ResultData& result)")
+    emit("    {")
+    emit("        if (!(present & (1u << output)))")
+    emit("            return nullptr;")
+    emit("        auto pos = variantContainer.find(ResultData::OutputName(output));")
+    emit("        if (pos == variantContainer.end())")
+    emit("            return nullptr;")
+    emit("        if (pos->second.HasError())")
+    emit("        {")
+    emit("            result.hasError = true;")
+    emit("            result.errorMessage = pos->second.GetErrorDescription();")
+    emit("            return nullptr;")
+    emit("        }")
+    emit("        return &pos->second;")
+    emit("    }")
+    emit("")
+    emit("    template <typename T, typename Convert>")
+    emit("    static void DecodeArray(const CVariantContainer& variantContainer, uint32_t present, ResultData::Output output,")
+    emit("                            std::vector<T>& values, ResultData& result, Convert convert)")
+    emit("    {")
+    emit("        values.clear();")
+    emit("        const CVariant* value = Find(variantContainer, present, output, result);")
+    emit("        if (!value)")
+    emit("            return;")
+    emit("        size_t count = value->GetNumArrayValues();")
+    emit("        values.reserve(count);")
+    emit("        for (size_t i = 0; i < count; ++i)")
+    emit("        {")
+    emit("            const CVariant element = value->GetArrayValue(i);")
+    emit("            if (element.HasError())")
+    emit("            {")
+    emit("                result.hasError = true;")
+    emit("                result.errorMessage = element.GetErrorDescription();")
+    emit("                return;")
+    emit("            }")
+    emit("            values.push_back(convert(element));")
+    emit("        }")
+    emit("    }")
+    emit("")
+    emit("    template <typename T, typename Convert>")
+    emit("    static void DecodeValue(const CVariantContainer& variantContainer, uint32_t present, ResultData::Output output,")
+    emit("                            T& field, ResultData& result, Convert convert)")
+    emit("    {")
+    emit("        const CVariant* value = Find(variantContainer, present, output, result);")
+    emit("        field = value ? convert(*value) : T();")
+    emit("    }")
+    emit("};")
+    emit("")
+    emit("#endif // RESULT_DATA_H")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("schema", nargs="?", default=DEFAULT_SCHEMA)
+    parser.add_argument("header", nargs="?", default=DEFAULT_HEADER)
+    parser.add_argument("--check", action="store_true")
+    args = parser.parse_args()
+
+    try:
+        outputs = parse_schema(args.schema)
+    except (OSError, ValueError) as e:
+        print("gen_result_data: %s" % e, file=sys.stderr)
+        return 1
+    text = generate(outputs, os.path.basename(args.schema))
+
+    if args.check:
+        try:
+            with open(args.header) as header:
+                current = header.read()
+        except OSError:
+            current = None
+        if current != text:
+            print("gen_result_data: %s is out of date with %s" % (args.header, args.schema), file=sys.stderr)
+            return 1
+        return 0
+
+    with open(args.header, "w", newline="\n") as header:
+        header.write(text)
+    print("gen_result_data: wrote %d outputs to %s" % (len(outputs), args.header))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,101 @@
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include "../include/tolerance_stack.h"
+
+// Estimates the probability of a mate landing within XY_TOLERANCE and Z_TOLERANCE.
+// Native counterpart of monte_carlo/monte_carlo.py, running the scanner's refinement logic on all cores.
+//
+// Usage: monte_carlo [--trials N] [--threads N] [--seed N] [--stack-only] [--<parameter> value]...
+// Parameters are the fields of ToleranceModel, e.g. --fixed-tolerance 0.05 or --gripper-xy 0.1.
+
+void PrintUsage(const std::map<std::string, double*>& parameters) {
+    std::cout << "Usage: monte_carlo [--trials N] [--threads N] [--seed N] [--stack-only] [--<parameter> value]..." << std::endl;
+    std::cout << "Parameters (mm unless noted):" << std::endl;
+    for (auto& [name, value] : parameters) {
+        std::cout << "  --" << std::left << std::setw(22) << name << *value << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ToleranceModel model;
+    uint64_t trials = 10000000;
+    uint64_t seed = 1;
+    size_t num_threads = 0;
+
+    std::map<std::string, double*> parameters {
+        {"xy-tolerance", &model.xy_tolerance},
+        {"z-tolerance", &model.z_tolerance},
+        {"encoder-xy", &model.encoder_xy},
+        {"encoder-z", &model.encoder_z},
+        {"gripper-xy", &model.gripper_xy},
+        {"gripper-z", &model.gripper_z},
+        {"camera-xy", &model.camera_xy},
+        {"camera-z", &model.camera_z},
+        {"mobile-tolerance", &model.mobile_tolerance},
+        {"fixed-tolerance", &model.fixed_tolerance},
+        {"mobile-scale-factor", &model.mobile_scale_factor},
+        {"fixed-scale-factor", &model.fixed_scale_factor},
+        {"camera-gain", &model.camera_gain},
+        {"initial-error", &model.initial_error},
+        {"frame-noise", &model.refinement.frame_noise},
+        {"confidence", &model.refinement.confidence},
+        {"trim-fraction", &model.refinement.trim_fraction},
+    };
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                PrintUsage(parameters);
+                return 0;
+            }
+            if (arg == "--stack-only") {
+                model.simulate_refinement = false;
+                continue;
+            }
+            if (i + 1 >= argc)
+                throw std::runtime_error(arg + " flag provided but no value specified");
+
+            std::string value = argv[++i];
+            if (arg == "--trials")
+                trials = static_cast<uint64_t>(std::stod(value));
+            else if (arg == "--threads")
+                num_threads = std::stoul(value);
+            else if (arg == "--seed")
+                seed = std::stoull(value);
+            else if (arg == "--min-frames")
+                model.refinement.min_frames = std::stoi(value);
+            else if (arg == "--max-frames")
+                model.refinement.max_frames = std::stoi(value);
+            else if (arg.rfind("--", 0) == 0 && parameters.count(arg.substr(2)))
+                *parameters[arg.substr(2)] = std::stod(value);
+            else
+                throw std::runtime_error(arg + " flag not recognized");
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        PrintUsage(parameters);
+        return 1;
+    }
+
+    auto estimate = SimulateMates(model, trials, seed, num_threads);
+
+    std::cout << std::fixed << std::setprecision(4)
+              << (model.simulate_refinement ? "Refinement simulated" : "Uncertainties summed") << ", "
+              << estimate.trials << " trials" << std::endl
+              << "P(mate within tolerance) = " << 100.0 * estimate.Probability() << " % +/- "
+              << 100.0 * estimate.StandardError() << " %" << std::endl;
+    if (model.simulate_refinement) {
+        std::cout << "Refinement failures " << 100.0 * estimate.refine_failures / (std::max)(estimate.trials, uint64_t(1))
+                  << " %, mean moves " << estimate.MeanMoves() << ", mean frames " << estimate.MeanFrames() << std::endl;
+    }
+    std::cout << std::setprecision(3) << estimate.seconds << " s, " << estimate.TrialsPerSecond() / 1e6
+              << " M trials/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../include/logging.h"
+#include "../include/cycle_parameters.h"
+#include "../include/cycle_simulator.h"
+
+// Tunes scan and refine parameters on the cycle simulator and reports the Pareto front of mean cycle time
+// against mate success rate.
+//
+// Usage: tune [--cycles N] [--threads N] [--seed N]
+//             [--grid name=min:max:step]... [--search] [--generations N]
+//             [--export file.ini] [--min-success fraction]
+//
+// --grid sweeps the named parameters over a grid, all others keep their defaults. --search runs a
+// separable CMA-ES over all tunable parameters for several trade-offs between time and success.
+// Without either, the default grid is swept. --export writes the fastest parameter set on the front
+// reaching --min-success as the [cycle] section of an INI file, keys named after CycleParameters fields.
+
+// The scan and refine loops log every frame they miss, which would drown the report
+int Logger::log_level_ = Logger::Level::OFF;
+
+/**
+ * A parameter of CycleParameters the tuner may change.
+ */
+struct Tunable {
+    std::string name; // Same as the CycleParameters field and the config key
+    double min;
+    double max;
+    bool integer;
+    std::function<double(const CycleParameters&)> get;
+    std::function<void(CycleParameters&, double)> set;
+};
+
+std::vector<Tunable> Tunables() {
+    return {
+        {"scan_width", 15.0, 60.0, false,
+            [](const CycleParameters& p) { return p.scan_width; }, [](CycleParameters& p, double v) { p.scan_width = v; }},
+        {"scan_speed", 50.0, 400.0, true,
+            [](const CycleParameters& p) { return double(p.scan_speed); }, [](CycleParameters& p, double v) { p.scan_speed = int(v); }},
+        {"refinement_speed", 20.0, 400.0, true,
+            [](const CycleParameters& p) { return double(p.refinement_speed); }, [](CycleParameters& p, double v) { p.refinement_speed = int(v); }},
+        {"mobile_scale_factor", 0.3, 1.0, false,
+            [](const CycleParameters& p) { return p.mobile_scale_factor; }, [](CycleParameters& p, double v) { p.mobile_scale_factor = v; }},
+        {"fixed_scale_factor", 0.3, 1.0, false,
+            [](const CycleParameters& p) { return p.fixed_scale_factor; }, [](CycleParameters& p, double v) { p.fixed_scale_factor = v; }},
+        {"mobile_tolerance", 0.05, 2.0, false,
+            [](const CycleParameters& p) { return p.mobile_tolerance; }, [](CycleParameters& p, double v) { p.mobile_tolerance = v; }},
+        {"fixed_tolerance", 0.02, 0.5, false,
+            [](const CycleParameters& p) { return p.fixed_tolerance; }, [](CycleParameters& p, double v) { p.fixed_tolerance = v; }},
+    };
+}
+
+struct Evaluation {
+    std::vector<double> values; // One per tunable
+    CycleEstimate estimate;
+};
+
+class Tuner {
+public:
+    Tuner(uint64_t cycles, uint64_t seed, size_t num_threads)
+        : tunables_(Tunables()), cycles_(cycles), seed_(seed), num_threads_(num_threads) {}
+
+    const std::vector<Tunable>& Parameters() const {
+        return tunables_;
+    }
+
+    const std::vector<Evaluation>& Archive() const {
+        return archive_;
+    }
+
+    CycleParameters Apply(const std::vector<double>& values) const {
+        CycleParameters parameters = base_;
+        for (size_t i = 0; i < tunables_.size(); ++i) {
+            tunables_[i].set(parameters, values[i]);
+        }
+        return parameters;
+    }
+
+    std::vector<double> Defaults() const {
+        std::vector<double> values;
+        for (auto& tunable : tunables_) {
+            values.push_back(tunable.get(base_));
+        }
+        return values;
+    }
+
+    const Evaluation& Evaluate(std::vector<double> values) {
+        for (size_t i = 0; i < tunables_.size(); ++i) {
+            values[i] = (std::min)((std::max)(values[i], tunables_[i].min), tunables_[i].max);
+            if (tunables_[i].integer)
+                values[i] = std::round(values[i]);
+        }
+        archive_.push_back({values, SimulateCycles(Apply(values), world_, cycles_, seed_, num_threads_)});
+        return archive_.back();
+    }
+
+    /**
+     * Evaluates every combination of the swept parameters. Parameters not swept keep their defaults.
+     * \param sweeps Index of the tunable and the values it takes
+     */
+    void Grid(const std::vector<std::pair<size_t, std::vector<double>>>& sweeps) {
+        std::vector<size_t> index(sweeps.size(), 0);
+        while (true) {
+            auto values = Defaults();
+            for (size_t i = 0; i < sweeps.size(); ++i) {
+                values[sweeps[i].first] = sweeps[i].second[index[i]];
+            }
+            Print(Evaluate(values));
+
+            size_t i = 0;
+            for (; i < sweeps.size(); ++i) {
+                if (++index[i] < sweeps[i].second.size())
+                    break;
+                index[i] = 0;
+            }
+            if (i == sweeps.size())
+                return;
+        }
+    }
+
+    /**
+     * Separable CMA-ES minimizing mean time relative to the defaults plus weight times the failure rate.
+     * Runs are repeated for several weights so the evaluations spread along the Pareto front.
+     */
+    void Search(const std::vector<double>& weights, int generations) {
+        const size_t n = tunables_.size();
+        const size_t lambda = 4 + static_cast<size_t>(3.0 * std::log(double(n)));
+        const size_t mu = lambda / 2;
+
+        std::vector<double> w(mu);
+        double sum = 0.0;
+        for (size_t i = 0; i < mu; ++i) {
+            w[i] = std::log(mu + 0.5) - std::log(i + 1.0);
+            sum += w[i];
+        }
+        double sum_squares = 0.0;
+        for (auto& weight : w) {
+            weight /= sum;
+            sum_squares += weight * weight;
+        }
+        const double mu_eff = 1.0 / sum_squares;
+
+        const double c_sigma = (mu_eff + 2.0) / (n + mu_eff + 5.0);
+        const double d_sigma = 1.0 + 2.0 * (std::max)(0.0, std::sqrt((mu_eff - 1.0) / (n + 1.0)) - 1.0) + c_sigma;
+        const double c_c = (4.0 + mu_eff / n) / (n + 4.0 + 2.0 * mu_eff / n);
+        const double c_1 = 2.0 / ((n + 1.3) * (n + 1.3) + mu_eff) * (n + 2.0) / 3.0;
+        const double c_mu = (std::min)(1.0 - c_1, 2.0 * (mu_eff - 2.0 + 1.0 / mu_eff) / ((n + 2.0) * (n + 2.0) + mu_eff) * (n + 2.0) / 3.0);
+        const double expected_norm = std::sqrt(double(n)) * (1.0 - 1.0 / (4.0 * n) + 1.0 / (21.0 * n * n));
+
+        double baseline = Evaluate(Defaults()).estimate.MeanTime();
+        std::mt19937 rng(static_cast<uint32_t>(seed_));
+        std::normal_distribution<double> normal(0.0, 1.0);
+
+        for (double weight : weights) {
+            std::cout << "Search, failure weight " << weight << std::endl;
+            auto objective = [&](const CycleEstimate& estimate) {
+                return estimate.MeanTime() / baseline + weight * (1.0 - estimate.SuccessRate());
+            };
+
+            // Search in coordinates normalized to [0, 1], starting from the defaults
+            std::vector<double> mean = Normalize(Defaults());
+            std::vector<double> c(n, 1.0), p_sigma(n, 0.0), p_c(n, 0.0);
+            double sigma = 0.2;
+
+            for (int generation = 0; generation < generations; ++generation) {
+                std::vector<std::vector<double>> y(lambda, std::vector<double>(n));
+                std::vector<std::pair<double, size_t>> ranked;
+
+                for (size_t k = 0; k < lambda; ++k) {
+                    std::vector<double> x(n);
+                    for (size_t i = 0; i < n; ++i) {
+                        y[k][i] = std::sqrt(c[i]) * normal(rng);
+                        x[i] = (std::min)((std::max)(mean[i] + sigma * y[k][i], 0.0), 1.0);
+                        y[k][i] = (x[i] - mean[i]) / sigma; // Step actually taken after clamping
+                    }
+                    ranked.emplace_back(objective(Evaluate(Denormalize(x)).estimate), k);
+                }
+                std::sort(ranked.begin(), ranked.end());
+
+                std::vector<double> y_w(n, 0.0);
+                for (size_t j = 0; j < mu; ++j) {
+                    for (size_t i = 0; i < n; ++i) {
+                        y_w[i] += w[j] * y[ranked[j].second][i];
+                    }
+                }
+
+                double p_sigma_norm = 0.0;
+                for (size_t i = 0; i < n; ++i) {
+                    mean[i] = (std::min)((std::max)(mean[i] + sigma * y_w[i], 0.0), 1.0);
+                    p_sigma[i] = (1.0 - c_sigma) * p_sigma[i] + std::sqrt(c_sigma * (2.0 - c_sigma) * mu_eff) * y_w[i] / std::sqrt(c[i]);
+                    p_sigma_norm += p_sigma[i] * p_sigma[i];
+                }
+                p_sigma_norm = std::sqrt(p_sigma_norm);
+
+                double h_sigma = p_sigma_norm / std::sqrt(1.0 - std::pow(1.0 - c_sigma, 2.0 * (generation + 1))) <
+                                 (1.4 + 2.0 / (n + 1.0)) * expected_norm ? 1.0 : 0.0;
+
+                for (size_t i = 0; i < n; ++i) {
+                    p_c[i] = (1.0 - c_c) * p_c[i] + h_sigma * std::sqrt(c_c * (2.0 - c_c) * mu_eff) * y_w[i];
+                    double rank_mu = 0.0;
+                    for (size_t j = 0; j < mu; ++j) {
+                        double step = y[ranked[j].second][i];
+                        rank_mu += w[j] * step * step;
+                    }
+                    c[i] = (1.0 - c_1 - c_mu) * c[i] + c_1 * p_c[i] * p_c[i] + c_mu * rank_mu;
+                }
+                sigma *= std::exp(c_sigma / d_sigma * (p_sigma_norm / expected_norm - 1.0));
+
+                auto& best = archive_[archive_.size() - lambda + ranked[0].second];
+                std::cout << "  generation " << std::setw(2) << generation << " best ";
+                Print(best);
+            }
+        }
+    }
+
+    /**
+     * \return Evaluations not beaten in both mean time and success rate by any other, fastest first
+     */
+    std::vector<const Evaluation*> ParetoFront() const {
+        std::vector<const Evaluation*> sorted;
+        for (auto& evaluation : archive_) {
+            sorted.push_back(&evaluation);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const Evaluation* a, const Evaluation* b) {
+            if (a->estimate.MeanTime() != b->estimate.MeanTime())
+                return a->estimate.MeanTime() < b->estimate.MeanTime();
+            return a->estimate.SuccessRate() > b->estimate.SuccessRate();
+        });
+
+        std::vector<const Evaluation*> front;
+        double best_success = -1.0;
+        for (auto* evaluation : sorted) {
+            if (evaluation->estimate.SuccessRate() > best_success) {
+                front.push_back(evaluation);
+                best_success = evaluation->estimate.SuccessRate();
+            }
+        }
+        return front;
+    }
+
+    void Print(const Evaluation& evaluation) const {
+        std::cout << std::fixed << std::setprecision(2) << "success " << std::setw(6) << 100.0 * evaluation.estimate.SuccessRate()
+                  << " %, time " << std::setw(6) << evaluation.estimate.MeanTime() << " s |";
+        for (size_t i = 0; i < tunables_.size(); ++i) {
+            std::cout << " " << tunables_[i].name << " " << std::setprecision(tunables_[i].integer ? 0 : 3) << evaluation.values[i];
+        }
+        std::cout << std::endl;
+    }
+
+    /**
+     * Writes a parameter set as the [cycle] section of a config file.
+     */
+    void Export(const Evaluation& evaluation, const std::string& path) const {
+        std::ofstream file(path);
+        if (!file)
+            throw std::runtime_error("Could not open " + path + " for writing");
+
+        file << "; Exported by tune: " << std::fixed << std::setprecision(2) << 100.0 * evaluation.estimate.SuccessRate()
+             << " % success, " << evaluation.estimate.MeanTime() << " s mean cycle over " << evaluation.estimate.cycles
+             << " simulated cycles" << std::endl;
+        file << "[cycle]" << std::endl;
+        for (size_t i = 0; i < tunables_.size(); ++i) {
+            file << tunables_[i].name << " = " << std::setprecision(tunables_[i].integer ? 0 : 4) << evaluation.values[i] << std::endl;
+        }
+    }
+
+private:
+    std::vector<Tunable> tunables_;
+    CycleParameters base_;
+    SimulatedWorld world_;
+    uint64_t cycles_;
+    uint64_t seed_;
+    size_t num_threads_;
+    std::vector<Evaluation> archive_;
+
+    std::vector<double> Normalize(const std::vector<double>& values) const {
+        std::vector<double> normalized;
+        for (size_t i = 0; i < tunables_.size(); ++i) {
+            normalized.push_back((values[i] - tunables_[i].min) / (tunables_[i].max - tunables_[i].min));
+        }
+        return normalized;
+    }
+
+    std::vector<double> Denormalize(const std::vector<double>& normalized) const {
+        std::vector<double> values;
+        for (size_t i = 0; i < tunables_.size(); ++i) {
+            values.push_back(tunables_[i].min + normalized[i] * (tunables_[i].max - tunables_[i].min));
+        }
+        return values;
+    }
+};
+
+/**
+ * Parses name=min:max:step.
+ */
+std::pair<size_t, std::vector<double>> ParseSweep(const std::string& description, const std::vector<Tunable>& tunables) {
+    auto equals = description.find('=');
+    std::string name = description.substr(0, equals);
+    auto it = std::find_if(tunables.begin(), tunables.end(), [&](const Tunable& t) { return t.name == name; });
+    if (equals == std::string::npos || it == tunables.end())
+        throw std::runtime_error("Invalid sweep '" + description + "'. Expected name=min:max:step with a tunable parameter name");
+
+    std::vector<double> range;
+    std::stringstream stream(description.substr(equals + 1));
+    std::string field;
+    while (std::getline(stream, field, ':')) {
+        range.push_back(std::stod(field));
+    }
+    if (range.size() != 3 || range[2] <= 0.0 || range[1] < range[0])
+        throw std::runtime_error("Invalid sweep range in '" + description + "'");
+
+    std::vector<double> values;
+    for (double value = range[0]; value <= range[1] + 1e-9; value += range[2]) {
+        values.push_back(value);
+    }
+    return {static_cast<size_t>(it - tunables.begin()), values};
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t cycles = 2000;
+    uint64_t seed = 1;
+    size_t num_threads = 0;
+    int generations = 15;
+    bool search = false;
+    double min_success = 0.95;
+    std::string export_path;
+    std::vector<std::string> sweeps;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--search") {
+                search = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                throw std::runtime_error(arg + " flag provided but no value specified");
+
+            std::string value = argv[++i];
+            if (arg == "--cycles")
+                cycles = static_cast<uint64_t>(std::stod(value));
+            else if (arg == "--threads")
+                num_threads = std::stoul(value);
+            else if (arg == "--seed")
+                seed = std::stoull(value);
+            else if (arg == "--generations")
+                generations = std::stoi(value);
+            else if (arg == "--grid")
+                sweeps.push_back(value);
+            else if (arg == "--export")
+                export_path = value;
+            else if (arg == "--min-success")
+                min_success = std::stod(value);
+            else
+                throw std::runtime_error(arg + " flag not recognized");
+        }
+
+        Tuner tuner(cycles, seed, num_threads);
+
+        if (!sweeps.empty() || !search) {
+            if (sweeps.empty())
+                sweeps = {"scan_width=25:45:10", "scan_speed=100:400:100", "fixed_scale_factor=0.5:0.9:0.2"};
+
+            std::vector<std::pair<size_t, std::vector<double>>> grid;
+            for (auto& sweep : sweeps) {
+                grid.push_back(ParseSweep(sweep, tuner.Parameters()));
+            }
+            std::cout << "Grid" << std::endl;
+            tuner.Grid(grid);
+        }
+
+        if (search)
+            tuner.Search({0.5, 2.0, 8.0, 32.0}, generations);
+
+        auto front = tuner.ParetoFront();
+        std::cout << std::endl << "Pareto front of " << tuner.Archive().size() << " parameter sets, "
+                  << cycles << " simulated cycles each" << std::endl;
+        for (auto* evaluation : front) {
+            tuner.Print(*evaluation);
+        }
+
+        if (!export_path.empty()) {
+            auto chosen = std::find_if(front.begin(), front.end(),
+                                       [&](const Evaluation* e) { return e->estimate.SuccessRate() >= min_success; });
+            if (chosen == front.end())
+                throw std::runtime_error("No parameter set reached a success rate of " + std::to_string(min_success));
+            tuner.Export(**chosen, export_path);
+            std::cout << "Exported to " << export_path << ": ";
+            tuner.Print(**chosen);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}